@@ -0,0 +1,102 @@
+#include "PreCompile.h"
+#include "MappedFile.h"     // Pick up forward declarations to ensure correctness.
+
+#if defined(_WIN32)
+
+Mapped_file::Mapped_file(_In_ const char* filename)
+{
+    const HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(INVALID_HANDLE_VALUE == file)
+    {
+        return;
+    }
+
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(m_file, &size) || (0 == size.QuadPart) || (static_cast<uint64_t>(size.QuadPart) > SIZE_MAX))
+    {
+        return;
+    }
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(nullptr == m_mapping)
+    {
+        return;
+    }
+
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    m_size = (nullptr == m_data) ? 0 : static_cast<size_t>(size.QuadPart);
+}
+
+Mapped_file::~Mapped_file()
+{
+    if(nullptr != m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+
+    if(nullptr != m_mapping)
+    {
+        CloseHandle(m_mapping);
+    }
+
+    if(nullptr != m_file)
+    {
+        CloseHandle(m_file);
+    }
+}
+
+#else
+
+Mapped_file::Mapped_file(_In_ const char* filename)
+{
+    m_file = open(filename, O_RDONLY);
+    if(-1 == m_file)
+    {
+        return;
+    }
+
+    struct stat status;
+    if((0 != fstat(m_file, &status)) || (0 == status.st_size) || (static_cast<uint64_t>(status.st_size) > SIZE_MAX))
+    {
+        return;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, m_file, 0);
+    if(MAP_FAILED != data)
+    {
+        m_data = static_cast<const uint8_t*>(data);
+        m_size = static_cast<size_t>(status.st_size);
+    }
+}
+
+Mapped_file::~Mapped_file()
+{
+    if(nullptr != m_data)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+
+    if(-1 != m_file)
+    {
+        close(m_file);
+    }
+}
+
+#endif
+
+bool Mapped_file::is_open() const
+{
+    return nullptr != m_data;
+}
+
+const uint8_t* Mapped_file::data() const
+{
+    return m_data;
+}
+
+size_t Mapped_file::size() const
+{
+    return m_size;
+}
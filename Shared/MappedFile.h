@@ -0,0 +1,31 @@
+#pragma once
+
+// Read-only view of a whole file, mapped into memory.  Pages are loaded by the
+// OS on first use and shared between processes mapping the same file, so large
+// files (such as a seed index) are not read up front.
+class Mapped_file
+{
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+#if defined(_WIN32)
+    void* m_file = nullptr;             // HANDLE, kept opaque so windows.h isn't needed here.
+    void* m_mapping = nullptr;          // HANDLE
+#else
+    int m_file = -1;
+#endif
+
+    // Not implemented to prevent accidental copying/moving.
+    Mapped_file(const Mapped_file&) = delete;
+    Mapped_file(Mapped_file&&) noexcept = delete;
+    Mapped_file& operator=(const Mapped_file&) = delete;
+    Mapped_file& operator=(Mapped_file&&) noexcept = delete;
+
+public:
+    // If the file can't be opened or mapped, is_open() is false.
+    explicit Mapped_file(_In_ const char* filename);
+    ~Mapped_file();
+
+    bool is_open() const;
+    const uint8_t* data() const;
+    size_t size() const;
+};
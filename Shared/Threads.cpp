@@ -0,0 +1,13 @@
+#include "PreCompile.h"
+#include "Threads.h"        // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+unsigned int resolve_thread_count(unsigned int thread_count)
+{
+    if(0 == thread_count)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return thread_count;
+}
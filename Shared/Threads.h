@@ -0,0 +1,46 @@
+#pragma once
+
+// Threads for a thread_count of 0, which means every hardware thread.
+// Always at least one.
+unsigned int resolve_thread_count(unsigned int thread_count);
+
+//---------------------------------------------------------------------------
+// Call worker() on thread_count threads (0 for every hardware thread), but no
+// more than max_threads, including the calling one.  The workers share out
+// the work among themselves, e.g. by taking tasks from an atomic counter, so
+// each can keep its own state (workspaces, partial results) without locking.
+template<typename Worker>
+void run_workers(unsigned int thread_count, size_t max_threads, const Worker& worker)
+{
+    const size_t worker_count = std::max<size_t>(1, std::min<size_t>(resolve_thread_count(thread_count), max_threads));
+
+    std::vector<std::thread> threads;
+    for(size_t ii = 1; ii < worker_count; ++ii)
+    {
+        threads.emplace_back([&worker]() { worker(); });
+    }
+
+    worker();
+
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+//---------------------------------------------------------------------------
+// Call task(0) to task(task_count - 1) on up to thread_count threads (0 for
+// every hardware thread), including this one.  Each thread takes the next
+// task when it finishes one, so uneven tasks still keep every thread busy.
+template<typename Task>
+void run_tasks(size_t task_count, unsigned int thread_count, const Task& task)
+{
+    std::atomic<size_t> next_task(0);
+    run_workers(thread_count, task_count, [&]()
+    {
+        for(size_t ii = next_task++; ii < task_count; ii = next_task++)
+        {
+            task(ii);
+        }
+    });
+}
@@ -36,3 +36,98 @@ std::string read_fasta_file(_In_ const char* filename)
     return read_fasta_stream(input_file, size);
 }
 
+
+Fasta_reader::Fasta_reader(std::istream& input) : m_input(input)
+{
+}
+
+static bool is_fasta_header(const std::string& line)
+{
+    return !line.empty() && (line[0] == '>');
+}
+
+// Reads the next record.  Lines before the first header and ';' comment
+// lines are skipped, and line endings and whitespace are not kept.
+bool Fasta_reader::read_record(Fasta_record& record)
+{
+    while(!m_has_header && std::getline(m_input, m_line))
+    {
+        m_has_header = is_fasta_header(m_line);
+    }
+
+    if(!m_has_header)
+    {
+        return false;
+    }
+
+    record.name.assign(m_line, 1, std::string::npos);
+    while(!record.name.empty() && isspace(static_cast<unsigned char>(record.name.back())))
+    {
+        record.name.pop_back();
+    }
+
+    record.sequence.clear();
+    m_has_header = false;
+
+    while(std::getline(m_input, m_line))
+    {
+        if(is_fasta_header(m_line))
+        {
+            m_has_header = true;
+            break;
+        }
+
+        if(!m_line.empty() && (m_line[0] == ';'))
+        {
+            continue;
+        }
+
+        for(char residue : m_line)
+        {
+            if(!isspace(static_cast<unsigned char>(residue)))
+            {
+                record.sequence.push_back(residue);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+Fasta_chunk_reader::Fasta_chunk_reader(std::istream& input) : m_input(input)
+{
+}
+
+bool Fasta_chunk_reader::read_chunk(std::string& chunk, size_t max_size)
+{
+    chunk.clear();
+
+    while(chunk.size() < max_size)
+    {
+        if(m_position == m_line.size())
+        {
+            if(!std::getline(m_input, m_line))
+            {
+                m_position = m_line.size();
+                break;
+            }
+
+            // Skip headers and comments by starting at the end of the line.
+            const bool is_residue_line = !is_fasta_header(m_line) && (m_line.empty() || (m_line[0] != ';'));
+            m_position = is_residue_line ? 0 : m_line.size();
+            continue;
+        }
+
+        const size_t end = m_position + std::min(max_size - chunk.size(), m_line.size() - m_position);
+        for(; m_position < end; ++m_position)
+        {
+            if(!isspace(static_cast<unsigned char>(m_line[m_position])))
+            {
+                chunk.push_back(m_line[m_position]);
+            }
+        }
+    }
+
+    return !chunk.empty();
+}
@@ -2,3 +2,42 @@
 
 std::string read_fasta_file(_In_ const char* filename);
 
+
+// One record of a multi-record FASTA file.
+struct Fasta_record
+{
+    std::string name;           // Header line, without the leading '>'.
+    std::string sequence;       // Residues of every line up to the next header.
+};
+
+// Reads the records of a FASTA stream one at a time, so that files with
+// millions of records can be processed without holding them all in memory.
+class Fasta_reader
+{
+    std::istream& m_input;
+    std::string m_line;         // Header line of the next record, once read.
+    bool m_has_header = false;  // True if m_line holds the next header.
+
+public:
+    explicit Fasta_reader(std::istream& input);
+
+    // Returns false when there are no more records.
+    bool read_record(Fasta_record& record);
+};
+
+// Reads the residues of a FASTA stream in chunks of bounded size, so that a
+// multi-gigabase sequence can be processed without holding it in memory.
+// Headers and ';' comment lines are skipped, and like read_fasta_file, the
+// residues of successive records are joined.
+class Fasta_chunk_reader
+{
+    std::istream& m_input;
+    std::string m_line;         // Line being read.
+    size_t m_position = 0;      // Position of the next residue in m_line.
+
+public:
+    explicit Fasta_chunk_reader(std::istream& input);
+
+    // Replaces chunk with up to max_size residues.  Returns false when there are no more.
+    bool read_chunk(std::string& chunk, size_t max_size);
+};
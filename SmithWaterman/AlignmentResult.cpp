@@ -0,0 +1,224 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "AlignmentResult.h"    // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Layout of one binary result.  The record is followed by the names and the
+// CIGAR string, with no terminators.
+struct Binary_result_record
+{
+    uint64_t begin1;
+    uint64_t end1;
+    uint64_t begin2;
+    uint64_t end2;
+    double pvalue;
+    int32_t score;
+    uint32_t name1_length;
+    uint32_t name2_length;
+    uint32_t cigar_length;
+};
+
+// The buffer is written out once it grows past this.
+constexpr size_t result_buffer_size = 64 * 1024;
+
+//---------------------------------------------------------------------------
+std::string alignment_cigar(const Local_alignment& alignment)
+{
+    assert(alignment.aligned1.size() == alignment.aligned2.size());
+
+    std::string cigar;
+    char operation = '\0';
+    size_t run_length = 0;
+
+    for(size_t ix = 0; ix <= alignment.aligned1.size(); ++ix)
+    {
+        char next_operation = '\0';
+        if(ix < alignment.aligned1.size())
+        {
+            next_operation = (alignment.aligned1[ix] == gap_character) ? 'I' :
+                             (alignment.aligned2[ix] == gap_character) ? 'D' : 'M';
+        }
+
+        if((next_operation != operation) && (run_length > 0))
+        {
+            cigar += std::to_string(run_length);
+            cigar += operation;
+            run_length = 0;
+        }
+
+        operation = next_operation;
+        ++run_length;
+    }
+
+    return cigar.empty() ? "*" : cigar;
+}
+
+//---------------------------------------------------------------------------
+Alignment_result make_alignment_result(const Local_alignment& alignment)
+{
+    Alignment_result result;
+    result.score = alignment.score;
+    result.begin1 = alignment.begin1;
+    result.end1 = alignment.end1;
+    result.begin2 = alignment.begin2;
+    result.end2 = alignment.end2;
+    result.cigar = alignment_cigar(alignment);
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+Alignment_result make_score_result(int score)
+{
+    Alignment_result result;
+    result.score = score;
+    result.cigar = "*";
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+Result_writer::Result_writer(std::ostream& output_stream, Result_format format)
+    : m_output_stream(output_stream)
+    , m_format(format)
+{
+    m_buffer.reserve(result_buffer_size * 2);
+}
+
+//---------------------------------------------------------------------------
+Result_writer::~Result_writer()
+{
+    flush();
+}
+
+//---------------------------------------------------------------------------
+// Format a number without the locale lookups of an ostream.
+void Result_writer::append_number(uint64_t number)
+{
+    char digits[20];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while(number != 0);
+
+    while(count > 0)
+    {
+        m_buffer.push_back(digits[--count]);
+    }
+}
+
+//---------------------------------------------------------------------------
+void Result_writer::append_tsv(const std::string& name1, const std::string& name2, const Alignment_result& result)
+{
+    m_buffer += name1;
+    m_buffer += '\t';
+    m_buffer += name2;
+    m_buffer += '\t';
+    m_buffer += std::to_string(result.score);
+    m_buffer += '\t';
+
+    // A result that was not traced back has no coordinates.
+    if(result.cigar != "*")
+    {
+        append_number(result.begin1 + 1);
+        m_buffer += '\t';
+        append_number(result.end1);
+        m_buffer += '\t';
+        append_number(result.begin2 + 1);
+        m_buffer += '\t';
+        append_number(result.end2);
+    }
+    else
+    {
+        m_buffer += "*\t*\t*\t*";
+    }
+
+    m_buffer += '\t';
+    m_buffer += result.cigar;
+    m_buffer += '\t';
+
+    if(result.pvalue >= 0.0)
+    {
+        char pvalue_text[32];
+        snprintf(pvalue_text, sizeof(pvalue_text), "%.3g", result.pvalue);
+        m_buffer += pvalue_text;
+    }
+    else
+    {
+        m_buffer += '*';
+    }
+
+    m_buffer += '\n';
+}
+
+//---------------------------------------------------------------------------
+// The sequences are not kept in a result, so SEQ and QUAL are '*', and
+// the unaligned ends of the read are not clipped in the CIGAR string.
+void Result_writer::append_sam(const std::string& name1, const std::string& name2, const Alignment_result& result)
+{
+    const bool is_aligned = (result.cigar != "*");
+
+    m_buffer += name2;
+    m_buffer += is_aligned ? "\t0\t" : "\t4\t";
+    m_buffer += name1;
+    m_buffer += '\t';
+    append_number(is_aligned ? result.begin1 + 1 : 0);
+    m_buffer += "\t255\t";
+    m_buffer += result.cigar;
+    m_buffer += "\t*\t0\t0\t*\t*\tAS:i:";
+    m_buffer += std::to_string(result.score);
+
+    if(result.pvalue >= 0.0)
+    {
+        char pvalue_text[32];
+        snprintf(pvalue_text, sizeof(pvalue_text), "\tXP:f:%g", result.pvalue);
+        m_buffer += pvalue_text;
+    }
+
+    m_buffer += '\n';
+}
+
+//---------------------------------------------------------------------------
+void Result_writer::append_binary(const std::string& name1, const std::string& name2, const Alignment_result& result)
+{
+    Binary_result_record record;
+    record.begin1 = result.begin1;
+    record.end1 = result.end1;
+    record.begin2 = result.begin2;
+    record.end2 = result.end2;
+    record.pvalue = result.pvalue;
+    record.score = result.score;
+    record.name1_length = static_cast<uint32_t>(name1.size());
+    record.name2_length = static_cast<uint32_t>(name2.size());
+    record.cigar_length = static_cast<uint32_t>(result.cigar.size());
+
+    m_buffer.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    m_buffer += name1;
+    m_buffer += name2;
+    m_buffer += result.cigar;
+}
+
+//---------------------------------------------------------------------------
+void Result_writer::write(const std::string& name1, const std::string& name2, const Alignment_result& result)
+{
+    switch(m_format)
+    {
+        case Result_format::tsv:    append_tsv(name1, name2, result); break;
+        case Result_format::sam:    append_sam(name1, name2, result); break;
+        case Result_format::binary: append_binary(name1, name2, result); break;
+    }
+
+    if(m_buffer.size() >= result_buffer_size)
+    {
+        flush();
+    }
+}
+
+//---------------------------------------------------------------------------
+void Result_writer::flush()
+{
+    m_output_stream.write(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Hirschberg.h"
+
+//---------------------------------------------------------------------------
+// Result of a local alignment that can be kept, compared and written without
+// the aligned strings.  sequence1 is the reference of the CIGAR string:
+// M is a residue pair, I is a residue of sequence2 aligned to a gap, and
+// D is a residue of sequence1 aligned to a gap.
+struct Alignment_result
+{
+    int score = 0;              // Score of the alignment.
+    size_t begin1 = 0;          // Start of the aligned region of sequence1.
+    size_t end1 = 0;            // One past the end of the aligned region of sequence1.
+    size_t begin2 = 0;          // Start of the aligned region of sequence2.
+    size_t end2 = 0;            // One past the end of the aligned region of sequence2.
+    std::string cigar;          // Run-length encoded operations, or "*" if not traced back.
+    double pvalue = -1.0;       // P-value of the score, or less than 0 if not calculated.
+};
+
+// Run-length encode the gaps of an alignment, e.g. "12M2I30M".
+std::string alignment_cigar(const Local_alignment& alignment);
+
+Alignment_result make_alignment_result(const Local_alignment& alignment);
+
+// Result with only a score, for alignments that were not traced back.
+Alignment_result make_score_result(int score);
+
+//---------------------------------------------------------------------------
+// Formats of Result_writer.
+enum class Result_format
+{
+    tsv,        // name1, name2, score, begin1, end1, begin2, end2, CIGAR, p-value.
+    sam,        // SAM columns with sequence2 as the read, sequence1 as the
+                // reference, AS:i: for the score and XP:f: for the p-value.
+    binary,     // Fixed size record, then the names and CIGAR string.
+};
+
+//---------------------------------------------------------------------------
+// Formats results into a buffer, and writes the buffer to the stream a block
+// at a time instead of a field at a time.  Positions in text formats are
+// one-based, and in binary zero-based as in Alignment_result.  Binary output
+// is in the byte order of the machine.
+class Result_writer
+{
+    std::ostream& m_output_stream;
+    Result_format m_format;
+    std::string m_buffer;
+
+    // Not implemented to prevent accidental copying/moving.
+    Result_writer(const Result_writer&) = delete;
+    Result_writer(Result_writer&&) noexcept = delete;
+    Result_writer& operator=(const Result_writer&) = delete;
+    Result_writer& operator=(Result_writer&&) noexcept = delete;
+
+    void append_number(uint64_t number);
+    void append_tsv(const std::string& name1, const std::string& name2, const Alignment_result& result);
+    void append_sam(const std::string& name1, const std::string& name2, const Alignment_result& result);
+    void append_binary(const std::string& name1, const std::string& name2, const Alignment_result& result);
+
+public:
+    Result_writer(std::ostream& output_stream, Result_format format);
+    ~Result_writer();
+
+    void write(const std::string& name1, const std::string& name2, const Alignment_result& result);
+    void flush();
+};
@@ -0,0 +1,247 @@
+#include "PreCompile.h"
+#include "TraceBack.h"
+#include "BandedAlignment.h"    // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Score of a cell, or 0 if it was not computed (including the base cases).
+int Banded_alignment_table::score_at(size_t row, size_t column) const
+{
+    if((column < m_first_columns[row]) || (column >= m_last_columns[row]))
+    {
+        return 0;
+    }
+
+    return m_scores[m_row_offsets[row] + column - m_first_columns[row]];
+}
+
+//---------------------------------------------------------------------------
+// Trace back directions of a cell, or none if it was not computed.
+uint8_t Banded_alignment_table::directions_at(size_t row, size_t column) const
+{
+    if((column < m_first_columns[row]) || (column >= m_last_columns[row]))
+    {
+        return 0;
+    }
+
+    return m_trace[m_row_offsets[row] + column - m_first_columns[row]];
+}
+
+//---------------------------------------------------------------------------
+// Fill the table, and refill an adaptive band with twice the width while
+// the first optimal alignment touches the edge of the band.
+void Banded_alignment_table::fill_table(const Band_options& options)
+{
+    m_codes2 = m_profile.encode(m_sequence2);
+
+    Band_options band_options(options);
+    while(fill_band(band_options))
+    {
+        band_options.band_width *= 2;
+    }
+
+    m_band_width = band_options.band_width;
+}
+
+//---------------------------------------------------------------------------
+// Fill the cells allowed by options.  Returns true if the band should be
+// widened and the table filled again.
+bool Banded_alignment_table::fill_band(const Band_options& options)
+{
+    // Diagonals are numbered column - row.  The band spans from the main
+    // diagonal to the diagonal through the last cell, plus band_width either side.
+    const ptrdiff_t end_diagonal = static_cast<ptrdiff_t>(m_columns) - static_cast<ptrdiff_t>(m_rows);
+    const bool banded = (options.band_width > 0);
+    const ptrdiff_t band_width = static_cast<ptrdiff_t>(std::min(options.band_width, m_columns + m_rows));
+    const ptrdiff_t low_diagonal = std::min<ptrdiff_t>(0, end_diagonal) - band_width;
+    const ptrdiff_t high_diagonal = std::max<ptrdiff_t>(0, end_diagonal) + band_width;
+
+    m_scores.clear();
+    m_trace.clear();
+    m_row_offsets.assign(m_rows, 0);
+    m_first_columns.assign(m_rows, 1);
+    m_last_columns.assign(m_rows, 1);
+    m_max_score = 0;
+    m_max_score_cells.clear();
+
+    const int* left_gap_scores = m_profile.query_gap_scores();
+
+    // Columns of the row above that are alive for X-drop.  All of row 0 is.
+    size_t live_first = 1;
+    size_t live_last = m_columns;
+
+    for(size_t row = 1; row < m_rows; ++row)
+    {
+        size_t first_column = 1;
+        size_t last_column = m_columns;
+        if(banded)
+        {
+            const ptrdiff_t signed_row = static_cast<ptrdiff_t>(row);
+            first_column = static_cast<size_t>(std::max<ptrdiff_t>(1, signed_row + low_diagonal));
+            last_column = static_cast<size_t>(std::max<ptrdiff_t>(1, std::min<ptrdiff_t>(m_columns, signed_row + high_diagonal + 1)));
+        }
+
+        // With X-drop, a row starts at the first live column above, and ends one past
+        // the last, unless live cells on this row extend it further.
+        size_t extend_column = last_column;
+        if(options.x_drop > 0)
+        {
+            first_column = std::max(first_column, live_first);
+            extend_column = std::min(last_column, live_last + 1);
+        }
+
+        if(first_column >= extend_column)
+        {
+            // Nothing is alive, so no later row can be reached either.
+            break;
+        }
+
+        const uint8_t code2 = m_codes2[row - 1];
+        const int* diagonal_scores = m_profile.scores(code2);
+        const int above_gap_score = m_profile.residue_gap_score(code2);
+
+        m_row_offsets[row] = m_scores.size();
+        m_first_columns[row] = first_column;
+        m_last_columns[row] = first_column;
+
+        size_t next_live_first = m_columns;
+        size_t next_live_last = 0;
+
+        for(size_t column = first_column; column < last_column; ++column)
+        {
+            int diagonal_score = score_at(row - 1, column - 1) + diagonal_scores[column - 1];
+            int above_score =    score_at(row - 1, column)     + above_gap_score;
+            int left_score =     score_at(row, column - 1)     + left_gap_scores[column - 1];
+
+            // Take the max score of 0 and the three potential scores and save it.
+            int score = std::max(0, diagonal_score);
+            score = std::max(score, left_score);
+            score = std::max(score, above_score);
+
+            const bool alive = (0 == options.x_drop) || (score >= m_max_score - options.x_drop);
+            if((column >= extend_column) && !alive)
+            {
+                break;
+            }
+
+            m_scores.push_back(score);
+            m_trace.push_back(trace_directions(score, diagonal_score, above_score, left_score));
+            m_last_columns[row] = column + 1;
+
+            if(alive)
+            {
+                next_live_first = std::min(next_live_first, column);
+                next_live_last = column;
+            }
+
+            if(score > 0 && score >= m_max_score)
+            {
+                if(score > m_max_score)
+                {
+                    m_max_score = score;
+                    m_max_score_cells.clear();
+                }
+
+                m_max_score_cells.push_back(table_cell { row, column });
+            }
+        }
+
+        live_first = next_live_first;
+        live_last = next_live_last;
+    }
+
+    m_computed_cells += m_scores.size();
+
+    if(!banded || !options.adaptive || m_max_score_cells.empty())
+    {
+        return false;
+    }
+
+    // The band can't grow past the edges of the table.
+    const ptrdiff_t first_diagonal = -static_cast<ptrdiff_t>(m_rows - 1);
+    const ptrdiff_t last_diagonal = static_cast<ptrdiff_t>(m_columns - 1);
+    if((low_diagonal <= first_diagonal) && (high_diagonal >= last_diagonal))
+    {
+        return false;
+    }
+
+    // Follow the first optimal alignment, with the same preference as
+    // print_trace_back, and check whether it runs along the band's edge.
+    size_t row = m_max_score_cells[0].row;
+    size_t column = m_max_score_cells[0].column;
+    for(uint8_t directions = directions_at(row, column); directions != 0; directions = directions_at(row, column))
+    {
+        const ptrdiff_t diagonal = static_cast<ptrdiff_t>(column) - static_cast<ptrdiff_t>(row);
+        if(((diagonal <= low_diagonal) && (low_diagonal > first_diagonal)) ||
+           ((diagonal >= high_diagonal) && (high_diagonal < last_diagonal)))
+        {
+            return true;
+        }
+
+        if(directions & trace_above)
+        {
+            --row;
+        }
+        else if(directions & trace_left)
+        {
+            --column;
+        }
+        else
+        {
+            --row;
+            --column;
+        }
+    }
+
+    return false;
+}
+
+//---------------------------------------------------------------------------
+int Banded_alignment_table::max_score() const
+{
+    return m_max_score;
+}
+
+//---------------------------------------------------------------------------
+// Return the cells that hold the max score, in row-major order.
+const std::vector<Banded_alignment_table::table_cell>& Banded_alignment_table::max_score_cells() const
+{
+    return m_max_score_cells;
+}
+
+//---------------------------------------------------------------------------
+// Return the band width used by the final fill, after any adaptive widening.
+size_t Banded_alignment_table::band_width() const
+{
+    return m_band_width;
+}
+
+//---------------------------------------------------------------------------
+// Return the number of cells computed, counting every fill of an adaptive band.
+size_t Banded_alignment_table::computed_cell_count() const
+{
+    return m_computed_cells;
+}
+
+//---------------------------------------------------------------------------
+// Print all of the trace backs from each cell that holds the max score.
+// Stop after max_alignments alignments, or print all of them if max_alignments is 0.
+void Banded_alignment_table::print_trace_back(std::ostream& output_stream, size_t max_alignments) const
+{
+    output_stream << "Optimal score: " << m_max_score << "\nTrace back sequences:\n";
+
+    size_t alignment_count = 0;
+
+    for(const table_cell& cell : m_max_score_cells)
+    {
+        const size_t remaining = (0 == max_alignments) ? 0 : max_alignments - alignment_count;
+        alignment_count += print_trace_backs(output_stream, m_sequence1, m_sequence2, cell.row, cell.column, remaining, [this](size_t row, size_t column)
+        {
+            return directions_at(row, column);
+        });
+
+        if(alignment_count == max_alignments)
+        {
+            return;
+        }
+    }
+}
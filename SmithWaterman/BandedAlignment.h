@@ -0,0 +1,95 @@
+#pragma once
+
+#include "QueryProfile.h"
+
+//---------------------------------------------------------------------------
+// Limits on the cells a Banded_alignment_table computes.
+struct Band_options
+{
+    size_t band_width = 16;     // Diagonals kept on each side of the band's center, or 0 for no band.
+    bool adaptive = true;       // Double the band width while the alignment touches the band's edge.
+    int x_drop = 0;             // Stop extending a row past cells more than x_drop below the best score, or 0 for no limit.
+};
+
+//---------------------------------------------------------------------------
+// Local alignment table that only computes a band of diagonals, and/or the
+// cells that X-drop leaves alive, for pairs whose optimal path stays near a
+// diagonal (such as orthologs).  The cells computed grow as O(n*band) rather
+// than O(n*m).  Cells that are not computed score 0.
+//
+// The band covers the diagonals from the main diagonal to the diagonal that
+// joins the ends of both sequences, widened by band_width on each side.  An
+// adaptive band is doubled and refilled while the first optimal alignment
+// touches the band's edge, which is a good sign that a better path lies outside.
+//
+// X-drop starts with every column of the first row alive.  Each later row only
+// spans the columns reachable from a live cell of the row above, and a cell
+// stays alive while its score is within x_drop of the best score so far.  Once
+// no cell of a row is alive, the remaining rows are not computed.
+//
+// Both are heuristics: with a band wide enough to cover the table and no
+// X-drop, the results are the same as an Alignment_table's.
+class Banded_alignment_table
+{
+public:
+    struct table_cell
+    {
+        size_t row;       // index on i axis, one past the residue of sequence2
+        size_t column;    // index on j axis, one past the residue of sequence1
+    };
+
+private:
+    std::vector<int> m_scores;          // Computed cells of each row, row after row.
+    std::vector<uint8_t> m_trace;       // Trace back directions of the computed cells.
+    std::vector<size_t> m_row_offsets;  // Index in m_scores of each row's first computed cell.
+    std::vector<size_t> m_first_columns;// First computed column of each row.
+    std::vector<size_t> m_last_columns; // One past the last computed column of each row.
+    const size_t m_columns;             // width of matrix
+    const size_t m_rows;                // height of matrix
+    int m_max_score = 0;                // maximum score in this matrix
+    std::vector<table_cell> m_max_score_cells;  // cells with m_max_score, in row-major order
+    size_t m_band_width;                // band width of the last fill
+    size_t m_computed_cells = 0;        // cells computed by every fill, including refills
+    std::string m_sequence1;            // represents sequence on j axis
+    std::string m_sequence2;            // represents sequence on i axis
+
+    Query_profile m_profile;
+    std::vector<uint8_t> m_codes2;
+
+    // Not implemented to prevent accidental copying/moving.
+    Banded_alignment_table(const Banded_alignment_table&) = delete;
+    Banded_alignment_table(Banded_alignment_table&&) noexcept = delete;
+    Banded_alignment_table& operator=(const Banded_alignment_table&) = delete;
+    Banded_alignment_table& operator=(Banded_alignment_table&&) noexcept = delete;
+
+    void fill_table(const Band_options& options);
+    bool fill_band(const Band_options& options);
+    int score_at(size_t row, size_t column) const;
+    uint8_t directions_at(size_t row, size_t column) const;
+
+public:
+    template<typename Score_policy>
+    Banded_alignment_table(const std::string& sequence1, const std::string& sequence2, Score_policy score_policy, const Band_options& options);
+    ~Banded_alignment_table() = default;
+
+    int max_score() const;
+    const std::vector<table_cell>& max_score_cells() const;
+    size_t band_width() const;
+    size_t computed_cell_count() const;
+    void print_trace_back(std::ostream& output_stream, size_t max_alignments) const;
+};
+
+//---------------------------------------------------------------------------
+// Constructor that takes a pair of sequences to align, a score policy
+// (a function or a policy type), and the limits on the cells computed.
+template<typename Score_policy>
+Banded_alignment_table::Banded_alignment_table(const std::string& sequence1, const std::string& sequence2, Score_policy score_policy, const Band_options& options)
+    : m_columns(sequence1.length() + 1)
+    , m_rows(sequence2.length() + 1)
+    , m_band_width(options.band_width)
+    , m_sequence1(sequence1)
+    , m_sequence2(sequence2)
+    , m_profile(sequence1, sequence2, score_policy)
+{
+    fill_table(options);
+}
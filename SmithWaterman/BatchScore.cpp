@@ -0,0 +1,227 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "LinearScore.h"
+#include "BatchScore.h"     // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Encode the residues of sequence, assigning codes in order of first use.
+// Returns the codes, and fills residue_index with the code of each residue.
+static std::string distinct_residues(const std::string& sequence, std::array<uint8_t, UCHAR_MAX + 1>& residue_index)
+{
+    residue_index.fill(UINT8_MAX);
+
+    std::string residues;
+    for(size_t ix = 0; ix < sequence.size(); ++ix)
+    {
+        const uint8_t residue = static_cast<uint8_t>(sequence[ix]);
+        if(residue_index[residue] == UINT8_MAX)
+        {
+            assert(residues.size() < UINT8_MAX);
+            residue_index[residue] = static_cast<uint8_t>(residues.size());
+            residues.push_back(sequence[ix]);
+        }
+    }
+
+    return residues;
+}
+
+//---------------------------------------------------------------------------
+// Build the profile of query against each residue in target_residues.
+// Targets scored against this profile may only contain those residues.
+Batch_profile::Batch_profile(const std::string& query, const std::string& target_residues, int (*score_policy)(char char1, char char2))
+    : m_striped_profile(query, target_residues, score_policy)
+{
+    std::array<uint8_t, UCHAR_MAX + 1> query_index;
+    const std::string query_residues = distinct_residues(query, query_index);
+    const std::string residues = distinct_residues(target_residues, m_residue_index);
+
+    m_target_residue_count = residues.size();
+    m_query_residue_count = query_residues.size();
+
+    m_query_codes.resize(query.size());
+    for(size_t ix = 0; ix < query.size(); ++ix)
+    {
+        m_query_codes[ix] = query_index[static_cast<uint8_t>(query[ix])];
+    }
+
+    // One row per target residue, plus a padding row for lanes past the end of
+    // their target.  Padding takes the lowest score, which can never raise the maximum.
+    int min_score = 0;
+    m_scores.resize((m_target_residue_count + 1) * m_query_residue_count);
+    for(size_t residue = 0; residue < m_target_residue_count; ++residue)
+    {
+        for(size_t query_residue = 0; query_residue < m_query_residue_count; ++query_residue)
+        {
+            const int score = score_policy(residues[residue], query_residues[query_residue]);
+            m_scores[residue * m_query_residue_count + query_residue] = score;
+            min_score = std::min(min_score, score);
+            m_max_score = std::max(m_max_score, score);
+        }
+    }
+
+    std::fill(m_scores.begin() + m_target_residue_count * m_query_residue_count, m_scores.end(), min_score);
+
+    m_bias = -min_score;
+    m_max_score += m_bias;
+    m_fits_bytes = (m_max_score <= UINT8_MAX) && (m_striped_profile.gap_penalty() <= UINT8_MAX);
+}
+
+//---------------------------------------------------------------------------
+// The profile is unusable if the score policy does not have a uniform gap penalty.
+bool Batch_profile::is_valid() const
+{
+    return m_striped_profile.is_valid();
+}
+
+//---------------------------------------------------------------------------
+// Score up to Vector::lanes targets at once, one per lane.
+//
+// For each target position, the scores of every query residue against the
+// residue in each lane are gathered once, so that walking the query only
+// needs one vector load per cell.
+template<typename Vector>
+void Batch_profile::score_group(const std::string* const* targets, size_t count, int* max_scores, Score_workspace& workspace) const
+{
+    typedef typename Vector::element_type element_type;
+    typedef typename Vector::vector_type vector_type;
+
+    const size_t lanes = Vector::lanes;
+    const size_t query_length = m_query_codes.size();
+    const int bias = Vector::biased ? m_bias : 0;
+
+    assert(count <= lanes);
+
+    size_t max_length = 0;
+    for(size_t lane = 0; lane < count; ++lane)
+    {
+        max_length = std::max(max_length, targets[lane]->size());
+    }
+
+    // Scores of each query residue against the current residue of each lane,
+    // followed by the scores of the previous target position.
+    element_type* column_scores = workspace.zeroed_scores<element_type>((m_query_residue_count + query_length) * lanes);
+    element_type* scores = column_scores + m_query_residue_count * lanes;
+
+    const vector_type zero = Vector::zero();
+    const vector_type gap = Vector::splat(m_striped_profile.gap_penalty());
+    const vector_type bias_vector = Vector::splat(bias);
+    vector_type max_vector = zero;
+
+    for(size_t position = 0; position < max_length; ++position)
+    {
+        for(size_t lane = 0; lane < lanes; ++lane)
+        {
+            size_t residue = m_target_residue_count;
+            if((lane < count) && (position < targets[lane]->size()))
+            {
+                residue = m_residue_index[static_cast<uint8_t>((*targets[lane])[position])];
+                assert(residue != UINT8_MAX);
+            }
+
+            const int* residue_scores = &m_scores[residue * m_query_residue_count];
+            for(size_t query_residue = 0; query_residue < m_query_residue_count; ++query_residue)
+            {
+                column_scores[query_residue * lanes + lane] = static_cast<element_type>(residue_scores[query_residue] + bias);
+            }
+        }
+
+        // Walk the query.  The diagonal and above scores carry in registers, and
+        // the left scores are the previous target position.
+        vector_type diagonal = zero;
+        vector_type above = zero;
+        for(size_t ix = 0; ix < query_length; ++ix)
+        {
+            const vector_type left = Vector::load(&scores[ix * lanes]);
+
+            vector_type score = Vector::add_score(diagonal, Vector::load(&column_scores[m_query_codes[ix] * lanes]), bias_vector);
+            score = Vector::max(score, Vector::subtract_gap(left, gap));
+            score = Vector::max(score, Vector::subtract_gap(above, gap));
+
+            max_vector = Vector::max(max_vector, score);
+            Vector::store(&scores[ix * lanes], score);
+
+            diagonal = left;
+            above = score;
+        }
+    }
+
+    element_type lane_scores[lanes];
+    Vector::store(lane_scores, max_vector);
+
+    for(size_t lane = 0; lane < count; ++lane)
+    {
+        max_scores[lane] = lane_scores[lane];
+    }
+
+    // Rescore any lane that may have saturated with the striped kernel, which
+    // moves to wider lanes as needed.  This is rare for unrelated sequences.
+    for(size_t lane = 0; lane < count; ++lane)
+    {
+        if(Vector::saturates &&
+           (static_cast<long long>(max_scores[lane]) + m_max_score >= std::numeric_limits<element_type>::max()))
+        {
+            max_scores[lane] = m_striped_profile.max_score(*targets[lane], workspace);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Return the max local alignment score of the query against each target.
+// This matches the max score of an Alignment_table of each pair.
+std::vector<int> Batch_profile::max_scores(const std::vector<std::string>& targets, Score_workspace& workspace) const
+{
+    assert(is_valid());
+
+    std::vector<int> max_scores(targets.size());
+    if(m_query_codes.empty())
+    {
+        return max_scores;
+    }
+
+    // Group targets of similar length, so that few lanes sit idle on padding.
+    std::vector<size_t> order(targets.size());
+    for(size_t ix = 0; ix < order.size(); ++ix)
+    {
+        order[ix] = ix;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&targets](size_t index1, size_t index2)
+    {
+        return targets[index1].size() < targets[index2].size();
+    });
+
+#if defined(SIMD_VECTOR_ENABLED)
+    const size_t lanes = m_fits_bytes ? Simd_byte_vector::lanes : Scalar_int_vector::lanes;
+#else
+    const size_t lanes = Scalar_int_vector::lanes;
+#endif
+
+    std::vector<const std::string*> group(lanes);
+    std::vector<int> group_scores(lanes);
+    for(size_t first = 0; first < order.size(); first += lanes)
+    {
+        const size_t count = std::min(lanes, order.size() - first);
+        for(size_t lane = 0; lane < count; ++lane)
+        {
+            group[lane] = &targets[order[first + lane]];
+        }
+
+#if defined(SIMD_VECTOR_ENABLED)
+        if(m_fits_bytes)
+        {
+            score_group<Simd_byte_vector>(group.data(), count, group_scores.data(), workspace);
+        }
+        else
+#endif
+        {
+            score_group<Scalar_int_vector>(group.data(), count, group_scores.data(), workspace);
+        }
+
+        for(size_t lane = 0; lane < count; ++lane)
+        {
+            max_scores[order[first + lane]] = group_scores[lane];
+        }
+    }
+
+    return max_scores;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "StripedScore.h"
+
+//---------------------------------------------------------------------------
+// Inter-sequence profile for scoring many targets against one query at once
+// (Rognes, 2011).  Each SIMD lane holds a different target, so the lanes of a
+// vector never depend on each other, unlike the lanes of the striped kernel.
+// This suits many short targets of similar length, such as the permutations
+// of a p-value calculation or the records of a protein database.
+//
+// Like the striped kernel, only max scores are computed, and the linear gap
+// penalty must be the same for every residue.
+class Batch_profile
+{
+    std::array<uint8_t, UCHAR_MAX + 1> m_residue_index; // Maps a target residue to its row in m_scores.
+    std::vector<uint8_t> m_query_codes;                 // Query, encoded as columns of m_scores.
+    std::vector<int> m_scores;                          // [target residue or padding][query residue] scores.
+    size_t m_target_residue_count = 0;                  // Number of distinct target residues (also the padding row).
+    size_t m_query_residue_count = 0;                   // Number of distinct query residues.
+    int m_bias = 0;                                     // Added to each score to keep it non-negative.
+    int m_max_score = 0;                                // Largest (biased) score in m_scores.
+    bool m_fits_bytes = false;                          // True if scores and gap fit the byte lanes.
+    Striped_profile m_striped_profile;                  // Rescores targets whose lanes overflow.
+
+    template<typename Vector>
+    void score_group(const std::string* const* targets, size_t count, int* max_scores, Score_workspace& workspace) const;
+
+public:
+    Batch_profile(const std::string& query, const std::string& target_residues, int (*score_policy)(char char1, char char2));
+
+    bool is_valid() const;
+    std::vector<int> max_scores(const std::vector<std::string>& targets, Score_workspace& workspace) const;
+};
@@ -0,0 +1,326 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "LinearScore.h"
+#include "BatchScore.h"
+#include "ThreadPool.h"
+#include "SeedIndex.h"
+#include "DatabaseSearch.h" // Pick up forward declarations to ensure correctness.
+#include <Shared/fasta.h>
+
+//---------------------------------------------------------------------------
+// Order of hits in the results: best score first, then earliest record.
+static bool hit_ranks_before(const Database_hit& hit1, const Database_hit& hit2)
+{
+    return (hit1.score > hit2.score) ||
+           ((hit1.score == hit2.score) && (hit1.record_index < hit2.record_index));
+}
+
+//---------------------------------------------------------------------------
+// Keep the top_count best hits in a heap whose front is the worst of them.
+// The record is only copied into the heap when it makes the cut.
+static void offer_hit(std::vector<Database_hit>& heap, size_t top_count, size_t record_index, int score, const Fasta_record& record)
+{
+    Database_hit hit;
+    hit.record_index = record_index;
+    hit.score = score;
+
+    if(heap.size() == top_count)
+    {
+        if(!hit_ranks_before(hit, heap.front()))
+        {
+            return;
+        }
+
+        std::pop_heap(heap.begin(), heap.end(), hit_ranks_before);
+        heap.pop_back();
+    }
+
+    hit.name = record.name;
+    hit.sequence = record.sequence;
+    heap.push_back(std::move(hit));
+    std::push_heap(heap.begin(), heap.end(), hit_ranks_before);
+}
+
+//---------------------------------------------------------------------------
+// Scores records against the queries on the workers of a pool.  Each worker
+// keeps a heap of hits per query, which are merged once every record is scored.
+class Hit_collector
+{
+    struct Worker_state
+    {
+        Score_workspace workspace;
+        std::vector<std::vector<Database_hit>> heaps;
+    };
+
+    std::vector<std::string> m_queries;         // Normalized queries.
+    std::vector<Batch_profile> m_profiles;      // Profile of each query.
+    int (*m_score_policy)(char char1, char char2);
+    size_t m_top_count;
+    std::vector<Worker_state> m_workers;
+
+public:
+    Hit_collector(const std::vector<std::string>& queries, int (*score_policy)(char char1, char char2), size_t top_count, unsigned int worker_count);
+
+    const std::string& query(size_t query) const;
+    void score_records(unsigned int worker, size_t first_query, size_t last_query, const std::vector<size_t>& record_indexes, const std::vector<Fasta_record>& records);
+    std::vector<std::vector<Database_hit>> merge_hits();
+    void trace_back_hits(Work_stealing_pool& pool, std::vector<std::vector<Database_hit>>& results) const;
+};
+
+//---------------------------------------------------------------------------
+Hit_collector::Hit_collector(const std::vector<std::string>& queries, int (*score_policy)(char char1, char char2), size_t top_count, unsigned int worker_count)
+    : m_queries(queries)
+    , m_score_policy(score_policy)
+    , m_top_count(top_count)
+    , m_workers(worker_count)
+{
+    for(auto& query : m_queries)
+    {
+        normalize_BLOSUM62_residues(query);
+        m_profiles.emplace_back(query, BLOSUM62_residues, score_policy);
+    }
+
+    for(auto& worker : m_workers)
+    {
+        worker.heaps.resize(m_queries.size());
+    }
+}
+
+//---------------------------------------------------------------------------
+const std::string& Hit_collector::query(size_t query) const
+{
+    return m_queries[query];
+}
+
+//---------------------------------------------------------------------------
+// Score a batch of records against queries [first_query, last_query).
+void Hit_collector::score_records(unsigned int worker_index, size_t first_query, size_t last_query, const std::vector<size_t>& record_indexes, const std::vector<Fasta_record>& records)
+{
+    Worker_state& worker = m_workers[worker_index];
+
+    std::vector<std::string> targets(records.size());
+    for(size_t ix = 0; ix < records.size(); ++ix)
+    {
+        targets[ix] = records[ix].sequence;
+        normalize_BLOSUM62_residues(targets[ix]);
+    }
+
+    std::vector<int> max_scores;
+    for(size_t query = first_query; query < last_query; ++query)
+    {
+        if(m_profiles[query].is_valid())
+        {
+            max_scores = m_profiles[query].max_scores(targets, worker.workspace);
+        }
+        else
+        {
+            max_scores.resize(targets.size());
+            for(size_t ix = 0; ix < targets.size(); ++ix)
+            {
+                max_scores[ix] = linear_max_score(m_queries[query], targets[ix], m_score_policy, worker.workspace);
+            }
+        }
+
+        for(size_t ix = 0; ix < records.size(); ++ix)
+        {
+            if(max_scores[ix] > 0)
+            {
+                offer_hit(worker.heaps[query], m_top_count, record_indexes[ix], max_scores[ix], records[ix]);
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Merge the workers' heaps.  The ranking is a total order over the records,
+// so the final hits are the same whichever worker scored them.
+std::vector<std::vector<Database_hit>> Hit_collector::merge_hits()
+{
+    std::vector<std::vector<Database_hit>> results(m_queries.size());
+
+    for(size_t query = 0; query < m_queries.size(); ++query)
+    {
+        for(auto& worker : m_workers)
+        {
+            auto& heap = worker.heaps[query];
+            std::move(heap.begin(), heap.end(), std::back_inserter(results[query]));
+            heap.clear();
+        }
+
+        std::sort(results[query].begin(), results[query].end(), hit_ranks_before);
+        if(results[query].size() > m_top_count)
+        {
+            results[query].resize(m_top_count);
+        }
+    }
+
+    return results;
+}
+
+//---------------------------------------------------------------------------
+// Trace back only the final hits, in linear space.
+void Hit_collector::trace_back_hits(Work_stealing_pool& pool, std::vector<std::vector<Database_hit>>& results) const
+{
+    for(size_t query = 0; query < results.size(); ++query)
+    {
+        for(auto& hit : results[query])
+        {
+            pool.submit([this, query, &hit](unsigned int)
+            {
+                std::string target(hit.sequence);
+                normalize_BLOSUM62_residues(target);
+                hit.alignment = linear_space_align(m_queries[query], target, m_score_policy);
+            });
+        }
+    }
+
+    pool.wait();
+}
+
+//---------------------------------------------------------------------------
+std::vector<std::vector<Database_hit>> search_database(
+    std::istream& database,
+    const std::vector<std::string>& queries,
+    int (*score_policy)(char char1, char char2),
+    size_t top_count,
+    unsigned int thread_count,
+    bool trace_back)
+{
+    constexpr size_t records_per_batch = 256;
+
+    if(0 == top_count)
+    {
+        return std::vector<std::vector<Database_hit>>(queries.size());
+    }
+
+    Work_stealing_pool pool(thread_count);
+    Hit_collector collector(queries, score_policy, top_count, pool.thread_count());
+
+    // Stream the database in batches.  submit() waits while the queues are full,
+    // so only a few batches per thread are ever held in memory.
+    Fasta_reader reader(database);
+    size_t record_count = 0;
+    std::vector<size_t> record_indexes;
+    std::vector<Fasta_record> batch;
+    Fasta_record record;
+
+    bool more_records = true;
+    while(more_records)
+    {
+        more_records = reader.read_record(record);
+        if(more_records)
+        {
+            record_indexes.push_back(record_count++);
+            batch.push_back(std::move(record));
+        }
+
+        if((batch.size() == records_per_batch) || (!more_records && !batch.empty()))
+        {
+            pool.submit([&collector, &queries, record_indexes = std::move(record_indexes), batch = std::move(batch)](unsigned int worker)
+            {
+                collector.score_records(worker, 0, queries.size(), record_indexes, batch);
+            });
+            record_indexes.clear();
+            batch.clear();
+        }
+    }
+
+    pool.wait();
+
+    auto results = collector.merge_hits();
+    if(trace_back)
+    {
+        collector.trace_back_hits(pool, results);
+    }
+
+    return results;
+}
+
+//---------------------------------------------------------------------------
+std::vector<std::vector<Database_hit>> search_database(
+    const Seed_index& index,
+    const std::vector<std::string>& queries,
+    int (*score_policy)(char char1, char char2),
+    size_t top_count,
+    unsigned int thread_count,
+    const Seed_options& options,
+    bool trace_back)
+{
+    constexpr size_t records_per_batch = 256;
+
+    if(0 == top_count)
+    {
+        return std::vector<std::vector<Database_hit>>(queries.size());
+    }
+
+    Work_stealing_pool pool(thread_count);
+    Hit_collector collector(queries, score_policy, top_count, pool.thread_count());
+
+    // Each query has its own candidates, so the seed filter runs once per query,
+    // and only its candidates are scored against it.
+    std::vector<std::vector<size_t>> candidates(queries.size());
+    for(size_t query = 0; query < queries.size(); ++query)
+    {
+        pool.submit([&collector, &index, score_policy, &options, &candidates, query](unsigned int)
+        {
+            candidates[query] = index.candidate_records(collector.query(query), score_policy, options);
+        });
+    }
+
+    pool.wait();
+
+    // Tasks never submit tasks, since submit() can wait for a worker to finish one.
+    for(size_t query = 0; query < queries.size(); ++query)
+    {
+        for(size_t first = 0; first < candidates[query].size(); first += records_per_batch)
+        {
+            const size_t last = std::min(first + records_per_batch, candidates[query].size());
+            std::vector<size_t> record_indexes(candidates[query].cbegin() + first, candidates[query].cbegin() + last);
+
+            pool.submit([&collector, &index, query, record_indexes = std::move(record_indexes)](unsigned int worker)
+            {
+                std::vector<Fasta_record> batch(record_indexes.size());
+                for(size_t ix = 0; ix < record_indexes.size(); ++ix)
+                {
+                    batch[ix].name = index.record_name(record_indexes[ix]);
+                    batch[ix].sequence = index.record_sequence(record_indexes[ix]);
+                }
+
+                collector.score_records(worker, query, query + 1, record_indexes, batch);
+            });
+        }
+    }
+
+    pool.wait();
+
+    auto results = collector.merge_hits();
+    if(trace_back)
+    {
+        collector.trace_back_hits(pool, results);
+    }
+
+    return results;
+}
+
+//---------------------------------------------------------------------------
+void print_database_hits(std::ostream& output_stream, const std::string& query_name, const std::vector<Database_hit>& hits)
+{
+    output_stream << "Query: " << query_name << "\n";
+
+    for(size_t ix = 0; ix < hits.size(); ++ix)
+    {
+        output_stream << "Hit " << (ix + 1) << ": " << hits[ix].name << "\n";
+        print_local_alignment(output_stream, hits[ix].alignment);
+    }
+}
+
+//---------------------------------------------------------------------------
+void write_database_hits(Result_writer& writer, const std::string& query_name, const std::vector<Database_hit>& hits)
+{
+    for(const auto& hit : hits)
+    {
+        // Hits that were not traced back only have a score.
+        const bool is_traced = !hit.alignment.aligned1.empty();
+        writer.write(query_name, hit.name, is_traced ? make_alignment_result(hit.alignment) : make_score_result(hit.score));
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Hirschberg.h"
+#include "AlignmentResult.h"
+#include "SeedIndex.h"
+
+//---------------------------------------------------------------------------
+// One database record that scored well against a query.
+struct Database_hit
+{
+    size_t record_index = 0;    // Position of the record in the database.
+    std::string name;           // FASTA header of the record.
+    std::string sequence;       // Residues of the record.
+    int score = 0;              // Max local alignment score against the query.
+    Local_alignment alignment;  // Filled in only for the final hits.
+};
+
+// Scan protein queries against every record of a FASTA database stream.
+// Records are read one batch at a time and scored by a work-stealing pool of
+// thread_count threads (0 for every hardware thread), so the database is never
+// held in memory.  Each query keeps only its best top_count hits, ranked by
+// score and then by record order, and only those are traced back.
+//
+// Residues are upper-cased, and residues outside BLOSUM62_residues are scored as 'X'.
+// The hits do not depend on thread_count.  If trace_back is false, only the
+// scores of the hits are needed, and their alignments are left empty.
+std::vector<std::vector<Database_hit>> search_database(
+    std::istream& database,
+    const std::vector<std::string>& queries,
+    int (*score_policy)(char char1, char char2),
+    size_t top_count,
+    unsigned int thread_count,
+    bool trace_back = true);
+
+// Search as above, but only align the records of an index that pass its seed
+// filter for each query.  Records that share no significant words with a query
+// are never aligned, so the hits may miss weak matches that a full search finds.
+std::vector<std::vector<Database_hit>> search_database(
+    const Seed_index& index,
+    const std::vector<std::string>& queries,
+    int (*score_policy)(char char1, char char2),
+    size_t top_count,
+    unsigned int thread_count,
+    const Seed_options& options,
+    bool trace_back = true);
+
+void print_database_hits(std::ostream& output_stream, const std::string& query_name, const std::vector<Database_hit>& hits);
+
+// Write the hits of a query as results, with the query as sequence1.
+void write_database_hits(Result_writer& writer, const std::string& query_name, const std::vector<Database_hit>& hits);
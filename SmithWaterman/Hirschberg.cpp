@@ -0,0 +1,297 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "Hirschberg.h"     // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Part of a sequence, optionally walked from the end towards the beginning.
+struct Sequence_range
+{
+    const char* first;          // First residue walked.
+    size_t length;              // Number of residues.
+    ptrdiff_t step;             // 1 to walk forwards, -1 to walk backwards.
+
+    Sequence_range(const std::string& sequence, size_t begin, size_t end, bool reverse)
+        : first(sequence.data() + (reverse ? end - 1 : begin))
+        , length(end - begin)
+        , step(reverse ? -1 : 1)
+    {
+    }
+
+    char operator[](size_t ix) const
+    {
+        return first[static_cast<ptrdiff_t>(ix) * step];
+    }
+};
+
+//---------------------------------------------------------------------------
+// Find the cell with the max local alignment score, keeping two rows.
+// end1 and end2 are set one past the last aligned residue of each sequence.
+static int find_alignment_end(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    int (*score_policy)(char char1, char char2),
+    size_t& end1,
+    size_t& end2)
+{
+    const size_t columns = sequence1.size() + 1;
+    std::vector<int> previous_row(columns);
+    std::vector<int> current_row(columns);
+
+    int max_score = 0;
+    end1 = 0;
+    end2 = 0;
+
+    for(size_t row = 1; row <= sequence2.size(); ++row)
+    {
+        const char residue2 = sequence2[row - 1];
+        const int above_gap = score_policy(residue2, gap_character);
+
+        for(size_t column = 1; column < columns; ++column)
+        {
+            int diagonal_score = previous_row[column - 1] + score_policy(residue2, sequence1[column - 1]);
+            int above_score =    previous_row[column]     + above_gap;
+            int left_score =     current_row[column - 1]  + score_policy(gap_character, sequence1[column - 1]);
+
+            int score = std::max(0, diagonal_score);
+            score = std::max(score, left_score);
+            score = std::max(score, above_score);
+
+            // Keep the first cell in row-major order, as print_trace_back would.
+            if(score > max_score)
+            {
+                max_score = score;
+                end1 = column;
+                end2 = row;
+            }
+
+            current_row[column] = score;
+        }
+
+        std::swap(previous_row, current_row);
+    }
+
+    return max_score;
+}
+
+//---------------------------------------------------------------------------
+// Walk backwards from the end of the alignment, scoring every alignment that
+// ends there, until one reaches max_score.  That is where the alignment begins.
+// The first one found is the shortest.
+static void find_alignment_begin(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    int (*score_policy)(char char1, char char2),
+    int max_score,
+    size_t end1,
+    size_t end2,
+    size_t& begin1,
+    size_t& begin2)
+{
+    // row[column] scores aligning sequence2[row, end2) with sequence1[column, end1).
+    std::vector<int> row(end1 + 1);
+    for(size_t column = end1; column > 0; --column)
+    {
+        row[column - 1] = row[column] + score_policy(gap_character, sequence1[column - 1]);
+    }
+
+    for(size_t row_index = end2; row_index > 0; --row_index)
+    {
+        const char residue2 = sequence2[row_index - 1];
+        const int above_gap = score_policy(residue2, gap_character);
+
+        int diagonal = row[end1];
+        row[end1] += above_gap;
+
+        for(size_t column = end1; column > 0; --column)
+        {
+            const int below = row[column - 1];
+            row[column - 1] = std::max(diagonal + score_policy(residue2, sequence1[column - 1]),
+                              std::max(below + above_gap,
+                                       row[column] + score_policy(gap_character, sequence1[column - 1])));
+            diagonal = below;
+
+            if(row[column - 1] == max_score)
+            {
+                begin1 = column - 1;
+                begin2 = row_index - 1;
+                return;
+            }
+        }
+    }
+
+    // A local alignment with a positive score must begin somewhere.
+    assert(false);
+}
+
+//---------------------------------------------------------------------------
+// Compute the last row of a global alignment of range1 (on the columns)
+// against range2 (on the rows), using a single row of memory.
+static void last_row_scores(
+    const Sequence_range& range1,
+    const Sequence_range& range2,
+    int (*score_policy)(char char1, char char2),
+    std::vector<int>& row)
+{
+    row.resize(range1.length + 1);
+
+    row[0] = 0;
+    for(size_t column = 0; column < range1.length; ++column)
+    {
+        row[column + 1] = row[column] + score_policy(gap_character, range1[column]);
+    }
+
+    for(size_t row_index = 0; row_index < range2.length; ++row_index)
+    {
+        const char residue2 = range2[row_index];
+        const int above_gap = score_policy(residue2, gap_character);
+
+        int diagonal = row[0];
+        row[0] += above_gap;
+
+        for(size_t column = 0; column < range1.length; ++column)
+        {
+            const int above = row[column + 1];
+            row[column + 1] = std::max(diagonal + score_policy(residue2, range1[column]),
+                              std::max(above + above_gap,
+                                       row[column] + score_policy(gap_character, range1[column])));
+            diagonal = above;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void append_pair(Local_alignment& alignment, char residue1, char residue2)
+{
+    alignment.aligned1.push_back(residue1);
+    alignment.aligned2.push_back(residue2);
+}
+
+//---------------------------------------------------------------------------
+// Globally align sequence1[begin1, end1) with sequence2[begin2, end2), and
+// append the aligned residues.  Split sequence2 in half, find where the
+// optimal path crosses the middle from a forward and a backward pass, and
+// recurse on the two quadrants the path passes through.
+static void hirschberg(
+    const std::string& sequence1,
+    size_t begin1,
+    size_t end1,
+    const std::string& sequence2,
+    size_t begin2,
+    size_t end2,
+    int (*score_policy)(char char1, char char2),
+    std::vector<int>& forward_row,
+    std::vector<int>& backward_row,
+    Local_alignment& alignment)
+{
+    // Base cases: one side is empty, so the other is all gaps.
+    if(begin2 == end2)
+    {
+        for(size_t column = begin1; column < end1; ++column)
+        {
+            append_pair(alignment, sequence1[column], gap_character);
+        }
+        return;
+    }
+
+    if(begin1 == end1)
+    {
+        for(size_t row = begin2; row < end2; ++row)
+        {
+            append_pair(alignment, gap_character, sequence2[row]);
+        }
+        return;
+    }
+
+    // Base case: a single residue of sequence2 either pairs with one residue of
+    // sequence1 or with a gap, and the rest of sequence1 is gaps.
+    if(end2 - begin2 == 1)
+    {
+        const char residue2 = sequence2[begin2];
+
+        int gaps_score = 0;
+        for(size_t column = begin1; column < end1; ++column)
+        {
+            gaps_score += score_policy(gap_character, sequence1[column]);
+        }
+
+        int best_score = gaps_score + score_policy(residue2, gap_character);
+        size_t best_column = end1;
+        for(size_t column = begin1; column < end1; ++column)
+        {
+            const int score = gaps_score - score_policy(gap_character, sequence1[column]) + score_policy(residue2, sequence1[column]);
+            if(score > best_score)
+            {
+                best_score = score;
+                best_column = column;
+            }
+        }
+
+        if(best_column == end1)
+        {
+            append_pair(alignment, gap_character, residue2);
+        }
+
+        for(size_t column = begin1; column < end1; ++column)
+        {
+            append_pair(alignment, sequence1[column], (column == best_column) ? residue2 : gap_character);
+        }
+        return;
+    }
+
+    const size_t middle2 = begin2 + (end2 - begin2) / 2;
+    last_row_scores(Sequence_range(sequence1, begin1, end1, false), Sequence_range(sequence2, begin2, middle2, false), score_policy, forward_row);
+    last_row_scores(Sequence_range(sequence1, begin1, end1, true),  Sequence_range(sequence2, middle2, end2, true),   score_policy, backward_row);
+
+    // The path crosses the middle row at the column with the best total.
+    const size_t length1 = end1 - begin1;
+    size_t split = 0;
+    int best_score = forward_row[0] + backward_row[length1];
+    for(size_t column = 1; column <= length1; ++column)
+    {
+        const int score = forward_row[column] + backward_row[length1 - column];
+        if(score > best_score)
+        {
+            best_score = score;
+            split = column;
+        }
+    }
+
+    // The rows are no longer needed, so the recursion can reuse them.
+    hirschberg(sequence1, begin1, begin1 + split, sequence2, begin2, middle2, score_policy, forward_row, backward_row, alignment);
+    hirschberg(sequence1, begin1 + split, end1, sequence2, middle2, end2, score_policy, forward_row, backward_row, alignment);
+}
+
+//---------------------------------------------------------------------------
+Local_alignment linear_space_align(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    int (*score_policy)(char char1, char char2))
+{
+    Local_alignment alignment;
+
+    alignment.score = find_alignment_end(sequence1, sequence2, score_policy, alignment.end1, alignment.end2);
+    if(alignment.score <= 0)
+    {
+        return alignment;
+    }
+
+    find_alignment_begin(sequence1, sequence2, score_policy, alignment.score, alignment.end1, alignment.end2, alignment.begin1, alignment.begin2);
+
+    std::vector<int> forward_row;
+    std::vector<int> backward_row;
+    hirschberg(sequence1, alignment.begin1, alignment.end1,
+               sequence2, alignment.begin2, alignment.end2,
+               score_policy, forward_row, backward_row, alignment);
+
+    return alignment;
+}
+
+//---------------------------------------------------------------------------
+void print_local_alignment(std::ostream& output_stream, const Local_alignment& alignment)
+{
+    output_stream << "Optimal score: " << alignment.score
+                  << " (" << alignment.begin1 << ".." << alignment.end1
+                  << ", " << alignment.begin2 << ".." << alignment.end2 << ")\n"
+                  << alignment.aligned1 << "\n"
+                  << alignment.aligned2 << "\n";
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// One optimal local alignment of a sequence pair.  The aligned strings are
+// the same length, with gap_character where a residue is aligned to a gap.
+struct Local_alignment
+{
+    int score = 0;              // Score of the alignment.
+    size_t begin1 = 0;          // Start of the aligned region of sequence1.
+    size_t end1 = 0;            // One past the end of the aligned region of sequence1.
+    size_t begin2 = 0;          // Start of the aligned region of sequence2.
+    size_t end2 = 0;            // One past the end of the aligned region of sequence2.
+    std::string aligned1;       // sequence1 residues and gaps.
+    std::string aligned2;       // sequence2 residues and gaps.
+};
+
+// Find an optimal local alignment in O(n+m) memory.  A score-only pass finds
+// where the alignment ends and another finds where it begins, then the region
+// between is aligned globally by divide and conquer (Hirschberg, Myers-Miller).
+Local_alignment linear_space_align(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    int (*score_policy)(char char1, char char2));
+
+void print_local_alignment(std::ostream& output_stream, const Local_alignment& alignment);
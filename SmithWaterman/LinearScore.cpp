@@ -0,0 +1,74 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "LinearScore.h"    // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Score a residue pair in the argument order of the score policy, which
+// expects the sequence2 residue first.
+template<bool TRANSPOSED>
+static int pair_score(int (*score_policy)(char char1, char char2), char outer, char inner)
+{
+    return TRANSPOSED ? score_policy(inner, outer) : score_policy(outer, inner);
+}
+
+//---------------------------------------------------------------------------
+// Fill the score table one row at a time, keeping only the previous row.
+// outer is walked by the rows and inner spans the columns.  When TRANSPOSED,
+// outer is sequence1 instead of sequence2.
+template<bool TRANSPOSED>
+static int linear_fill(
+    const std::string& outer,
+    const std::string& inner,
+    int (*score_policy)(char char1, char char2),
+    Score_workspace& workspace)
+{
+    const size_t columns = inner.size() + 1;
+
+    // Column 0 is the base case, and is never written.
+    int* previous_row = workspace.zeroed_scores<int>(columns * 2);
+    int* current_row = previous_row + columns;
+
+    int max_score = 0;
+    for(size_t row = 0; row < outer.size(); ++row)
+    {
+        const char outer_residue = outer[row];
+        const int above_gap = pair_score<TRANSPOSED>(score_policy, outer_residue, gap_character);
+
+        for(size_t column = 1; column < columns; ++column)
+        {
+            const char inner_residue = inner[column - 1];
+
+            int diagonal_score = previous_row[column - 1] + pair_score<TRANSPOSED>(score_policy, outer_residue, inner_residue);
+            int above_score =    previous_row[column]     + above_gap;
+            int left_score =     current_row[column - 1]  + pair_score<TRANSPOSED>(score_policy, gap_character, inner_residue);
+
+            // Take the max score of 0 and the three potential scores and save it.
+            int score = std::max(0, diagonal_score);
+            score = std::max(score, left_score);
+            score = std::max(score, above_score);
+
+            max_score = std::max(max_score, score);
+            current_row[column] = score;
+        }
+
+        std::swap(previous_row, current_row);
+    }
+
+    return max_score;
+}
+
+//---------------------------------------------------------------------------
+int linear_max_score(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    int (*score_policy)(char char1, char char2),
+    Score_workspace& workspace)
+{
+    // Keep the rows as short as possible.
+    if(sequence1.size() <= sequence2.size())
+    {
+        return linear_fill<false>(sequence2, sequence1, score_policy, workspace);
+    }
+
+    return linear_fill<true>(sequence1, sequence2, score_policy, workspace);
+}
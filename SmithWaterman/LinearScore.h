@@ -0,0 +1,62 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// Scratch memory for the score-only engines.  Keep one of these alive across
+// many alignments (e.g. the permutations in a p-value calculation) so the
+// buffers are allocated once and then stay warm in cache.
+//
+// A workspace is not thread safe.  Use one per thread.
+class Score_workspace
+{
+    std::vector<int>     m_int_scores;
+    std::vector<int16_t> m_word_scores;
+    std::vector<uint8_t> m_byte_scores;
+    std::vector<double>  m_log_probabilities;
+
+    template<typename Element>
+    static Element* zeroed(std::vector<Element>& scores, size_t count)
+    {
+        // assign() only reallocates when the buffer must grow.
+        scores.assign(count, 0);
+        return scores.data();
+    }
+
+public:
+    // Return count zeroed elements.  Any previous contents are lost.
+    template<typename Element>
+    Element* zeroed_scores(size_t count);
+};
+
+template<>
+inline int* Score_workspace::zeroed_scores<int>(size_t count)
+{
+    return zeroed(m_int_scores, count);
+}
+
+template<>
+inline int16_t* Score_workspace::zeroed_scores<int16_t>(size_t count)
+{
+    return zeroed(m_word_scores, count);
+}
+
+template<>
+inline uint8_t* Score_workspace::zeroed_scores<uint8_t>(size_t count)
+{
+    return zeroed(m_byte_scores, count);
+}
+
+template<>
+inline double* Score_workspace::zeroed_scores<double>(size_t count)
+{
+    return zeroed(m_log_probabilities, count);
+}
+
+//---------------------------------------------------------------------------
+// Return the max local alignment score of a sequence pair, keeping only two
+// rows of the score table.  Memory is O(min(n,m)), and the result matches the
+// max score of an Alignment_table of the same pair.
+int linear_max_score(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    int (*score_policy)(char char1, char char2),
+    Score_workspace& workspace);
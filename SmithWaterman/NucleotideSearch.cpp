@@ -0,0 +1,317 @@
+#include "PreCompile.h"
+#include "NucleotideSearch.h"   // Pick up forward declarations to ensure correctness.
+
+// Code of bases in a Bit_parallel_pattern.  Codes 0-3 are the packed bases.
+constexpr size_t other_base_code = 4;
+constexpr size_t base_code_count = 5;
+
+//---------------------------------------------------------------------------
+// Return the 2-bit code of a base, or other_base_code.
+// ASCII/UTF-8 is assumed.
+static size_t base_code(char base)
+{
+    switch(toupper(static_cast<unsigned char>(base)))
+    {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default:  return other_base_code;
+    }
+}
+
+//---------------------------------------------------------------------------
+Packed_genome::Packed_genome(const std::string& sequence)
+    : m_words((sequence.size() + 31) / 32)
+    , m_length(sequence.size())
+{
+    for(size_t position = 0; position < m_length; ++position)
+    {
+        const size_t code = base_code(sequence[position]);
+        if(code == other_base_code)
+        {
+            if(!m_other_runs.empty() && (m_other_runs.back().second == position))
+            {
+                ++m_other_runs.back().second;
+            }
+            else
+            {
+                m_other_runs.emplace_back(position, position + 1);
+            }
+            continue;
+        }
+
+        m_words[position / 32] |= static_cast<uint64_t>(code) << (2 * (position % 32));
+    }
+}
+
+//---------------------------------------------------------------------------
+size_t Packed_genome::size() const
+{
+    return m_length;
+}
+
+//---------------------------------------------------------------------------
+const std::vector<uint64_t>& Packed_genome::words() const
+{
+    return m_words;
+}
+
+//---------------------------------------------------------------------------
+const std::vector<std::pair<size_t, size_t>>& Packed_genome::other_runs() const
+{
+    return m_other_runs;
+}
+
+//---------------------------------------------------------------------------
+// Unpack bases [begin, end), with N for bases other than ACGT.
+std::string Packed_genome::substring(size_t begin, size_t end) const
+{
+    static const char bases[] = "ACGT";
+
+    std::string sequence;
+    sequence.reserve(end - begin);
+    for(size_t position = begin; position < end; ++position)
+    {
+        sequence.push_back(bases[(m_words[position / 32] >> (2 * (position % 32))) & 3]);
+    }
+
+    for(const auto& run : m_other_runs)
+    {
+        for(size_t position = std::max(run.first, begin); position < std::min(run.second, end); ++position)
+        {
+            sequence[position - begin] = 'N';
+        }
+    }
+
+    return sequence;
+}
+
+//---------------------------------------------------------------------------
+// Build the match mask of each base code.
+Bit_parallel_pattern::Bit_parallel_pattern(const std::string& pattern)
+    : m_length(pattern.size())
+    , m_block_count((pattern.size() + 63) / 64)
+{
+    m_match_masks.resize(base_code_count * m_block_count);
+    m_reverse_masks.resize(base_code_count * m_block_count);
+
+    for(size_t position = 0; position < m_length; ++position)
+    {
+        const size_t code = base_code(pattern[position]);
+
+        // Set the bit of this base in the masks of both pattern directions.
+        const auto set_bit = [&](std::vector<uint64_t>& masks, size_t bit_position)
+        {
+            const uint64_t bit = uint64_t(1) << (bit_position % 64);
+            const size_t block = bit_position / 64;
+
+            if(code == other_base_code)
+            {
+                // N (or any other symbol) in the pattern matches every base.
+                for(size_t any_code = 0; any_code < base_code_count; ++any_code)
+                {
+                    masks[any_code * m_block_count + block] |= bit;
+                }
+            }
+            else
+            {
+                masks[code * m_block_count + block] |= bit;
+            }
+        };
+
+        set_bit(m_match_masks, position);
+        set_bit(m_reverse_masks, m_length - 1 - position);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Vertical deltas of one 64-row block of the edit distance table, as bit vectors.
+struct Edit_block
+{
+    uint64_t positive;      // Bit i set if row i is one more than row i-1.
+    uint64_t negative;      // Bit i set if row i is one less than row i-1.
+};
+
+//---------------------------------------------------------------------------
+// Advance one block by one text column (Myers, 1999, Figure 4).  carry_in is
+// the horizontal delta (-1, 0 or +1) entering the top row of the block, and
+// the return value is the horizontal delta leaving the row at high_bit.
+static int advance_block(Edit_block& block, uint64_t match, int carry_in, uint64_t high_bit)
+{
+    const uint64_t positive = block.positive;
+    const uint64_t negative = block.negative;
+
+    const uint64_t vertical = match | negative;
+    if(carry_in < 0)
+    {
+        match |= 1;
+    }
+
+    const uint64_t horizontal = (((match & positive) + positive) ^ positive) | match;
+    uint64_t horizontal_positive = negative | ~(horizontal | positive);
+    uint64_t horizontal_negative = positive & horizontal;
+
+    const int carry_out = (horizontal_positive & high_bit) ? 1 : ((horizontal_negative & high_bit) ? -1 : 0);
+
+    horizontal_positive <<= 1;
+    horizontal_negative <<= 1;
+    if(carry_in < 0)
+    {
+        horizontal_negative |= 1;
+    }
+    else if(carry_in > 0)
+    {
+        horizontal_positive |= 1;
+    }
+
+    block.positive = horizontal_negative | ~(vertical | horizontal_positive);
+    block.negative = horizontal_positive & vertical;
+
+    return carry_out;
+}
+
+//---------------------------------------------------------------------------
+// Find where an occurrence that ends at end begins.  The reversed pattern is
+// aligned against the genome read backwards from end, anchored at end, so the
+// top row of the table grows by one per base.  Returns the least distance, and
+// the begin of the shortest occurrence with it.
+int Bit_parallel_pattern::search_end(const Packed_genome& genome, size_t end, int max_distance, size_t& begin) const
+{
+    const uint64_t last_high_bit = uint64_t(1) << ((m_length - 1) % 64);
+    std::vector<Edit_block> blocks(m_block_count, Edit_block { ~uint64_t(0), 0 });
+
+    const size_t span = std::min(end, m_length + static_cast<size_t>(max_distance));
+    const std::string text = genome.substring(end - span, end);
+
+    int distance = static_cast<int>(m_length);
+    int best_distance = distance;
+    begin = end;
+
+    for(size_t length = 1; length <= span; ++length)
+    {
+        const size_t code = base_code(text[span - length]);
+
+        int carry = 1;
+        for(size_t block = 0; block < m_block_count; ++block)
+        {
+            const uint64_t high_bit = (block + 1 == m_block_count) ? last_high_bit : (uint64_t(1) << 63);
+            carry = advance_block(blocks[block], m_reverse_masks[code * m_block_count + block], carry, high_bit);
+        }
+
+        distance += carry;
+        if(distance < best_distance)
+        {
+            best_distance = distance;
+            begin = end - length;
+        }
+    }
+
+    return best_distance;
+}
+
+//---------------------------------------------------------------------------
+std::vector<Nucleotide_occurrence> Bit_parallel_pattern::search(const Packed_genome& genome, int max_distance) const
+{
+    std::vector<Nucleotide_occurrence> occurrences;
+    if(0 == m_length)
+    {
+        return occurrences;
+    }
+
+    const uint64_t last_high_bit = uint64_t(1) << ((m_length - 1) % 64);
+    std::vector<Edit_block> blocks(m_block_count, Edit_block { ~uint64_t(0), 0 });
+
+    // The run of ends under the threshold that is being collected.
+    bool in_run = false;
+    size_t best_end = 0;
+    int best_distance = 0;
+
+    const auto end_run = [&]()
+    {
+        if(in_run)
+        {
+            Nucleotide_occurrence occurrence;
+            occurrence.end = best_end;
+            occurrence.distance = search_end(genome, best_end, max_distance, occurrence.begin);
+            occurrences.push_back(occurrence);
+            in_run = false;
+        }
+    };
+
+    const auto& words = genome.words();
+    const auto& other_runs = genome.other_runs();
+    size_t next_other_run = 0;
+
+    // The distance of the whole pattern against the empty text before the genome.
+    int distance = static_cast<int>(m_length);
+
+    for(size_t position = 0; position < genome.size(); ++position)
+    {
+        size_t code = (words[position / 32] >> (2 * (position % 32))) & 3;
+
+        while((next_other_run < other_runs.size()) && (other_runs[next_other_run].second <= position))
+        {
+            ++next_other_run;
+        }
+        if((next_other_run < other_runs.size()) && (other_runs[next_other_run].first <= position))
+        {
+            code = other_base_code;
+        }
+
+        // An occurrence may start anywhere, so nothing carries into the top row.
+        int carry = 0;
+        if(1 == m_block_count)
+        {
+            carry = advance_block(blocks[0], m_match_masks[code], 0, last_high_bit);
+        }
+        else
+        {
+            for(size_t block = 0; block < m_block_count; ++block)
+            {
+                const uint64_t high_bit = (block + 1 == m_block_count) ? last_high_bit : (uint64_t(1) << 63);
+                carry = advance_block(blocks[block], m_match_masks[code * m_block_count + block], carry, high_bit);
+            }
+        }
+
+        distance += carry;
+
+        if(distance <= max_distance)
+        {
+            if(!in_run || (distance < best_distance))
+            {
+                best_end = position + 1;
+                best_distance = distance;
+            }
+            in_run = true;
+        }
+        else
+        {
+            end_run();
+        }
+    }
+
+    end_run();
+
+    return occurrences;
+}
+
+//---------------------------------------------------------------------------
+// ASCII/UTF-8 is assumed.
+std::string reverse_complement(const std::string& sequence)
+{
+    std::string complement(sequence.rbegin(), sequence.rend());
+    for(char& base : complement)
+    {
+        switch(toupper(static_cast<unsigned char>(base)))
+        {
+            case 'A': base = 'T'; break;
+            case 'C': base = 'G'; break;
+            case 'G': base = 'C'; break;
+            case 'T': base = 'A'; break;
+            default:  base = 'N'; break;
+        }
+    }
+
+    return complement;
+}
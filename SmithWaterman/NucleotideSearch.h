@@ -0,0 +1,61 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// Nucleotide sequence packed two bits per base (A=0, C=1, G=2, T=3), 32 bases
+// per 64-bit word.  Bases other than ACGT (such as N) are kept as a list of
+// runs, since a genome has few of them.
+class Packed_genome
+{
+    std::vector<uint64_t> m_words;                          // Base i is bits 2*(i%32) of word i/32.
+    std::vector<std::pair<size_t, size_t>> m_other_runs;    // [begin, end) of each run of other bases.
+    size_t m_length = 0;
+
+public:
+    // Lower case bases are accepted.
+    explicit Packed_genome(const std::string& sequence);
+
+    size_t size() const;
+    const std::vector<uint64_t>& words() const;
+    const std::vector<std::pair<size_t, size_t>>& other_runs() const;
+    std::string substring(size_t begin, size_t end) const;
+};
+
+//---------------------------------------------------------------------------
+// One approximate occurrence of a pattern in a genome.
+struct Nucleotide_occurrence
+{
+    size_t begin;       // First base of the occurrence.
+    size_t end;         // One past the last base.
+    int distance;       // Edit distance between the pattern and genome[begin, end).
+};
+
+//---------------------------------------------------------------------------
+// Approximate pattern search with the bit-parallel edit distance algorithm
+// (Myers, 1999; in the form of Hyyro, 2003).  Each column of the edit distance
+// table takes a few word operations per 64 pattern bases, so the search runs
+// in O(n * ceil(m/64)) instead of the O(n * m) of a dynamic programming table.
+// Patterns longer than 64 bases are split into blocks of 64, with the
+// horizontal deltas carried from block to block.
+//
+// N in the pattern matches any base, and bases other than ACGT in the genome
+// match only N.
+class Bit_parallel_pattern
+{
+    std::vector<uint64_t> m_match_masks;    // [code][block] bit i set if pattern base i matches code.
+    std::vector<uint64_t> m_reverse_masks;  // m_match_masks of the reversed pattern.
+    size_t m_length;                        // Number of pattern bases.
+    size_t m_block_count;                   // Number of 64-base blocks.
+
+    int search_end(const Packed_genome& genome, size_t end, int max_distance, size_t& begin) const;
+
+public:
+    explicit Bit_parallel_pattern(const std::string& pattern);
+
+    // Report every occurrence within max_distance edits.  Occurrences that end
+    // at adjacent positions overlap, so each run of them is reported once, at
+    // the end with the least distance.
+    std::vector<Nucleotide_occurrence> search(const Packed_genome& genome, int max_distance) const;
+};
+
+// Reverse complement of a nucleotide sequence, to search the other strand.
+std::string reverse_complement(const std::string& sequence);
@@ -0,0 +1,321 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "LinearScore.h"
+#include "BatchScore.h"
+#include "ThreadPool.h"
+#include "PairwiseScores.h" // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Layout of a binary score matrix.  The header is followed by the name starts
+// (size + 1 64-bit integers), the p-values (doubles, if has_pvalues), the
+// scores (32-bit integers), then the names, so every array is naturally aligned.
+// Both triangles hold size * (size + 1) / 2 cells, row by row.
+struct Score_matrix_header
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t size;
+    uint64_t name_bytes;
+    uint64_t has_pvalues;
+    double lambda;
+    double K;
+};
+
+static const char score_matrix_magic[8] = { 'S', 'W', 'S', 'C', 'O', 'R', 'E', '\0' };
+constexpr uint64_t score_matrix_version = 1;
+
+//---------------------------------------------------------------------------
+Score_matrix::Score_matrix(size_t size)
+    : m_size(size)
+    , m_scores(size * (size + 1) / 2)
+{
+}
+
+//---------------------------------------------------------------------------
+// Cells before row r are r rows of decreasing length, size + (size - 1) + ...
+size_t Score_matrix::cell_index(size_t row, size_t column) const
+{
+    if(row > column)
+    {
+        std::swap(row, column);
+    }
+
+    assert(column < m_size);
+    return row * m_size - row * (row - 1) / 2 + (column - row);
+}
+
+//---------------------------------------------------------------------------
+size_t Score_matrix::size() const
+{
+    return m_size;
+}
+
+//---------------------------------------------------------------------------
+int Score_matrix::score(size_t row, size_t column) const
+{
+    return m_scores[cell_index(row, column)];
+}
+
+//---------------------------------------------------------------------------
+void Score_matrix::set_score(size_t row, size_t column, int score)
+{
+    m_scores[cell_index(row, column)] = score;
+}
+
+//---------------------------------------------------------------------------
+bool Score_matrix::has_pvalues() const
+{
+    return !m_pvalues.empty();
+}
+
+//---------------------------------------------------------------------------
+double Score_matrix::pvalue(size_t row, size_t column) const
+{
+    assert(has_pvalues());
+    return m_pvalues[cell_index(row, column)];
+}
+
+//---------------------------------------------------------------------------
+const Gumbel_fit& Score_matrix::fit() const
+{
+    return m_fit;
+}
+
+//---------------------------------------------------------------------------
+// Set the p-value of every scored pair from the fit.
+void Score_matrix::set_pvalues(const Gumbel_fit& fit, const std::vector<std::string>& sequences)
+{
+    assert(sequences.size() == m_size);
+
+    m_fit = fit;
+    if(!fit.is_valid)
+    {
+        m_pvalues.clear();
+        return;
+    }
+
+    m_pvalues.resize(m_scores.size());
+    for(size_t row = 0; row < m_size; ++row)
+    {
+        for(size_t column = row; column < m_size; ++column)
+        {
+            const double search_space = static_cast<double>(sequences[row].size()) * sequences[column].size();
+            m_pvalues[cell_index(row, column)] = karlin_altschul_pvalue(fit, score(row, column), search_space);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Rows are formatted into one string each, since the matrix can have
+// millions of cells.  P-values follow their score as score/p-value.
+void Score_matrix::write_tsv(std::ostream& output_stream, const std::vector<std::string>& names) const
+{
+    assert(names.size() == m_size);
+
+    std::string line;
+    for(const auto& name : names)
+    {
+        line += '\t';
+        line += name;
+    }
+    line += '\n';
+    output_stream << line;
+
+    char pvalue_text[32];
+    for(size_t row = 0; row < m_size; ++row)
+    {
+        line = names[row];
+        for(size_t column = 0; column < m_size; ++column)
+        {
+            line += '\t';
+            line += std::to_string(score(row, column));
+
+            if(has_pvalues())
+            {
+                snprintf(pvalue_text, sizeof(pvalue_text), "/%.3g", pvalue(row, column));
+                line += pvalue_text;
+            }
+        }
+        line += '\n';
+        output_stream << line;
+    }
+}
+
+//---------------------------------------------------------------------------
+void Score_matrix::write_binary(std::ostream& output_stream, const std::vector<std::string>& names) const
+{
+    assert(names.size() == m_size);
+
+    std::vector<uint64_t> name_starts(1, 0);
+    for(const auto& name : names)
+    {
+        name_starts.push_back(name_starts.back() + name.size());
+    }
+
+    Score_matrix_header header = {};
+    std::copy(std::begin(score_matrix_magic), std::end(score_matrix_magic), header.magic);
+    header.version = score_matrix_version;
+    header.size = m_size;
+    header.name_bytes = name_starts.back();
+    header.has_pvalues = has_pvalues() ? 1 : 0;
+    header.lambda = m_fit.is_valid ? m_fit.lambda : 0.0;
+    header.K = m_fit.is_valid ? std::exp(m_fit.lambda * m_fit.mu) : 0.0;
+
+    output_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output_stream.write(reinterpret_cast<const char*>(name_starts.data()), name_starts.size() * sizeof(uint64_t));
+    output_stream.write(reinterpret_cast<const char*>(m_pvalues.data()), m_pvalues.size() * sizeof(double));
+    static_assert(sizeof(int) == sizeof(int32_t), "Scores are written as 32-bit integers.");
+    output_stream.write(reinterpret_cast<const char*>(m_scores.data()), m_scores.size() * sizeof(int));
+
+    for(const auto& name : names)
+    {
+        output_stream.write(name.data(), name.size());
+    }
+}
+
+//---------------------------------------------------------------------------
+// Score one row of the matrix from column first_column to last_column (one
+// past the last).  The row's sequence is the query of a batch profile, and
+// the columns' sequences are its targets.
+static void score_row(
+    Score_matrix& matrix,
+    const std::vector<std::string>& sequences,
+    int (*score_policy)(char char1, char char2),
+    size_t row,
+    size_t first_column,
+    size_t last_column,
+    Score_workspace& workspace)
+{
+    const Batch_profile profile(sequences[row], BLOSUM62_residues, score_policy);
+
+    std::vector<int> max_scores;
+    if(profile.is_valid())
+    {
+        const std::vector<std::string> targets(sequences.cbegin() + first_column, sequences.cbegin() + last_column);
+        max_scores = profile.max_scores(targets, workspace);
+    }
+    else
+    {
+        for(size_t column = first_column; column < last_column; ++column)
+        {
+            max_scores.push_back(linear_max_score(sequences[row], sequences[column], score_policy, workspace));
+        }
+    }
+
+    for(size_t column = first_column; column < last_column; ++column)
+    {
+        matrix.set_score(row, column, max_scores[column - first_column]);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Score pvalue_samples random pairs, with the second of each shuffled, and fit
+// them.  Samples are drawn in blocks seeded from (seed, block), so the fit
+// does not depend on the thread count.
+static Gumbel_fit fit_sequence_set(
+    const std::vector<std::string>& sequences,
+    int (*score_policy)(char char1, char char2),
+    Work_stealing_pool& pool,
+    std::vector<Score_workspace>& workspaces,
+    unsigned int pvalue_samples,
+    uint32_t seed)
+{
+    constexpr unsigned int samples_per_block = 64;
+
+    std::vector<int> scores(pvalue_samples);
+    std::vector<double> search_spaces(pvalue_samples);
+
+    for(unsigned int first = 0; first < pvalue_samples; first += samples_per_block)
+    {
+        const unsigned int last = std::min(first + samples_per_block, pvalue_samples);
+        pool.submit([&, first, last](unsigned int worker)
+        {
+            std::seed_seq block_seed { seed, first / samples_per_block };
+            std::mt19937 generator(block_seed);
+
+            for(unsigned int sample = first; sample < last; ++sample)
+            {
+                // Multiply-shift, as in permute_sequence, to pick the same pairs on every platform.
+                const size_t row = static_cast<size_t>((static_cast<uint64_t>(generator()) * sequences.size()) >> 32);
+                const size_t column = static_cast<size_t>((static_cast<uint64_t>(generator()) * sequences.size()) >> 32);
+
+                std::string shuffled(sequences[column]);
+                permute_sequence(shuffled, generator);
+
+                scores[sample] = linear_max_score(sequences[row], shuffled, score_policy, workspaces[worker]);
+                search_spaces[sample] = static_cast<double>(sequences[row].size()) * shuffled.size();
+            }
+        });
+    }
+
+    pool.wait();
+
+    return fit_karlin_altschul(scores, search_spaces);
+}
+
+//---------------------------------------------------------------------------
+Score_matrix all_vs_all_scores(
+    const std::vector<std::string>& sequences,
+    int (*score_policy)(char char1, char char2),
+    unsigned int thread_count,
+    unsigned int pvalue_samples,
+    uint32_t seed)
+{
+    // Tasks per thread, so that the pool can even out tasks that run long.
+    constexpr uint64_t tasks_per_thread = 16;
+
+    std::vector<std::string> normalized(sequences);
+    for(auto& sequence : normalized)
+    {
+        normalize_BLOSUM62_residues(sequence);
+    }
+
+    Score_matrix matrix(normalized.size());
+    Work_stealing_pool pool(thread_count);
+    std::vector<Score_workspace> workspaces(pool.thread_count());
+
+    uint64_t total_cost = 0;
+    for(size_t row = 0; row < normalized.size(); ++row)
+    {
+        for(size_t column = row; column < normalized.size(); ++column)
+        {
+            total_cost += static_cast<uint64_t>(normalized[row].size()) * normalized[column].size();
+        }
+    }
+
+    const uint64_t task_cost = std::max<uint64_t>(1, total_cost / (tasks_per_thread * pool.thread_count()));
+
+    // Cut each row of the upper triangle into runs of columns whose length
+    // products add up to about task_cost.  Long rows make several tasks, and
+    // short rows one task each.
+    for(size_t row = 0; row < normalized.size(); ++row)
+    {
+        size_t first_column = row;
+        uint64_t cost = 0;
+
+        for(size_t column = row; column < normalized.size(); ++column)
+        {
+            cost += static_cast<uint64_t>(normalized[row].size()) * normalized[column].size();
+
+            if((cost >= task_cost) || (column + 1 == normalized.size()))
+            {
+                pool.submit([&matrix, &normalized, &workspaces, score_policy, row, first_column, last_column = column + 1](unsigned int worker)
+                {
+                    score_row(matrix, normalized, score_policy, row, first_column, last_column, workspaces[worker]);
+                });
+
+                first_column = column + 1;
+                cost = 0;
+            }
+        }
+    }
+
+    pool.wait();
+
+    if((pvalue_samples > 0) && !normalized.empty())
+    {
+        matrix.set_pvalues(fit_sequence_set(normalized, score_policy, pool, workspaces, pvalue_samples, seed), normalized);
+    }
+
+    return matrix;
+}
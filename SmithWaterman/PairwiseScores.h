@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Significance.h"
+
+//---------------------------------------------------------------------------
+// Symmetric matrix of max local alignment scores between every pair of a set
+// of sequences, including each sequence against itself.  Only the upper
+// triangle is stored, row by row.
+class Score_matrix
+{
+    size_t m_size = 0;                  // Number of sequences.
+    std::vector<int> m_scores;          // Upper triangle of scores.
+    std::vector<double> m_pvalues;      // Upper triangle of p-values, or empty.
+    Gumbel_fit m_fit;                   // Fit the p-values come from.
+
+    size_t cell_index(size_t row, size_t column) const;
+
+public:
+    explicit Score_matrix(size_t size);
+
+    size_t size() const;
+    int score(size_t row, size_t column) const;
+    void set_score(size_t row, size_t column, int score);
+
+    bool has_pvalues() const;
+    double pvalue(size_t row, size_t column) const;
+    const Gumbel_fit& fit() const;
+    void set_pvalues(const Gumbel_fit& fit, const std::vector<std::string>& sequences);
+
+    // Tab separated, with a header row and column of names.
+    void write_tsv(std::ostream& output_stream, const std::vector<std::string>& names) const;
+
+    // Header, name offsets, p-values (if any), scores and names, in the byte
+    // order of the machine.
+    void write_binary(std::ostream& output_stream, const std::vector<std::string>& names) const;
+};
+
+// Score every pair of protein sequences.  Only the upper triangle is aligned,
+// split into tasks of roughly equal cost (the sum of the length products of
+// their pairs) on a work-stealing pool of thread_count threads (0 for every
+// hardware thread).  The scores do not depend on thread_count.
+//
+// With pvalue_samples other than 0, that many random pairs, one of each
+// shuffled, are scored to fit the Karlin-Altschul parameters of the set,
+// which give the p-value of every pair.
+Score_matrix all_vs_all_scores(
+    const std::vector<std::string>& sequences,
+    int (*score_policy)(char char1, char char2),
+    unsigned int thread_count,
+    unsigned int pvalue_samples,
+    uint32_t seed);
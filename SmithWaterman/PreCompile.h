@@ -2,9 +2,27 @@
 
 #include <cassert>
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
@@ -0,0 +1,825 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "LinearScore.h"
+#include "ThreadPool.h"
+#include "ProfileHmm.h"     // Pick up forward declarations to ensure correctness.
+#include <Shared/Probability.h>
+#include <Shared/fasta.h>
+
+constexpr char Profile_hmm::residues[];
+constexpr size_t Profile_hmm::residue_count;
+
+// Background frequencies of the residues, in Profile_hmm::residues order
+// (the BLOSUM-62 background of HMMER).
+static const double background_frequencies[Profile_hmm::residue_count] =
+{
+    0.0787945, 0.0151600, 0.0535222, 0.0668298, 0.0397062,
+    0.0695071, 0.0229198, 0.0590092, 0.0594422, 0.0963728,
+    0.0237718, 0.0414386, 0.0482904, 0.0395639, 0.0540978,
+    0.0683364, 0.0540687, 0.0673417, 0.0114135, 0.0304133,
+};
+
+// Rows of a filter layout: each residue, then one for any other residue.
+constexpr size_t residue_row_count = Profile_hmm::residue_count + 1;
+
+// Fixed point scales of the filters, in units per nat.  MSV bytes are in
+// thirds of a bit, and Viterbi words in 500ths of a bit.  The base keeps
+// scores above 0, which stands for log(0) in the filters.
+static const double msv_scale = 3.0 / std::log(2.0);
+constexpr int msv_base = 190;
+static const double viterbi_scale = 500.0 / std::log(2.0);
+constexpr int viterbi_base = 12000;
+
+// The filters leave out the N, C and J loops, whose total over a target of
+// length L is about L log(L / (L + 3)), or -3 nats.
+constexpr double filter_loop_nats = -3.0;
+
+// Random sequences scored to calibrate the p-values.
+constexpr size_t calibration_sequence_count = 400;
+constexpr size_t calibration_sequence_length = 100;
+
+// Fraction of the Forward scores of random sequences in the exponential tail.
+constexpr double forward_tail_mass = 0.1;
+
+//---------------------------------------------------------------------------
+// Log probability of the null model emitting a target of length L, relative
+// to its residue background, which the emission log-odds already cancel.
+static double null_nats(size_t length)
+{
+    const double L = static_cast<double>(length);
+    return L * std::log(L / (L + 1.0)) + std::log(1.0 / (L + 1.0));
+}
+
+//---------------------------------------------------------------------------
+// Log probability of moving on from N, C or J for a target of length L
+// (the expected length of each of them is L / 3).
+static double move_nats(size_t length)
+{
+    return std::log(3.0 / (length + 3.0));
+}
+
+//---------------------------------------------------------------------------
+// Scale a log probability to a fixed point score, with log(0) at the floor.
+static int fixed_point(double nats, double scale, int floor)
+{
+    const double score = std::round(nats * scale);
+    return (score < floor) ? floor : static_cast<int>(score);
+}
+
+//---------------------------------------------------------------------------
+// Counting works on the states of each aligned sequence in turn, following
+// the path the alignment gives it through the nodes.
+Profile_hmm::Profile_hmm(const std::vector<std::string>& alignment, uint32_t seed)
+{
+    m_codes.fill(static_cast<uint8_t>(residue_count));
+    for(size_t code = 0; code < residue_count; ++code)
+    {
+        m_codes[static_cast<uint8_t>(residues[code])] = static_cast<uint8_t>(code);
+        m_codes[static_cast<uint8_t>(tolower(residues[code]))] = static_cast<uint8_t>(code);
+    }
+
+    const auto is_gap = [](char residue)
+    {
+        return (residue == '-') || (residue == '.');
+    };
+
+    if(alignment.empty() || alignment[0].empty())
+    {
+        return;
+    }
+
+    const size_t column_count = alignment[0].size();
+    for(const auto& sequence : alignment)
+    {
+        if(sequence.size() != column_count)
+        {
+            return;
+        }
+    }
+
+    // Columns with residues in at least half of the sequences are nodes.
+    std::vector<bool> is_node(column_count);
+    for(size_t column = 0; column < column_count; ++column)
+    {
+        size_t residue_count_in_column = 0;
+        for(const auto& sequence : alignment)
+        {
+            residue_count_in_column += is_gap(sequence[column]) ? 0 : 1;
+        }
+
+        is_node[column] = (2 * residue_count_in_column >= alignment.size());
+        m_length += is_node[column] ? 1 : 0;
+    }
+
+    if(0 == m_length)
+    {
+        return;
+    }
+
+    // Laplace pseudocounts: one of each emission and each transition.
+    std::vector<double> emission_counts(m_length * residue_count, 1.0);
+    std::vector<double> transition_counts(m_length * transition_count, 1.0);
+
+    enum State { match_state, insert_state, delete_state, begin_state };
+
+    for(const auto& sequence : alignment)
+    {
+        State state = begin_state;
+        size_t node = 0;        // Node of state (one past the last node passed, for begin).
+
+        for(size_t column = 0; column < column_count; ++column)
+        {
+            const bool has_residue = !is_gap(sequence[column]);
+            State next_state;
+            size_t next_node = node;
+
+            if(is_node[column])
+            {
+                next_node = (begin_state == state) ? 0 : node + 1;
+                next_state = has_residue ? match_state : delete_state;
+            }
+            else if(has_residue)
+            {
+                next_state = insert_state;
+            }
+            else
+            {
+                continue;
+            }
+
+            // Local entry and exit are uniform, so begin and end transitions
+            // are not counted.  Plan7 has no I<->D transitions, so they aren't either.
+            const bool from_node = (begin_state != state) && ((insert_state != next_state) || (match_state == state) || (insert_state == state));
+            if(from_node && (next_node < m_length))
+            {
+                int transition = -1;
+                switch(state)
+                {
+                    case match_state:  transition = (match_state == next_state) ? match_match : (insert_state == next_state) ? match_insert : match_delete; break;
+                    case insert_state: transition = (match_state == next_state) ? insert_match : (insert_state == next_state) ? insert_insert : -1; break;
+                    case delete_state: transition = (match_state == next_state) ? delete_match : (delete_state == next_state) ? delete_delete : -1; break;
+                    default: break;
+                }
+
+                if(transition >= 0)
+                {
+                    transition_counts[node * transition_count + transition] += 1.0;
+                }
+            }
+
+            if(match_state == next_state)
+            {
+                const uint8_t code = m_codes[static_cast<uint8_t>(sequence[column])];
+                if(code < residue_count)
+                {
+                    emission_counts[next_node * residue_count + code] += 1.0;
+                }
+            }
+
+            // Inserts before the first node have no node to belong to.
+            if((insert_state != next_state) || (begin_state != state))
+            {
+                state = next_state;
+                node = next_node;
+            }
+        }
+    }
+
+    // Emission log-odds against the background, with 0 for other residues.
+    m_match_scores.assign(m_length * residue_row_count, 0.0);
+    for(size_t node = 0; node < m_length; ++node)
+    {
+        double total = 0.0;
+        for(size_t code = 0; code < residue_count; ++code)
+        {
+            total += emission_counts[node * residue_count + code];
+        }
+
+        for(size_t code = 0; code < residue_count; ++code)
+        {
+            const double probability = emission_counts[node * residue_count + code] / total;
+            m_match_scores[node * residue_row_count + code] = std::log(probability / background_frequencies[code]);
+        }
+    }
+
+    // Transition log probabilities, normalized over each source state.
+    m_transitions.assign(m_length * transition_count, 0.0);
+    for(size_t node = 0; node < m_length; ++node)
+    {
+        const double* counts = &transition_counts[node * transition_count];
+        double* transitions = &m_transitions[node * transition_count];
+
+        const double match_total = counts[match_match] + counts[match_insert] + counts[match_delete];
+        const double insert_total = counts[insert_match] + counts[insert_insert];
+        const double delete_total = counts[delete_match] + counts[delete_delete];
+
+        transitions[match_match] = std::log(counts[match_match] / match_total);
+        transitions[match_insert] = std::log(counts[match_insert] / match_total);
+        transitions[match_delete] = std::log(counts[match_delete] / match_total);
+        transitions[insert_match] = std::log(counts[insert_match] / insert_total);
+        transitions[insert_insert] = std::log(counts[insert_insert] / insert_total);
+        transitions[delete_match] = std::log(counts[delete_match] / delete_total);
+        transitions[delete_delete] = std::log(counts[delete_delete] / delete_total);
+    }
+
+    // The last node has nowhere to go but E.
+    double* last_transitions = &m_transitions[(m_length - 1) * transition_count];
+    std::fill(last_transitions, last_transitions + transition_count, -std::numeric_limits<double>::infinity());
+
+#if defined(SIMD_VECTOR_ENABLED)
+    build_msv_layout(m_msv_bytes);
+    build_viterbi_layout(m_viterbi_words);
+#endif
+    build_msv_layout(m_msv_ints);
+    build_viterbi_layout(m_viterbi_ints);
+
+    calibrate(seed);
+}
+
+//---------------------------------------------------------------------------
+// MSV scores only need match emissions.  Unsigned bytes are biased by the
+// largest penalty, so the layout is invalid if that pushes a score past 255.
+template<typename Vector>
+void Profile_hmm::build_msv_layout(Filter_layout<Vector>& layout) const
+{
+    const size_t lanes = Vector::lanes;
+    layout.segment_count = (m_length + lanes - 1) / lanes;
+
+    int min_score = 0;
+    int max_score = 0;
+    for(double score : m_match_scores)
+    {
+        min_score = std::min(min_score, fixed_point(score, msv_scale, INT_MIN / 2));
+        max_score = std::max(max_score, fixed_point(score, msv_scale, INT_MIN / 2));
+    }
+
+    layout.bias = Vector::biased ? -min_score : 0;
+    layout.valid = !Vector::biased || (max_score + layout.bias <= Vector::element_max);
+    if(!layout.valid)
+    {
+        return;
+    }
+
+    // Padding nodes past the end of the model score log(0), the floor (or
+    // the largest penalty in biased bytes).
+    layout.emissions.assign(residue_row_count * layout.segment_count * lanes, static_cast<typename Vector::element_type>(Vector::biased ? 0 : -Vector::element_max / 2));
+    for(size_t code = 0; code < residue_row_count; ++code)
+    {
+        for(size_t node = 0; node < m_length; ++node)
+        {
+            const size_t segment = node % layout.segment_count;
+            const size_t lane = node / layout.segment_count;
+            const int score = fixed_point(m_match_scores[node * residue_row_count + code], msv_scale, INT_MIN / 2) + layout.bias;
+
+            layout.emissions[(code * layout.segment_count + segment) * lanes + lane] = static_cast<typename Vector::element_type>(score);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Transitions into a node (M->M, I->M, D->M) are stored with the node they
+// enter, and the others with the node they leave.  Log(0) is a large penalty,
+// which floors any score it is added to.
+template<typename Vector>
+void Profile_hmm::build_viterbi_layout(Filter_layout<Vector>& layout) const
+{
+    const size_t lanes = Vector::lanes;
+    const int log_zero = -viterbi_base * 2;
+    layout.segment_count = (m_length + lanes - 1) / lanes;
+    layout.valid = true;
+
+    layout.emissions.assign(residue_row_count * layout.segment_count * lanes, static_cast<typename Vector::element_type>(log_zero));
+    layout.transitions.assign(layout.segment_count * transition_count * lanes, static_cast<typename Vector::element_type>(log_zero));
+
+    for(size_t node = 0; node < m_length; ++node)
+    {
+        const size_t segment = node % layout.segment_count;
+        const size_t lane = node / layout.segment_count;
+
+        for(size_t code = 0; code < residue_row_count; ++code)
+        {
+            const int score = fixed_point(m_match_scores[node * residue_row_count + code], viterbi_scale, log_zero);
+            layout.emissions[(code * layout.segment_count + segment) * lanes + lane] = static_cast<typename Vector::element_type>(score);
+        }
+
+        for(size_t transition = 0; transition < transition_count; ++transition)
+        {
+            // Transitions into node come from the node before it.
+            const bool is_into = (match_match == transition) || (insert_match == transition) || (delete_match == transition);
+            if(is_into && (0 == node))
+            {
+                continue;
+            }
+
+            const size_t source_node = is_into ? node - 1 : node;
+            const int score = fixed_point(m_transitions[source_node * transition_count + transition], viterbi_scale, log_zero);
+            layout.transitions[(segment * transition_count + transition) * lanes + lane] = static_cast<typename Vector::element_type>(score);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Ungapped local Viterbi with multiple hits (Eddy, 2011, Figure 2).  Each
+// node is entered from B or from the node before it, and exits to E.
+template<typename Vector>
+double Profile_hmm::msv_nats(const Filter_layout<Vector>& layout, const std::string& sequence, Score_workspace& workspace) const
+{
+    typedef typename Vector::vector_type vector_type;
+
+    const size_t segment_count = layout.segment_count;
+    typename Vector::element_type* scores = workspace.zeroed_scores<typename Vector::element_type>(segment_count * Vector::lanes);
+
+    const double L = static_cast<double>(sequence.size());
+    const int entry_cost = -fixed_point(std::log(2.0 / (m_length * (m_length + 1.0))), msv_scale, INT_MIN / 2);
+    const int exit_cost = -fixed_point(std::log(0.5), msv_scale, INT_MIN / 2);
+    const int move_cost = -fixed_point(move_nats(sequence.size()), msv_scale, INT_MIN / 2);
+
+    const vector_type bias = Vector::splat(layout.bias);
+    int begin_score = msv_base - move_cost;
+    int joined_score = 0;
+    int end_score = 0;
+
+    for(char residue : sequence)
+    {
+        const typename Vector::element_type* emissions = &layout.emissions[m_codes[static_cast<uint8_t>(residue)] * segment_count * Vector::lanes];
+        const vector_type begin = Vector::splat(std::max(begin_score - entry_cost, 0));
+
+        vector_type previous = Vector::shift_in_zero(Vector::load(scores + (segment_count - 1) * Vector::lanes));
+        vector_type best = Vector::zero();
+
+        for(size_t segment = 0; segment < segment_count; ++segment)
+        {
+            vector_type score = Vector::max(previous, begin);
+            score = Vector::add_score(score, Vector::load(emissions + segment * Vector::lanes), bias);
+            best = Vector::max(best, score);
+
+            previous = Vector::load(scores + segment * Vector::lanes);
+            Vector::store(scores + segment * Vector::lanes, score);
+        }
+
+        const int exit_score = Vector::horizontal_max(best);
+        if(Vector::saturates && (exit_score >= Vector::element_max - layout.bias))
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        joined_score = std::max(joined_score, exit_score - exit_cost);
+        end_score = std::max(end_score, exit_score - exit_cost);
+        begin_score = std::max(msv_base - move_cost, joined_score - move_cost);
+    }
+
+    if((0 == end_score) || (0.0 == L))
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    return (end_score - move_cost - msv_base) / msv_scale + filter_loop_nats - null_nats(sequence.size());
+}
+
+//---------------------------------------------------------------------------
+// Striped Viterbi (Farrar, 2007; Eddy, 2011).  D->D chains that cross from
+// one lane to the next are filled in after each row by the "lazy F" loop,
+// which stops as soon as no delete score would change.  Only match states
+// exit to E, since a path that ends in D_k scores less than the same path
+// ending at the match state before the deletes.
+template<typename Vector>
+double Profile_hmm::viterbi_nats(const Filter_layout<Vector>& layout, const std::string& sequence, Score_workspace& workspace) const
+{
+    typedef typename Vector::vector_type vector_type;
+
+    const size_t lanes = Vector::lanes;
+    const size_t segment_count = layout.segment_count;
+    typename Vector::element_type* rows = workspace.zeroed_scores<typename Vector::element_type>(3 * segment_count * lanes);
+    typename Vector::element_type* match_scores = rows;
+    typename Vector::element_type* insert_scores = rows + segment_count * lanes;
+    typename Vector::element_type* delete_scores = rows + 2 * segment_count * lanes;
+
+    const auto transition = [&layout](size_t segment, int which)
+    {
+        return Vector::load(&layout.transitions[(segment * transition_count + which) * lanes]);
+    };
+
+    const int entry_score = fixed_point(std::log(2.0 / (m_length * (m_length + 1.0))), viterbi_scale, -viterbi_base);
+    const int exit_score = fixed_point(std::log(0.5), viterbi_scale, -viterbi_base);
+    const int move_score = fixed_point(move_nats(sequence.size()), viterbi_scale, -viterbi_base);
+
+    int begin_score = viterbi_base + move_score;
+    int joined_score = 0;
+    int end_score = 0;
+
+    for(char residue : sequence)
+    {
+        const typename Vector::element_type* emissions = &layout.emissions[m_codes[static_cast<uint8_t>(residue)] * segment_count * lanes];
+        const vector_type begin = Vector::splat(std::min(std::max(begin_score + entry_score, 0), static_cast<int>(Vector::element_max)));
+
+        vector_type previous_match = Vector::shift_in_zero(Vector::load(match_scores + (segment_count - 1) * lanes));
+        vector_type previous_insert = Vector::shift_in_zero(Vector::load(insert_scores + (segment_count - 1) * lanes));
+        vector_type previous_delete = Vector::shift_in_zero(Vector::load(delete_scores + (segment_count - 1) * lanes));
+        vector_type delete_carry = Vector::zero();
+        vector_type best = Vector::zero();
+
+        for(size_t segment = 0; segment < segment_count; ++segment)
+        {
+            vector_type score = begin;
+            score = Vector::max(score, Vector::add_score(previous_match, transition(segment, match_match), Vector::zero()));
+            score = Vector::max(score, Vector::add_score(previous_insert, transition(segment, insert_match), Vector::zero()));
+            score = Vector::max(score, Vector::add_score(previous_delete, transition(segment, delete_match), Vector::zero()));
+            score = Vector::add_score(score, Vector::load(emissions + segment * lanes), Vector::zero());
+            best = Vector::max(best, score);
+
+            // The scores of the row above, at this node, feed the next node and this node's insert.
+            previous_match = Vector::load(match_scores + segment * lanes);
+            previous_insert = Vector::load(insert_scores + segment * lanes);
+            previous_delete = Vector::load(delete_scores + segment * lanes);
+
+            Vector::store(match_scores + segment * lanes, score);
+            Vector::store(delete_scores + segment * lanes, delete_carry);
+            delete_carry = Vector::max(
+                Vector::add_score(score, transition(segment, match_delete), Vector::zero()),
+                Vector::add_score(delete_carry, transition(segment, delete_delete), Vector::zero()));
+
+            const vector_type insert = Vector::max(
+                Vector::add_score(previous_match, transition(segment, match_insert), Vector::zero()),
+                Vector::add_score(previous_insert, transition(segment, insert_insert), Vector::zero()));
+            Vector::store(insert_scores + segment * lanes, insert);
+        }
+
+        // Deletes that carry past the last segment continue in the next lane.
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+            delete_carry = Vector::shift_in_zero(delete_carry);
+            for(size_t segment = 0; segment < segment_count; ++segment)
+            {
+                const vector_type delete_score = Vector::load(delete_scores + segment * lanes);
+                if(!Vector::any_greater(delete_carry, delete_score))
+                {
+                    break;
+                }
+
+                changed = (segment + 1 == segment_count);
+                const vector_type updated = Vector::max(delete_carry, delete_score);
+                Vector::store(delete_scores + segment * lanes, updated);
+                delete_carry = Vector::add_score(updated, transition(segment, delete_delete), Vector::zero());
+            }
+        }
+
+        const int row_end_score = Vector::horizontal_max(best);
+        if(Vector::saturates && (row_end_score >= Vector::element_max))
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        joined_score = std::max(joined_score, row_end_score + exit_score);
+        end_score = std::max(end_score, row_end_score + exit_score);
+        begin_score = std::max(viterbi_base + move_score, joined_score + move_score);
+    }
+
+    if((0 == end_score) || sequence.empty())
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    return (end_score + move_score - viterbi_base) / viterbi_scale + filter_loop_nats - null_nats(sequence.size());
+}
+
+//---------------------------------------------------------------------------
+// Forward over two rows of M, I and D scores, with NaN for log(0) as
+// log_of_sum_of_logs expects.  Every transition of the model is used,
+// including the N, C and J loops that the filters leave out.
+double Profile_hmm::forward_nats(const std::string& sequence, Score_workspace& workspace) const
+{
+    const double log_zero = std::numeric_limits<double>::quiet_NaN();
+    const size_t L = sequence.size();
+    if(0 == L)
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    double* rows = workspace.zeroed_scores<double>(6 * m_length);
+    std::fill(rows, rows + 6 * m_length, log_zero);
+    double* match_scores[2] = { rows, rows + m_length };
+    double* insert_scores[2] = { rows + 2 * m_length, rows + 3 * m_length };
+    double* delete_scores[2] = { rows + 4 * m_length, rows + 5 * m_length };
+
+    const double entry = std::log(2.0 / (m_length * (m_length + 1.0)));
+    const double exit = std::log(0.5);
+    const double loop = std::log(L / (L + 3.0));
+    const double move = move_nats(L);
+
+    double n_score = 0.0;
+    double begin_score = move;
+    double joined_score = log_zero;
+    double c_score = log_zero;
+
+    for(size_t position = 0; position < L; ++position)
+    {
+        const size_t current = (position + 1) % 2;
+        const size_t previous = position % 2;
+        const double* emissions = &m_match_scores[0];
+        const size_t code = m_codes[static_cast<uint8_t>(sequence[position])];
+
+        double end_score = log_zero;
+        for(size_t node = 0; node < m_length; ++node)
+        {
+            double match = begin_score + entry;
+            double deletion = log_zero;
+            if(node > 0)
+            {
+                const double* from = &m_transitions[(node - 1) * transition_count];
+                match = log_of_sum_of_logs(match, match_scores[previous][node - 1] + from[match_match]);
+                match = log_of_sum_of_logs(match, insert_scores[previous][node - 1] + from[insert_match]);
+                match = log_of_sum_of_logs(match, delete_scores[previous][node - 1] + from[delete_match]);
+
+                deletion = log_of_sum_of_logs(match_scores[current][node - 1] + from[match_delete], delete_scores[current][node - 1] + from[delete_delete]);
+            }
+
+            const double* here = &m_transitions[node * transition_count];
+            match_scores[current][node] = match + emissions[node * residue_row_count + code];
+            insert_scores[current][node] = log_of_sum_of_logs(match_scores[previous][node] + here[match_insert], insert_scores[previous][node] + here[insert_insert]);
+            delete_scores[current][node] = deletion;
+
+            end_score = log_of_sum_of_logs(end_score, match_scores[current][node]);
+            end_score = log_of_sum_of_logs(end_score, deletion);
+        }
+
+        n_score += loop;
+        joined_score = log_of_sum_of_logs(joined_score + loop, end_score + exit);
+        c_score = log_of_sum_of_logs(c_score + loop, end_score + exit);
+        begin_score = log_of_sum_of_logs(n_score + move, joined_score + move);
+    }
+
+    if(std::isnan(c_score))
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    return c_score + move - null_nats(L);
+}
+
+//---------------------------------------------------------------------------
+// Score random sequences drawn from the background.  A model built from a few
+// sequences is too weak for the fixed lambda of HMMER (ln 2 per bit), so both
+// parameters of each distribution are fit.  The Forward tail starts where
+// forward_tail_mass of the scores are above it, and its lambda is the maximum
+// likelihood estimate of an exponential, 1 / mean(x - tau).
+void Profile_hmm::calibrate(uint32_t seed)
+{
+    std::mt19937 generator(seed);
+    Score_workspace workspace;
+
+    std::vector<double> msv_scores;
+    std::vector<double> viterbi_scores;
+    std::vector<double> forward_scores;
+    std::string sequence(calibration_sequence_length, 'A');
+
+    for(size_t ix = 0; ix < calibration_sequence_count; ++ix)
+    {
+        for(char& residue : sequence)
+        {
+            // The generator output is fully specified, so this gives the same sequences on every platform.
+            double uniform = generator() / 4294967296.0;
+            size_t code = 0;
+            while((code + 1 < residue_count) && (uniform >= background_frequencies[code]))
+            {
+                uniform -= background_frequencies[code];
+                ++code;
+            }
+
+            residue = residues[code];
+        }
+
+        msv_scores.push_back(msv_score(sequence, workspace));
+        viterbi_scores.push_back(viterbi_score(sequence, workspace));
+        forward_scores.push_back(forward_score(sequence, workspace));
+    }
+
+    m_msv_fit = fit_gumbel(msv_scores);
+    m_viterbi_fit = fit_gumbel(viterbi_scores);
+
+    std::sort(forward_scores.begin(), forward_scores.end());
+    const size_t tail_begin = static_cast<size_t>((1.0 - forward_tail_mass) * forward_scores.size());
+    m_forward_tau = forward_scores[tail_begin];
+
+    double excess = 0.0;
+    for(size_t ix = tail_begin + 1; ix < forward_scores.size(); ++ix)
+    {
+        excess += forward_scores[ix] - m_forward_tau;
+    }
+
+    m_forward_lambda = (excess > 0.0) ? (forward_scores.size() - tail_begin - 1) / excess : std::log(2.0);
+}
+
+//---------------------------------------------------------------------------
+bool Profile_hmm::is_valid() const
+{
+    return m_length > 0;
+}
+
+//---------------------------------------------------------------------------
+size_t Profile_hmm::length() const
+{
+    return m_length;
+}
+
+//---------------------------------------------------------------------------
+double Profile_hmm::msv_score(const std::string& sequence, Score_workspace& workspace) const
+{
+    assert(is_valid());
+
+#if defined(SIMD_VECTOR_ENABLED)
+    // Only strong hits overflow the bytes, so rescoring them in ints is rare.
+    if(m_msv_bytes.valid)
+    {
+        const double score = msv_nats(m_msv_bytes, sequence, workspace);
+        if(!std::isinf(score) || (score < 0.0))
+        {
+            return score / std::log(2.0);
+        }
+    }
+#endif
+
+    return msv_nats(m_msv_ints, sequence, workspace) / std::log(2.0);
+}
+
+//---------------------------------------------------------------------------
+double Profile_hmm::viterbi_score(const std::string& sequence, Score_workspace& workspace) const
+{
+    assert(is_valid());
+
+#if defined(SIMD_VECTOR_ENABLED)
+    const double score = viterbi_nats(m_viterbi_words, sequence, workspace);
+    if(!std::isinf(score) || (score < 0.0))
+    {
+        return score / std::log(2.0);
+    }
+#endif
+
+    return viterbi_nats(m_viterbi_ints, sequence, workspace) / std::log(2.0);
+}
+
+//---------------------------------------------------------------------------
+double Profile_hmm::forward_score(const std::string& sequence, Score_workspace& workspace) const
+{
+    assert(is_valid());
+    return forward_nats(sequence, workspace) / std::log(2.0);
+}
+
+//---------------------------------------------------------------------------
+// A fit is only invalid if every random sequence scored the same.  Then the
+// filter cannot tell targets apart, so it passes all of them.
+static double gumbel_score_pvalue(const Gumbel_fit& fit, double score)
+{
+    if(!fit.is_valid)
+    {
+        return 0.0;
+    }
+
+    return -std::expm1(-std::exp(-fit.lambda * (score - fit.mu)));
+}
+
+//---------------------------------------------------------------------------
+double Profile_hmm::msv_pvalue(double score) const
+{
+    return gumbel_score_pvalue(m_msv_fit, score);
+}
+
+//---------------------------------------------------------------------------
+double Profile_hmm::viterbi_pvalue(double score) const
+{
+    return gumbel_score_pvalue(m_viterbi_fit, score);
+}
+
+//---------------------------------------------------------------------------
+double Profile_hmm::forward_pvalue(double score) const
+{
+    return std::min(1.0, forward_tail_mass * std::exp(-m_forward_lambda * (score - m_forward_tau)));
+}
+
+//---------------------------------------------------------------------------
+// Order of hits in the results: best p-value first, then earliest record.
+static bool hmm_hit_ranks_before(const Hmm_hit& hit1, const Hmm_hit& hit2)
+{
+    return (hit1.pvalue < hit2.pvalue) ||
+           ((hit1.pvalue == hit2.pvalue) && (hit1.record_index < hit2.record_index));
+}
+
+//---------------------------------------------------------------------------
+std::vector<Hmm_hit> search_profile_hmm(
+    const Profile_hmm& model,
+    std::istream& database,
+    const Hmm_search_options& options,
+    unsigned int thread_count,
+    Hmm_search_statistics& statistics)
+{
+    constexpr size_t records_per_batch = 256;
+
+    struct Worker_state
+    {
+        Score_workspace workspace;
+        std::vector<Hmm_hit> hits;
+        size_t msv_passed = 0;
+        size_t viterbi_passed = 0;
+    };
+
+    Work_stealing_pool pool(thread_count);
+    std::vector<Worker_state> workers(pool.thread_count());
+    statistics = Hmm_search_statistics();
+
+    const auto score_batch = [&model, &options, &workers](unsigned int worker_index, size_t first_index, std::vector<Fasta_record>& batch)
+    {
+        Worker_state& worker = workers[worker_index];
+
+        for(size_t ix = 0; ix < batch.size(); ++ix)
+        {
+            std::string& sequence = batch[ix].sequence;
+            normalize_BLOSUM62_residues(sequence);
+
+            Hmm_hit hit;
+            hit.msv_score = model.msv_score(sequence, worker.workspace);
+            if(model.msv_pvalue(hit.msv_score) > options.msv_pvalue)
+            {
+                continue;
+            }
+            ++worker.msv_passed;
+
+            hit.viterbi_score = model.viterbi_score(sequence, worker.workspace);
+            if(model.viterbi_pvalue(hit.viterbi_score) > options.viterbi_pvalue)
+            {
+                continue;
+            }
+            ++worker.viterbi_passed;
+
+            hit.forward_score = model.forward_score(sequence, worker.workspace);
+            hit.pvalue = model.forward_pvalue(hit.forward_score);
+            if(hit.pvalue > options.report_pvalue)
+            {
+                continue;
+            }
+
+            hit.record_index = first_index + ix;
+            hit.name = std::move(batch[ix].name);
+            worker.hits.push_back(std::move(hit));
+        }
+    };
+
+    // Stream the database in batches, as search_database does.
+    Fasta_reader reader(database);
+    std::vector<Fasta_record> batch;
+    Fasta_record record;
+    size_t first_index = 0;
+
+    bool more_records = true;
+    while(more_records)
+    {
+        more_records = reader.read_record(record);
+        if(more_records)
+        {
+            batch.push_back(std::move(record));
+            ++statistics.record_count;
+        }
+
+        if((batch.size() == records_per_batch) || (!more_records && !batch.empty()))
+        {
+            pool.submit([&score_batch, first_index, batch = std::move(batch)](unsigned int worker) mutable
+            {
+                score_batch(worker, first_index, batch);
+            });
+
+            first_index = statistics.record_count;
+            batch.clear();
+        }
+    }
+
+    pool.wait();
+
+    std::vector<Hmm_hit> hits;
+    for(auto& worker : workers)
+    {
+        std::move(worker.hits.begin(), worker.hits.end(), std::back_inserter(hits));
+        statistics.msv_passed += worker.msv_passed;
+        statistics.viterbi_passed += worker.viterbi_passed;
+    }
+
+    std::sort(hits.begin(), hits.end(), hmm_hit_ranks_before);
+    statistics.reported = hits.size();
+
+    return hits;
+}
+
+//---------------------------------------------------------------------------
+void print_hmm_hits(std::ostream& output_stream, const std::vector<Hmm_hit>& hits, const Hmm_search_statistics& statistics)
+{
+    output_stream << "Records: " << statistics.record_count << "\n";
+    output_stream << "Passed MSV filter: " << statistics.msv_passed << "\n";
+    output_stream << "Passed Viterbi filter: " << statistics.viterbi_passed << "\n";
+    output_stream << "Reported: " << statistics.reported << "\n";
+
+    for(size_t ix = 0; ix < hits.size(); ++ix)
+    {
+        output_stream << "Hit " << (ix + 1) << ": " << hits[ix].name << "\n";
+        output_stream << "  MSV " << hits[ix].msv_score << " bits, Viterbi " << hits[ix].viterbi_score
+                      << " bits, Forward " << hits[ix].forward_score << " bits, P-value " << hits[ix].pvalue << "\n";
+    }
+}
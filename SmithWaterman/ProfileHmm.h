@@ -0,0 +1,146 @@
+#pragma once
+
+#include "SimdVector.h"
+#include "Significance.h"
+
+class Score_workspace;
+
+//---------------------------------------------------------------------------
+// Profile HMM of a protein family in the Plan7 architecture (Eddy, 1998).
+// Each node k of the model has a match state M_k, an insert state I_k and a
+// delete state D_k, and the special states N, B, E, C and J let the model
+// align locally, any number of times, to a target of any length:
+//
+//      S -> N -> B -> M_k ... M_j -> E -> C -> T
+//                ^                   |
+//                +------- J <--------+
+//
+// Entry into M_k is uniform, and every M_k may exit to E (local alignment).
+//
+// A target is scored by three algorithms of increasing cost, so that most
+// targets only pay for the first (Eddy, 2011):
+//      MSV      ungapped multi-segment Viterbi, striped in unsigned bytes.
+//      Viterbi  full Viterbi, striped in signed 16-bit words.
+//      Forward  sum over all paths, in log space, with log_of_sum_of_logs.
+// All scores are log-odds in bits against a background (null) model of the
+// same length.  A target that overflows the narrow lanes of a filter is
+// rescored in ints, which only happens for strong hits.
+class Profile_hmm
+{
+public:
+    // Residues with their own emission probabilities.  Others (B, Z, X, etc.)
+    // score 0 (the background) in every state.
+    static constexpr char residues[] = "ACDEFGHIKLMNPQRSTVWY";
+    static constexpr size_t residue_count = 20;
+
+private:
+    // Transitions of each node, from node k to node k + 1 (or within node k for M->I and I->I).
+    enum Transition { match_match, match_insert, match_delete, insert_match, insert_insert, delete_match, delete_delete, transition_count };
+
+    // Scores of one filter, laid out for a vector type.
+    // Lane l of segment q holds node l * segment_count + q.
+    template<typename Vector>
+    struct Filter_layout
+    {
+        std::vector<typename Vector::element_type> emissions;   // [residue code][segment][lane]
+        std::vector<typename Vector::element_type> transitions; // [segment][Transition][lane] (Viterbi filter only)
+        size_t segment_count = 0;
+        int bias = 0;               // Added to emissions to keep them non-negative (MSV bytes only).
+        bool valid = false;         // False if the scores do not fit the element type.
+    };
+
+    size_t m_length = 0;                        // Number of nodes (M).
+    std::array<uint8_t, UCHAR_MAX + 1> m_codes; // Maps a residue to its code, or residue_count.
+    std::vector<double> m_match_scores;         // [node][code] log-odds of match emissions (nats).
+    std::vector<double> m_transitions;          // [node][Transition] log probabilities.
+
+#if defined(SIMD_VECTOR_ENABLED)
+    Filter_layout<Simd_byte_vector> m_msv_bytes;
+    Filter_layout<Simd_word_vector> m_viterbi_words;
+#endif
+    Filter_layout<Scalar_int_vector> m_msv_ints;    // Used if the MSV bytes overflow.
+    Filter_layout<Scalar_int_vector> m_viterbi_ints;    // Used if the Viterbi words overflow.
+
+    // Score distributions of random sequences (bits).
+    Gumbel_fit m_msv_fit;
+    Gumbel_fit m_viterbi_fit;
+    double m_forward_tau = 0.0;     // Start of the exponential tail of Forward scores.
+    double m_forward_lambda = 0.0;
+
+    template<typename Vector>
+    void build_msv_layout(Filter_layout<Vector>& layout) const;
+    template<typename Vector>
+    void build_viterbi_layout(Filter_layout<Vector>& layout) const;
+    template<typename Vector>
+    double msv_nats(const Filter_layout<Vector>& layout, const std::string& sequence, Score_workspace& workspace) const;
+    template<typename Vector>
+    double viterbi_nats(const Filter_layout<Vector>& layout, const std::string& sequence, Score_workspace& workspace) const;
+    double forward_nats(const std::string& sequence, Score_workspace& workspace) const;
+    void calibrate(uint32_t seed);
+
+public:
+    // Build a model from a multiple alignment of a family, with '-' or '.'
+    // for gaps.  Columns with residues in at least half of the sequences
+    // become nodes (Durbin et al., 1998, 5.7), and counts get Laplace pseudocounts.
+    // The score distributions are calibrated on random sequences from seed.
+    Profile_hmm(const std::vector<std::string>& alignment, uint32_t seed);
+
+    bool is_valid() const;
+    size_t length() const;
+
+    double msv_score(const std::string& sequence, Score_workspace& workspace) const;
+    double viterbi_score(const std::string& sequence, Score_workspace& workspace) const;
+    double forward_score(const std::string& sequence, Score_workspace& workspace) const;
+
+    // P-values of bit scores of a target of any length.  MSV and Viterbi scores
+    // follow a Gumbel distribution, and Forward scores have an exponential
+    // tail (Eddy, 2008).  Each is fit to the scores of random sequences.
+    double msv_pvalue(double score) const;
+    double viterbi_pvalue(double score) const;
+    double forward_pvalue(double score) const;
+};
+
+//---------------------------------------------------------------------------
+// P-value thresholds of the search pipeline.  A target must pass each filter
+// to be scored by the next stage.
+struct Hmm_search_options
+{
+    double msv_pvalue = 0.02;
+    double viterbi_pvalue = 0.001;
+    double report_pvalue = 1e-5;    // Forward p-value of a reported hit.
+};
+
+//---------------------------------------------------------------------------
+// A database record that passed every stage of a search.
+struct Hmm_hit
+{
+    size_t record_index = 0;    // Position of the record in the database.
+    std::string name;           // FASTA header of the record.
+    double msv_score = 0.0;     // Bits.
+    double viterbi_score = 0.0; // Bits.
+    double forward_score = 0.0; // Bits.
+    double pvalue = 1.0;        // Forward p-value.
+};
+
+//---------------------------------------------------------------------------
+// Number of records that reached each stage of a search.
+struct Hmm_search_statistics
+{
+    size_t record_count = 0;
+    size_t msv_passed = 0;
+    size_t viterbi_passed = 0;
+    size_t reported = 0;
+};
+
+// Search every record of a FASTA database stream with a profile HMM, on a
+// work-stealing pool of thread_count threads (0 for every hardware thread).
+// Hits are ordered by p-value and then by record order, and do not depend on
+// thread_count.
+std::vector<Hmm_hit> search_profile_hmm(
+    const Profile_hmm& model,
+    std::istream& database,
+    const Hmm_search_options& options,
+    unsigned int thread_count,
+    Hmm_search_statistics& statistics);
+
+void print_hmm_hits(std::ostream& output_stream, const std::vector<Hmm_hit>& hits, const Hmm_search_statistics& statistics);
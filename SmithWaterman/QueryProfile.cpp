@@ -0,0 +1,58 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "QueryProfile.h"   // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Assign a code to each distinct residue, in order of first use.
+void Query_profile::encode_residues(const std::string& residues)
+{
+    m_residue_index.fill(UINT8_MAX);
+
+    for(size_t ix = 0; ix < residues.size(); ++ix)
+    {
+        const uint8_t residue = static_cast<uint8_t>(residues[ix]);
+        if(m_residue_index[residue] == UINT8_MAX)
+        {
+            assert(m_residues.size() < UINT8_MAX);
+            m_residue_index[residue] = static_cast<uint8_t>(m_residues.size());
+            m_residues.push_back(residues[ix]);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Return the codes of each residue in sequence.
+std::vector<uint8_t> Query_profile::encode(const std::string& sequence) const
+{
+    std::vector<uint8_t> codes(sequence.size());
+    for(size_t ix = 0; ix < sequence.size(); ++ix)
+    {
+        codes[ix] = m_residue_index[static_cast<uint8_t>(sequence[ix])];
+
+        // If the input strings ever come from an untrusted source, a residue
+        // missing from the profile must be handled instead of asserting.
+        assert(codes[ix] != UINT8_MAX);
+    }
+
+    return codes;
+}
+
+//---------------------------------------------------------------------------
+// Return the row of scores of a coded residue against each query position.
+const int* Query_profile::scores(uint8_t code) const
+{
+    return &m_scores[code * m_query_length];
+}
+
+//---------------------------------------------------------------------------
+// Return the score of a gap against each query position.
+const int* Query_profile::query_gap_scores() const
+{
+    return m_query_gap_scores.data();
+}
+
+//---------------------------------------------------------------------------
+int Query_profile::residue_gap_score(uint8_t code) const
+{
+    return m_residue_gap_scores[code];
+}
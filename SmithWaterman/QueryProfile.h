@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ScorePolicy.h"
+
+//---------------------------------------------------------------------------
+// Precomputed scores of a query sequence against an alphabet of residues.
+// Each residue of the alphabet is encoded as a small integer, which indexes a
+// row holding its score against every query position.  With the sequences
+// encoded once up front, filling a score table only needs array loads.
+class Query_profile
+{
+    std::array<uint8_t, UCHAR_MAX + 1> m_residue_index; // Maps a residue to its code, or UINT8_MAX.
+    std::string m_residues;                             // Residue of each code.
+    std::vector<int> m_scores;                          // [code][query position] scores.
+    std::vector<int> m_query_gap_scores;                // Score of each query residue against a gap.
+    std::vector<int> m_residue_gap_scores;              // Score of each coded residue against a gap.
+    size_t m_query_length;                              // Number of residues in the query.
+
+    void encode_residues(const std::string& residues);
+
+public:
+    // score_policy may be a function pointer, or a policy object such as
+    // Basic_score_policy, in which case the scores are inlined into the build.
+    template<typename Score_policy>
+    Query_profile(const std::string& query, const std::string& residues, Score_policy score_policy);
+
+    std::vector<uint8_t> encode(const std::string& sequence) const;
+    const int* scores(uint8_t code) const;
+    const int* query_gap_scores() const;
+    int residue_gap_score(uint8_t code) const;
+};
+
+//---------------------------------------------------------------------------
+// Build the profile of query against each residue in residues.
+// Sequences encoded by this profile may only contain those residues.
+template<typename Score_policy>
+Query_profile::Query_profile(const std::string& query, const std::string& residues, Score_policy score_policy)
+    : m_query_length(query.size())
+{
+    encode_residues(residues);
+
+    m_scores.resize(m_residues.size() * m_query_length);
+    m_residue_gap_scores.resize(m_residues.size());
+    for(size_t code = 0; code < m_residues.size(); ++code)
+    {
+        const char residue = m_residues[code];
+        for(size_t position = 0; position < m_query_length; ++position)
+        {
+            m_scores[code * m_query_length + position] = score_policy(residue, query[position]);
+        }
+
+        m_residue_gap_scores[code] = score_policy(residue, gap_character);
+    }
+
+    m_query_gap_scores.resize(m_query_length);
+    for(size_t position = 0; position < m_query_length; ++position)
+    {
+        m_query_gap_scores[position] = score_policy(gap_character, query[position]);
+    }
+}
@@ -81,3 +81,20 @@ int BLOSUM62_calc_score_with_penalty(char char1, char char2, int gap_penalty)
     return BLOSUM62_matrix[row * BLOSUM62_width + column];
 }
 
+
+//---------------------------------------------------------------------------
+// Upper-case a protein sequence, and replace residues that have no BLOSUM-62
+// row with 'X'.  ASCII/UTF-8 is assumed.
+void normalize_BLOSUM62_residues(std::string& sequence)
+{
+    for(char& residue : sequence)
+    {
+        residue = static_cast<char>(toupper(static_cast<unsigned char>(residue)));
+
+        const size_t index = static_cast<size_t>(residue - 'A');
+        if((index >= ('Z' - 'A' + 1)) || (BLOSUM62_index[index] == -1))
+        {
+            residue = 'X';
+        }
+    }
+}
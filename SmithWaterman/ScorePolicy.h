@@ -2,6 +2,13 @@
 
 constexpr char gap_character = '-';
 
+// Residues that have a row in the BLOSUM-62 matrix, in matrix order.
+constexpr char BLOSUM62_residues[] = "ARNDCQEGHILKMFPSTWYVBZX";
+
+// Upper-case a protein sequence, and replace residues that have no BLOSUM-62
+// row with 'X', so profiles never see a residue they were not built for.
+void normalize_BLOSUM62_residues(std::string& sequence);
+
 // Basic scoring policy, with no gap penalty.
 // This is simply for testing.
 int basic_calc_score(char char1, char char2);
@@ -16,3 +23,22 @@ int BLOSUM62_calc_score(char char1, char char2)
     return BLOSUM62_calc_score_with_penalty(char1, char2, GAP_PENALTY);
 }
 
+// Score policies as types, for passing as a template parameter instead of a
+// function pointer.  These are only called while building a Query_profile.
+struct Basic_score_policy
+{
+    int operator()(char char1, char char2) const
+    {
+        return basic_calc_score(char1, char2);
+    }
+};
+
+template<int GAP_PENALTY>
+struct BLOSUM62_score_policy
+{
+    int operator()(char char1, char char2) const
+    {
+        return BLOSUM62_calc_score_with_penalty(char1, char2, GAP_PENALTY);
+    }
+};
+
@@ -0,0 +1,437 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "SeedIndex.h"      // Pick up forward declarations to ensure correctness.
+#include <Shared/fasta.h>
+
+//---------------------------------------------------------------------------
+// Layout of an index file.  The header is followed by the arrays of 64-bit
+// integers (record starts, name starts, word starts and positions), then the
+// names and the residues, so every array is naturally aligned.  The file is
+// written in the byte order of the machine, and is not meant to be shared
+// between machines of different byte orders.
+struct Seed_index_header
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t word_length;
+    uint64_t record_count;
+    uint64_t residue_count;
+    uint64_t name_bytes;
+    uint64_t word_count;
+    uint64_t position_count;
+};
+
+static const char seed_index_magic[8] = { 'S', 'W', 'S', 'E', 'E', 'D', 'S', '\0' };
+constexpr uint64_t seed_index_version = 1;
+
+// Residues that make up words, and the longest word, so that the word table
+// (20^k entries) stays small.
+static const char word_residues[] = "ARNDCQEGHILKMFPSTWYV";
+constexpr size_t word_residue_count = sizeof(word_residues) - 1;
+constexpr size_t max_word_length = 5;
+
+//---------------------------------------------------------------------------
+// Map residues to their code in a word, or UINT8_MAX if they can't be in one.
+static std::array<uint8_t, UCHAR_MAX + 1> word_residue_codes()
+{
+    std::array<uint8_t, UCHAR_MAX + 1> codes;
+    codes.fill(UINT8_MAX);
+
+    for(size_t code = 0; code < word_residue_count; ++code)
+    {
+        codes[static_cast<uint8_t>(word_residues[code])] = static_cast<uint8_t>(code);
+    }
+
+    return codes;
+}
+
+//---------------------------------------------------------------------------
+static size_t word_count(size_t word_length)
+{
+    size_t count = 1;
+    for(size_t ix = 0; ix < word_length; ++ix)
+    {
+        count *= word_residue_count;
+    }
+
+    return count;
+}
+
+//---------------------------------------------------------------------------
+// Call visit(word, position) for each word of residues[begin, end) made only of word residues.
+template<typename Visitor>
+static void for_each_word(const std::string& residues, size_t begin, size_t end, size_t word_length, Visitor visit)
+{
+    static const std::array<uint8_t, UCHAR_MAX + 1> codes = word_residue_codes();
+    const size_t words = word_count(word_length);
+
+    size_t word = 0;
+    size_t valid_length = 0;    // Number of word residues that end at position.
+    for(size_t position = begin; position < end; ++position)
+    {
+        const uint8_t code = codes[static_cast<uint8_t>(residues[position])];
+        if(code == UINT8_MAX)
+        {
+            valid_length = 0;
+            continue;
+        }
+
+        word = (word * word_residue_count + code) % words;
+        if(++valid_length >= word_length)
+        {
+            visit(word, position + 1 - word_length);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+template<typename Element>
+static void write_array(std::ostream& output, const std::vector<Element>& elements)
+{
+    output.write(reinterpret_cast<const char*>(elements.data()), elements.size() * sizeof(Element));
+}
+
+//---------------------------------------------------------------------------
+// True if the starts never decrease and the last one is total, so every range
+// between neighbouring starts lies within an array of total elements.
+static bool are_starts_valid(const uint64_t* starts, uint64_t count, uint64_t total)
+{
+    return std::is_sorted(starts, starts + count) && (starts[count - 1] == total);
+}
+
+//---------------------------------------------------------------------------
+// Read every record, then count the words and place the position of each word
+// in its bucket (a counting sort), so positions are in database order.
+bool Seed_index::write(std::istream& database, _In_ const char* filename, size_t word_length)
+{
+    if((word_length == 0) || (word_length > max_word_length))
+    {
+        return false;
+    }
+
+    std::vector<uint64_t> record_starts(1, 0);
+    std::vector<uint64_t> name_starts(1, 0);
+    std::string names;
+    std::string residues;
+
+    Fasta_reader reader(database);
+    Fasta_record record;
+    while(reader.read_record(record))
+    {
+        normalize_BLOSUM62_residues(record.sequence);
+        residues.append(record.sequence);
+        names.append(record.name);
+        record_starts.push_back(residues.size());
+        name_starts.push_back(names.size());
+    }
+
+    const size_t record_count = record_starts.size() - 1;
+    const size_t words = word_count(word_length);
+
+    std::vector<uint64_t> word_starts(words + 1);
+    for(size_t record_index = 0; record_index < record_count; ++record_index)
+    {
+        for_each_word(residues, record_starts[record_index], record_starts[record_index + 1], word_length, [&word_starts](size_t word, size_t)
+        {
+            ++word_starts[word + 1];
+        });
+    }
+
+    for(size_t word = 0; word < words; ++word)
+    {
+        word_starts[word + 1] += word_starts[word];
+    }
+
+    std::vector<uint64_t> positions(word_starts[words]);
+    std::vector<uint64_t> next_position(word_starts.cbegin(), word_starts.cend() - 1);
+    for(size_t record_index = 0; record_index < record_count; ++record_index)
+    {
+        for_each_word(residues, record_starts[record_index], record_starts[record_index + 1], word_length, [&positions, &next_position](size_t word, size_t position)
+        {
+            positions[next_position[word]++] = position;
+        });
+    }
+
+    Seed_index_header header;
+    std::copy(std::begin(seed_index_magic), std::end(seed_index_magic), header.magic);
+    header.version = seed_index_version;
+    header.word_length = word_length;
+    header.record_count = record_count;
+    header.residue_count = residues.size();
+    header.name_bytes = names.size();
+    header.word_count = words;
+    header.position_count = positions.size();
+
+    std::ofstream output(filename, std::ofstream::binary | std::ofstream::trunc);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_array(output, record_starts);
+    write_array(output, name_starts);
+    write_array(output, word_starts);
+    write_array(output, positions);
+    output.write(names.data(), names.size());
+    output.write(residues.data(), residues.size());
+
+    return static_cast<bool>(output);
+}
+
+//---------------------------------------------------------------------------
+// Map the file, and check that it holds a whole index before using any of it.
+Seed_index::Seed_index(_In_ const char* filename) : m_file(filename)
+{
+    if(!m_file.is_open() || (m_file.size() < sizeof(Seed_index_header)))
+    {
+        return;
+    }
+
+    const Seed_index_header& header = *reinterpret_cast<const Seed_index_header*>(m_file.data());
+    if(!std::equal(std::begin(seed_index_magic), std::end(seed_index_magic), header.magic) ||
+       (header.version != seed_index_version) ||
+       (header.word_length == 0) || (header.word_length > max_word_length) ||
+       (header.word_count != word_count(static_cast<size_t>(header.word_length))))
+    {
+        return;
+    }
+
+    // Compare in 64 bits, so that a corrupt header can't wrap the sizes around.
+    const uint64_t array_count = (header.record_count + 1) * 2 + (header.word_count + 1) + header.position_count;
+    const uint64_t expected_size = sizeof(header) + array_count * sizeof(uint64_t) + header.name_bytes + header.residue_count;
+    if((header.record_count > m_file.size()) || (header.position_count > m_file.size()) ||
+       (header.name_bytes > m_file.size()) || (header.residue_count > m_file.size()) ||
+       (expected_size != m_file.size()))
+    {
+        return;
+    }
+
+    // The starts index the residues, names and positions, so a corrupt file
+    // must not send them past the ends of those arrays.
+    const uint64_t* record_starts = reinterpret_cast<const uint64_t*>(m_file.data() + sizeof(header));
+    const uint64_t* name_starts = record_starts + header.record_count + 1;
+    const uint64_t* word_starts = name_starts + header.record_count + 1;
+    if(!are_starts_valid(record_starts, header.record_count + 1, header.residue_count) ||
+       !are_starts_valid(name_starts, header.record_count + 1, header.name_bytes) ||
+       !are_starts_valid(word_starts, header.word_count + 1, header.position_count))
+    {
+        return;
+    }
+
+    m_record_starts = record_starts;
+    m_name_starts = name_starts;
+    m_word_starts = word_starts;
+    m_positions = m_word_starts + header.word_count + 1;
+    m_names = reinterpret_cast<const char*>(m_positions + header.position_count);
+    m_residues = m_names + header.name_bytes;
+
+    m_word_length = static_cast<size_t>(header.word_length);
+    m_record_count = static_cast<size_t>(header.record_count);
+}
+
+//---------------------------------------------------------------------------
+bool Seed_index::is_valid() const
+{
+    return m_record_starts != nullptr;
+}
+
+//---------------------------------------------------------------------------
+size_t Seed_index::record_count() const
+{
+    return m_record_count;
+}
+
+//---------------------------------------------------------------------------
+std::string Seed_index::record_name(size_t record) const
+{
+    return std::string(m_names + m_name_starts[record], m_names + m_name_starts[record + 1]);
+}
+
+//---------------------------------------------------------------------------
+std::string Seed_index::record_sequence(size_t record) const
+{
+    return std::string(m_residues + m_record_starts[record], m_residues + m_record_starts[record + 1]);
+}
+
+//---------------------------------------------------------------------------
+// Return the record that holds a residue position.
+size_t Seed_index::record_of(uint64_t position) const
+{
+    const uint64_t* end = m_record_starts + m_record_count + 1;
+    return static_cast<size_t>(std::upper_bound(m_record_starts, end, position) - m_record_starts) - 1;
+}
+
+//---------------------------------------------------------------------------
+// Find the seed hits of the query, and extend them without gaps.
+//
+// A hit is a database word that scores at least neighborhood_threshold against
+// a query word, so similar words count as well as exact ones.  Hits are grouped
+// by diagonal.  In two-hit mode, a hit is only extended when an earlier,
+// non-overlapping hit lies on the same diagonal within two_hit_window.  A
+// record passes if any ungapped extension reaches ungapped_cutoff.
+std::vector<size_t> Seed_index::candidate_records(
+    const std::string& query,
+    int (*score_policy)(char char1, char char2),
+    const Seed_options& options) const
+{
+    const size_t query_length = query.size();
+    if(!is_valid() || (query_length < m_word_length))
+    {
+        return std::vector<size_t>();
+    }
+
+    // Score of each word residue against each query position, and the best
+    // score at each position, to prune the neighborhood words.
+    std::vector<int> residue_scores(query_length * word_residue_count);
+    std::vector<int> best_scores(query_length, INT_MIN);
+    for(size_t position = 0; position < query_length; ++position)
+    {
+        for(size_t code = 0; code < word_residue_count; ++code)
+        {
+            const int score = score_policy(word_residues[code], query[position]);
+            residue_scores[position * word_residue_count + code] = score;
+            best_scores[position] = std::max(best_scores[position], score);
+        }
+    }
+
+    struct seed_hit
+    {
+        uint64_t diagonal;          // Database position - query position + query length.
+        size_t query_position;
+    };
+
+    std::vector<seed_hit> hits;
+    std::vector<size_t> word_codes(m_word_length);
+
+    for(size_t query_position = 0; query_position + m_word_length <= query_length; ++query_position)
+    {
+        // Best score the rest of the word could still add, from each residue on.
+        std::vector<int> best_remaining(m_word_length + 1, 0);
+        for(size_t ix = m_word_length; ix > 0; --ix)
+        {
+            best_remaining[ix - 1] = best_remaining[ix] + best_scores[query_position + ix - 1];
+        }
+
+        // Enumerate the neighborhood words depth first, skipping any prefix that
+        // can't reach the threshold.
+        const std::function<void(size_t, size_t, int)> visit = [&](size_t depth, size_t word, int score)
+        {
+            if(score + best_remaining[depth] < options.neighborhood_threshold)
+            {
+                return;
+            }
+
+            if(depth == m_word_length)
+            {
+                for(uint64_t ix = m_word_starts[word]; ix < m_word_starts[word + 1]; ++ix)
+                {
+                    hits.push_back(seed_hit { m_positions[ix] + query_length - query_position, query_position });
+                }
+                return;
+            }
+
+            const int* scores = &residue_scores[(query_position + depth) * word_residue_count];
+            for(size_t code = 0; code < word_residue_count; ++code)
+            {
+                visit(depth + 1, word * word_residue_count + code, score + scores[code]);
+            }
+        };
+
+        visit(0, 0, 0);
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const seed_hit& hit1, const seed_hit& hit2)
+    {
+        return (hit1.diagonal < hit2.diagonal) ||
+               ((hit1.diagonal == hit2.diagonal) && (hit1.query_position < hit2.query_position));
+    });
+
+    std::vector<bool> is_candidate(m_record_count);
+
+    size_t last_hit = SIZE_MAX;         // Query position of the last hit on this diagonal.
+    size_t extended_to = 0;             // Query position that extensions on this diagonal have reached.
+    for(size_t ix = 0; ix < hits.size(); ++ix)
+    {
+        const seed_hit& hit = hits[ix];
+        if((ix == 0) || (hit.diagonal != hits[ix - 1].diagonal))
+        {
+            last_hit = SIZE_MAX;
+            extended_to = 0;
+        }
+
+        if(hit.query_position < extended_to)
+        {
+            continue;
+        }
+
+        const uint64_t database_position = hit.diagonal - query_length + hit.query_position;
+        const size_t record = record_of(database_position);
+
+        if(options.two_hit)
+        {
+            // Both hits must be in the same record, and must not overlap.
+            const bool paired = (last_hit != SIZE_MAX) &&
+                                (hit.query_position - last_hit >= m_word_length) &&
+                                (hit.query_position - last_hit <= options.two_hit_window) &&
+                                (record_of(database_position - (hit.query_position - last_hit)) == record);
+
+            if(!paired)
+            {
+                if((last_hit == SIZE_MAX) || (hit.query_position - last_hit >= m_word_length))
+                {
+                    last_hit = hit.query_position;
+                }
+                continue;
+            }
+        }
+
+        const uint64_t record_begin = m_record_starts[record];
+        const uint64_t record_end = m_record_starts[record + 1];
+
+        // Extend right from the start of the hit, then left, stopping each way
+        // once the score falls x_drop below the best so far.
+        int score = 0;
+        int best_right = 0;
+        size_t right_length = 0;
+        for(size_t length = 0; (hit.query_position + length < query_length) && (database_position + length < record_end); ++length)
+        {
+            score += score_policy(m_residues[database_position + length], query[hit.query_position + length]);
+            if(score > best_right)
+            {
+                best_right = score;
+                right_length = length + 1;
+            }
+            else if(score < best_right - options.x_drop)
+            {
+                break;
+            }
+        }
+
+        score = 0;
+        int best_left = 0;
+        for(size_t length = 1; (length <= hit.query_position) && (database_position - record_begin >= length); ++length)
+        {
+            score += score_policy(m_residues[database_position - length], query[hit.query_position - length]);
+            best_left = std::max(best_left, score);
+            if(score < best_left - options.x_drop)
+            {
+                break;
+            }
+        }
+
+        if(best_left + best_right >= options.ungapped_cutoff)
+        {
+            is_candidate[record] = true;
+        }
+
+        extended_to = hit.query_position + std::max<size_t>(right_length, 1);
+        last_hit = hit.query_position;
+    }
+
+    std::vector<size_t> candidates;
+    for(size_t record = 0; record < m_record_count; ++record)
+    {
+        if(is_candidate[record])
+        {
+            candidates.push_back(record);
+        }
+    }
+
+    return candidates;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Shared/MappedFile.h>
+
+//---------------------------------------------------------------------------
+// Settings of the seed filter that picks the database records worth a full
+// alignment (BLAST-like).
+struct Seed_options
+{
+    int neighborhood_threshold = 11;    // Min score of a word against a query word to count as a hit.
+    bool two_hit = true;                // Require two hits on one diagonal before extending.
+    size_t two_hit_window = 40;         // Max distance between the starts of the two hits.
+    int x_drop = 16;                    // Stop an ungapped extension this far below its best score.
+    int ungapped_cutoff = 41;           // Min ungapped extension score for a record to pass (about 22 bits with BLOSUM-62).
+};
+
+//---------------------------------------------------------------------------
+// Index of the words (k-mers) of every record of a protein FASTA database.
+// The index is written to a file once, and later runs map the file into
+// memory, so opening an index is cheap and its pages are shared between runs.
+//
+// The file holds the records too (names and normalized residues), so a search
+// never needs to read the FASTA file again.  Words are made of the 20 standard
+// amino acids, and words containing any other residue are not indexed.
+class Seed_index
+{
+    Mapped_file m_file;
+    size_t m_word_length = 0;
+    size_t m_record_count = 0;
+    const uint64_t* m_record_starts = nullptr;  // Offset of each record in m_residues, plus the end.
+    const uint64_t* m_name_starts = nullptr;    // Offset of each record's name in m_names, plus the end.
+    const char* m_names = nullptr;
+    const char* m_residues = nullptr;           // Every record, one after the other.
+    const uint64_t* m_word_starts = nullptr;    // Index in m_positions of each word's positions, plus the end.
+    const uint64_t* m_positions = nullptr;      // Offsets in m_residues where each word starts.
+
+    // Not implemented to prevent accidental copying/moving.
+    Seed_index(const Seed_index&) = delete;
+    Seed_index(Seed_index&&) noexcept = delete;
+    Seed_index& operator=(const Seed_index&) = delete;
+    Seed_index& operator=(Seed_index&&) noexcept = delete;
+
+    size_t record_of(uint64_t position) const;
+
+public:
+    // Read the records of a FASTA stream and write their index to a file.
+    // Returns false if the file can't be written.
+    static bool write(std::istream& database, _In_ const char* filename, size_t word_length);
+
+    // Map an index file into memory.  If the file is missing or is not an
+    // index, is_valid() is false.
+    explicit Seed_index(_In_ const char* filename);
+
+    bool is_valid() const;
+    size_t record_count() const;
+    std::string record_name(size_t record) const;
+    std::string record_sequence(size_t record) const;
+
+    // Return the records, in database order, with a seed hit against query that
+    // passes the filter.  Only these need a full alignment.
+    std::vector<size_t> candidate_records(
+        const std::string& query,
+        int (*score_policy)(char char1, char char2),
+        const Seed_options& options) const;
+};
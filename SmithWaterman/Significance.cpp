@@ -0,0 +1,226 @@
+#include "PreCompile.h"
+#include "Significance.h"   // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Method to permute a sequence (Fisher-Yates shuffle).
+// The Mersenne twister output is fully specified by the standard, but the
+// distribution classes are not, so the range is reduced by hand
+// (multiply-shift) to give the same permutations on every platform.
+void permute_sequence(std::string& sequence, std::mt19937& generator)
+{
+    for(size_t ix = sequence.size(); ix > 0; --ix)
+    {
+        const size_t swap_index = static_cast<size_t>((static_cast<uint64_t>(generator()) * ix) >> 32);
+        std::swap(sequence[ix - 1], sequence[swap_index]);
+    }
+}
+
+//---------------------------------------------------------------------------
+// The likelihood equation of lambda (Lawless, 1982) is
+//     1/lambda - mean(x) + sum(x e^(-lambda x)) / sum(e^(-lambda x)) = 0
+// which is solved by Newton's method from the method of moments estimate.
+// Scores are centered on their mean so the exponentials stay in range.
+static Gumbel_fit fit_gumbel_sample(const std::vector<double>& scores)
+{
+    constexpr double pi = 3.14159265358979323846;
+    constexpr double euler_gamma = 0.57721566490153286061;
+
+    Gumbel_fit fit;
+    if(scores.size() < 2)
+    {
+        return fit;
+    }
+
+    double mean = 0.0;
+    for(double score : scores)
+    {
+        mean += score;
+    }
+    mean /= scores.size();
+
+    double variance = 0.0;
+    for(double score : scores)
+    {
+        variance += (score - mean) * (score - mean);
+    }
+    variance /= scores.size() - 1;
+
+    if(variance <= 0.0)
+    {
+        return fit;
+    }
+
+    // Method of moments, which is also the fallback if Newton's method fails.
+    const double moments_lambda = pi / std::sqrt(6.0 * variance);
+    double lambda = moments_lambda;
+
+    for(int iteration = 0; iteration < 100; ++iteration)
+    {
+        double sum = 0.0;
+        double x_sum = 0.0;
+        double x2_sum = 0.0;
+        for(double score : scores)
+        {
+            const double x = score - mean;
+            const double weight = std::exp(-lambda * x);
+            sum += weight;
+            x_sum += x * weight;
+            x2_sum += x * x * weight;
+        }
+
+        const double weighted_mean = x_sum / sum;
+        const double equation = 1.0 / lambda + weighted_mean;
+        const double derivative = -1.0 / (lambda * lambda) - (x2_sum / sum - weighted_mean * weighted_mean);
+        const double next_lambda = lambda - equation / derivative;
+
+        if(!(next_lambda > 0.0))
+        {
+            lambda = moments_lambda;
+            break;
+        }
+
+        const bool converged = std::abs(next_lambda - lambda) < 1e-9 * lambda;
+        lambda = next_lambda;
+        if(converged)
+        {
+            break;
+        }
+    }
+
+    double sum = 0.0;
+    for(double score : scores)
+    {
+        sum += std::exp(-lambda * (score - mean));
+    }
+
+    fit.is_valid = true;
+    fit.lambda = lambda;
+    fit.mu = mean - std::log(sum / scores.size()) / lambda;
+
+    // Fall back to the method of moments if the sum overflowed.
+    if(!std::isfinite(fit.mu))
+    {
+        fit.lambda = moments_lambda;
+        fit.mu = mean - euler_gamma / moments_lambda;
+    }
+
+    return fit;
+}
+
+//---------------------------------------------------------------------------
+Gumbel_fit fit_gumbel(const std::vector<int>& scores)
+{
+    return fit_gumbel_sample(std::vector<double>(scores.cbegin(), scores.cend()));
+}
+
+//---------------------------------------------------------------------------
+Gumbel_fit fit_gumbel(const std::vector<double>& scores)
+{
+    return fit_gumbel_sample(scores);
+}
+
+//---------------------------------------------------------------------------
+// Each score is shifted by ln(m n) / lambda to the search space of size 1,
+// which depends on lambda, so the fit is repeated until lambda settles.
+Gumbel_fit fit_karlin_altschul(const std::vector<int>& scores, const std::vector<double>& search_spaces)
+{
+    assert(scores.size() == search_spaces.size());
+
+    // A pair with an empty sequence has no search space to shift by.
+    std::vector<int> pair_scores;
+    std::vector<double> log_search_spaces;
+    for(size_t ix = 0; ix < scores.size(); ++ix)
+    {
+        if(search_spaces[ix] > 0.0)
+        {
+            pair_scores.push_back(scores[ix]);
+            log_search_spaces.push_back(std::log(search_spaces[ix]));
+        }
+    }
+
+    Gumbel_fit fit = fit_gumbel(pair_scores);
+    std::vector<double> shifted_scores(pair_scores.size());
+
+    for(int iteration = 0; (iteration < 20) && fit.is_valid; ++iteration)
+    {
+        for(size_t ix = 0; ix < pair_scores.size(); ++ix)
+        {
+            shifted_scores[ix] = pair_scores[ix] - log_search_spaces[ix] / fit.lambda;
+        }
+
+        const Gumbel_fit next_fit = fit_gumbel_sample(shifted_scores);
+        const bool converged = next_fit.is_valid && (std::abs(next_fit.lambda - fit.lambda) < 1e-6 * fit.lambda);
+        fit = next_fit;
+        if(converged)
+        {
+            break;
+        }
+    }
+
+    return fit;
+}
+
+//---------------------------------------------------------------------------
+double karlin_altschul_pvalue(const Gumbel_fit& fit, int score, double search_space)
+{
+    // Nothing aligns against an empty sequence.
+    if(search_space <= 0.0)
+    {
+        return 1.0;
+    }
+
+    Gumbel_fit shifted_fit = fit;
+    shifted_fit.mu += std::log(search_space) / fit.lambda;
+    return gumbel_pvalue(shifted_fit, score);
+}
+
+//---------------------------------------------------------------------------
+// Scores are integers, so P(S > score) is P(S >= score + 1), which the
+// continuous distribution approximates halfway between.
+double gumbel_pvalue(const Gumbel_fit& fit, int score)
+{
+    assert(fit.is_valid);
+
+    // -expm1 keeps the precision of very small p-values.
+    return -std::expm1(-std::exp(-fit.lambda * (score + 0.5 - fit.mu)));
+}
+
+//---------------------------------------------------------------------------
+bool pvalue_is_settled(unsigned int better_scores, unsigned int permutations, const Pvalue_options& options)
+{
+    if((permutations < options.min_permutations) || (0 == permutations))
+    {
+        return false;
+    }
+
+    const double n = permutations;
+    const double p = better_scores / n;
+    const double z2 = options.confidence_z * options.confidence_z;
+
+    const double center = (p + z2 / (2.0 * n)) / (1.0 + z2 / n);
+    const double half_width = options.confidence_z * std::sqrt(p * (1.0 - p) / n + z2 / (4.0 * n * n)) / (1.0 + z2 / n);
+
+    // The test is decided either way.
+    if((center - half_width > options.significance_level) || (center + half_width < options.significance_level))
+    {
+        return true;
+    }
+
+    return (better_scores > 0) && (half_width <= options.relative_error * p);
+}
+
+//---------------------------------------------------------------------------
+void print_pvalue_estimate(std::ostream& output_stream, const Pvalue_estimate& estimate)
+{
+    output_stream << "p-value: " << static_cast<float>(estimate.pvalue)
+                  << " (" << estimate.better_scores << " / " << estimate.permutations << ")";
+
+    if(estimate.fit.is_valid)
+    {
+        output_stream << ", Gumbel tail: " << static_cast<float>(estimate.tail_pvalue)
+                      << " (lambda " << static_cast<float>(estimate.fit.lambda)
+                      << ", K " << static_cast<float>(estimate.karlin_altschul_K) << ")";
+    }
+
+    output_stream << "\n\n";
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// When an adaptive p-value estimate may stop drawing permutations.
+struct Pvalue_options
+{
+    unsigned int max_permutations = 10000;  // Never draw more than this.
+    unsigned int min_permutations = 1000;   // Never stop before this, so the tail fit has enough scores.
+    double significance_level = 0.05;       // Stop once the confidence interval of k/N excludes this.
+    double relative_error = 0.1;            // Or once the interval half-width is this fraction of k/N.
+    double confidence_z = 2.576;            // Normal quantile of the interval (99%).
+};
+
+//---------------------------------------------------------------------------
+// Extreme value (Gumbel) distribution of local alignment scores,
+// P(S > x) = 1 - exp(-exp(-lambda * (x - mu))).  Karlin-Altschul statistics
+// write mu as ln(K m n) / lambda for sequences of length m and n.
+struct Gumbel_fit
+{
+    bool is_valid = false;
+    double lambda = 0.0;
+    double mu = 0.0;
+};
+
+//---------------------------------------------------------------------------
+// Result of a permutation test of an alignment score.
+struct Pvalue_estimate
+{
+    unsigned int permutations = 0;      // Number of permutations drawn.
+    unsigned int better_scores = 0;     // Number of them that scored better than the alignment.
+    double pvalue = 0.0;                // better_scores / permutations.
+    Gumbel_fit fit;                     // Fit of the permutation scores.
+    double tail_pvalue = 0.0;           // P(S > score) under the fit, if it is valid.
+    double karlin_altschul_K = 0.0;     // K of the fit, if it is valid.
+};
+
+// Shuffle a sequence in place, the same way on every platform.
+void permute_sequence(std::string& sequence, std::mt19937& generator);
+
+// Maximum likelihood fit of a Gumbel distribution to a sample of scores.
+Gumbel_fit fit_gumbel(const std::vector<int>& scores);
+Gumbel_fit fit_gumbel(const std::vector<double>& scores);
+
+// Probability that a score drawn from the fit is greater than score.
+double gumbel_pvalue(const Gumbel_fit& fit, int score);
+
+// Fit of scores of sequence pairs of different lengths, with the search space
+// (m n) of each pair.  The mu of the fit is for a search space of 1, so K is
+// exp(lambda mu).
+Gumbel_fit fit_karlin_altschul(const std::vector<int>& scores, const std::vector<double>& search_spaces);
+
+// Probability that a pair with the given search space scores more than score.
+double karlin_altschul_pvalue(const Gumbel_fit& fit, int score, double search_space);
+
+// Sequential stopping rule: true once better_scores / permutations is known
+// well enough, by a Wilson score interval, to decide the test or to quote.
+bool pvalue_is_settled(unsigned int better_scores, unsigned int permutations, const Pvalue_options& options);
+
+void print_pvalue_estimate(std::ostream& output_stream, const Pvalue_estimate& estimate);
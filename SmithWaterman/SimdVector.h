@@ -0,0 +1,198 @@
+#pragma once
+
+// Thin wrappers over the SIMD instruction sets used by the score-only kernels.
+// Each wrapper presents the same static interface, so a kernel can be written
+// once as a template and instantiated for whatever vector width is available.
+//
+// All arithmetic saturates, and scores are kept non-negative, which is all that
+// local alignment needs (every cell is clamped at 0 anyway).
+//
+// AVX2 is used when the compiler targets it: the Release builds of the project
+// set /arch:AVX2, and GCC or Clang need -mavx2 (or -march=native).
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_VECTOR_AVX2
+#define SIMD_VECTOR_ENABLED
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define SIMD_VECTOR_SSE2
+#define SIMD_VECTOR_ENABLED
+#endif
+
+//---------------------------------------------------------------------------
+// One lane "vector" of ints.  Used on targets without SIMD support (ARM), and
+// as the final fallback when a score overflows the narrower lanes.
+struct Scalar_int_vector
+{
+    typedef int element_type;
+    typedef int vector_type;
+
+    static constexpr size_t lanes = 1;
+    static constexpr bool saturates = false;    // Scores are not expected to exceed INT_MAX.
+    static constexpr bool biased = false;       // Profile holds signed scores.
+    static constexpr int element_max = INT_MAX;
+
+    static vector_type load(const element_type* source) { return *source; }
+    static void store(element_type* destination, vector_type value) { *destination = value; }
+    static vector_type splat(int value) { return value; }
+    static vector_type zero() { return 0; }
+    static vector_type add_score(vector_type score, vector_type profile, vector_type) { return std::max(score + profile, 0); }
+    static vector_type subtract_gap(vector_type score, vector_type gap) { return std::max(score - gap, 0); }
+    static vector_type max(vector_type a, vector_type b) { return std::max(a, b); }
+    static vector_type shift_in_zero(vector_type) { return 0; }
+    static bool any_greater(vector_type a, vector_type b) { return a > b; }
+    static int horizontal_max(vector_type value) { return value; }
+};
+
+#if defined(SIMD_VECTOR_SSE2)
+
+//---------------------------------------------------------------------------
+// 16 unsigned byte lanes.  The profile is biased so that every score is
+// non-negative, and the bias is subtracted again after each add (Farrar).
+struct Sse2_byte_vector
+{
+    typedef uint8_t element_type;
+    typedef __m128i vector_type;
+
+    static constexpr size_t lanes = 16;
+    static constexpr bool saturates = true;
+    static constexpr bool biased = true;
+    static constexpr int element_max = UINT8_MAX;
+
+    static vector_type load(const element_type* source) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)); }
+    static void store(element_type* destination, vector_type value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), value); }
+    static vector_type splat(int value) { return _mm_set1_epi8(static_cast<char>(value)); }
+    static vector_type zero() { return _mm_setzero_si128(); }
+    static vector_type add_score(vector_type score, vector_type profile, vector_type bias) { return _mm_subs_epu8(_mm_adds_epu8(score, profile), bias); }
+    static vector_type subtract_gap(vector_type score, vector_type gap) { return _mm_subs_epu8(score, gap); }
+    static vector_type max(vector_type a, vector_type b) { return _mm_max_epu8(a, b); }
+    static vector_type shift_in_zero(vector_type value) { return _mm_slli_si128(value, 1); }
+
+    static bool any_greater(vector_type a, vector_type b)
+    {
+        // a - b saturates to zero in every lane where a <= b.
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(a, b), _mm_setzero_si128())) != 0xFFFF;
+    }
+
+    static int horizontal_max(vector_type value)
+    {
+        element_type elements[lanes];
+        store(elements, value);
+        return *std::max_element(elements, elements + lanes);
+    }
+};
+
+//---------------------------------------------------------------------------
+// 8 signed 16-bit lanes.  Used when a byte score overflows.
+struct Sse2_word_vector
+{
+    typedef int16_t element_type;
+    typedef __m128i vector_type;
+
+    static constexpr size_t lanes = 8;
+    static constexpr bool saturates = true;
+    static constexpr bool biased = false;
+    static constexpr int element_max = INT16_MAX;
+
+    static vector_type load(const element_type* source) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)); }
+    static void store(element_type* destination, vector_type value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), value); }
+    static vector_type splat(int value) { return _mm_set1_epi16(static_cast<short>(value)); }
+    static vector_type zero() { return _mm_setzero_si128(); }
+    static vector_type add_score(vector_type score, vector_type profile, vector_type) { return _mm_max_epi16(_mm_adds_epi16(score, profile), _mm_setzero_si128()); }
+    static vector_type subtract_gap(vector_type score, vector_type gap) { return _mm_subs_epu16(score, gap); }
+    static vector_type max(vector_type a, vector_type b) { return _mm_max_epi16(a, b); }
+    static vector_type shift_in_zero(vector_type value) { return _mm_slli_si128(value, 2); }
+    static bool any_greater(vector_type a, vector_type b) { return _mm_movemask_epi8(_mm_cmpgt_epi16(a, b)) != 0; }
+
+    static int horizontal_max(vector_type value)
+    {
+        element_type elements[lanes];
+        store(elements, value);
+        return *std::max_element(elements, elements + lanes);
+    }
+};
+
+typedef Sse2_byte_vector Simd_byte_vector;
+typedef Sse2_word_vector Simd_word_vector;
+
+#elif defined(SIMD_VECTOR_AVX2)
+
+//---------------------------------------------------------------------------
+// Shift a 256-bit register up by BYTES, carrying across the 128-bit halves.
+template<int BYTES>
+__m256i avx2_shift_in_zero(__m256i value)
+{
+    // Low half becomes zero, high half becomes the original low half, then
+    // align the pair so the top bytes of the low half move into the high half.
+    return _mm256_alignr_epi8(value, _mm256_permute2x128_si256(value, value, 0x08), 16 - BYTES);
+}
+
+//---------------------------------------------------------------------------
+// 32 unsigned byte lanes.  See Sse2_byte_vector.
+struct Avx2_byte_vector
+{
+    typedef uint8_t element_type;
+    typedef __m256i vector_type;
+
+    static constexpr size_t lanes = 32;
+    static constexpr bool saturates = true;
+    static constexpr bool biased = true;
+    static constexpr int element_max = UINT8_MAX;
+
+    static vector_type load(const element_type* source) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)); }
+    static void store(element_type* destination, vector_type value) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), value); }
+    static vector_type splat(int value) { return _mm256_set1_epi8(static_cast<char>(value)); }
+    static vector_type zero() { return _mm256_setzero_si256(); }
+    static vector_type add_score(vector_type score, vector_type profile, vector_type bias) { return _mm256_subs_epu8(_mm256_adds_epu8(score, profile), bias); }
+    static vector_type subtract_gap(vector_type score, vector_type gap) { return _mm256_subs_epu8(score, gap); }
+    static vector_type max(vector_type a, vector_type b) { return _mm256_max_epu8(a, b); }
+    static vector_type shift_in_zero(vector_type value) { return avx2_shift_in_zero<1>(value); }
+
+    static bool any_greater(vector_type a, vector_type b)
+    {
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), _mm256_setzero_si256())) != -1;
+    }
+
+    static int horizontal_max(vector_type value)
+    {
+        element_type elements[lanes];
+        store(elements, value);
+        return *std::max_element(elements, elements + lanes);
+    }
+};
+
+//---------------------------------------------------------------------------
+// 16 signed 16-bit lanes.  See Sse2_word_vector.
+struct Avx2_word_vector
+{
+    typedef int16_t element_type;
+    typedef __m256i vector_type;
+
+    static constexpr size_t lanes = 16;
+    static constexpr bool saturates = true;
+    static constexpr bool biased = false;
+    static constexpr int element_max = INT16_MAX;
+
+    static vector_type load(const element_type* source) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)); }
+    static void store(element_type* destination, vector_type value) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), value); }
+    static vector_type splat(int value) { return _mm256_set1_epi16(static_cast<short>(value)); }
+    static vector_type zero() { return _mm256_setzero_si256(); }
+    static vector_type add_score(vector_type score, vector_type profile, vector_type) { return _mm256_max_epi16(_mm256_adds_epi16(score, profile), _mm256_setzero_si256()); }
+    static vector_type subtract_gap(vector_type score, vector_type gap) { return _mm256_subs_epu16(score, gap); }
+    static vector_type max(vector_type a, vector_type b) { return _mm256_max_epi16(a, b); }
+    static vector_type shift_in_zero(vector_type value) { return avx2_shift_in_zero<2>(value); }
+    static bool any_greater(vector_type a, vector_type b) { return _mm256_movemask_epi8(_mm256_cmpgt_epi16(a, b)) != 0; }
+
+    static int horizontal_max(vector_type value)
+    {
+        element_type elements[lanes];
+        store(elements, value);
+        return *std::max_element(elements, elements + lanes);
+    }
+};
+
+typedef Avx2_byte_vector Simd_byte_vector;
+typedef Avx2_word_vector Simd_word_vector;
+
+#endif
@@ -1,6 +1,11 @@
 #include "PreCompile.h"
 #include "SmithWaterman.h"
 #include "ScorePolicy.h"
+#include "LinearScore.h"
+#include "BatchScore.h"
+#include "ThreadPool.h"
+#include "TraceBack.h"
+#include <Shared/Threads.h>
 
 //---------------------------------------------------------------------------
 int Alignment_table::score_at(size_t row, size_t column) const
@@ -15,167 +20,445 @@ void Alignment_table::set_score_at(int score, size_t row, size_t column)
 }
 
 //---------------------------------------------------------------------------
-// Helper function for printing trace backs.
-void Alignment_table::print_trace_back(std::ostream& output_stream, size_t row, size_t column, std::vector<residue_pair> optimal_alignment) const
+// Helper function for printing trace backs from one cell.
+// Prints at most max_alignments alignments (0 for no limit), and returns the number printed.
+size_t Alignment_table::print_trace_back(std::ostream& output_stream, size_t row, size_t column, size_t max_alignments) const
 {
-    bool print_when_done = true;
+    return print_trace_backs(output_stream, m_sequence1, m_sequence2, row, column, max_alignments, [this](size_t trace_row, size_t trace_column)
+    {
+        return m_trace_table[trace_row * m_columns + trace_column];
+    });
+}
 
-    // Don't continue the back trace if the base case is hit.
-    if((row > 0) && (column > 0))
+//---------------------------------------------------------------------------
+// Constructor that takes a pair of sequences to align.
+// A thread_count other than 1 fills large tables with a parallel wavefront (0 uses every hardware thread).
+Alignment_table::Alignment_table(const std::string& sequence1, const std::string& sequence2, int (*score_policy)(char char1, char char2), unsigned int thread_count)
+    : m_columns(sequence1.length() + 1)
+    , m_rows(sequence2.length() + 1)
+    , m_sequence1(sequence1)
+    , m_sequence2(sequence2)
+    , m_score_policy(score_policy)
+    , m_profile(sequence1, sequence2, score_policy)
+{
+    fill_table(thread_count);
+}
+
+//---------------------------------------------------------------------------
+// Score the entries of one tile of the table from the query profile.  The
+// entries above and to the left of the tile must already be scored.
+// Records the tile's max score cells (in row-major order), and the first
+// column of each row that beats the row's earlier columns.
+void Alignment_table::fill_tile(const table_tile& tile, tile_maxima& maxima)
+{
+    const int* left_gap_scores = m_profile.query_gap_scores();
+
+    maxima.max_score = 0;
+    maxima.max_score_cells.clear();
+    maxima.row_max_columns.assign(tile.last_row - tile.first_row, 0);
+
+    // Visit each entry in the tile and score each.
+    for(size_t row = tile.first_row; row < tile.last_row; ++row)
     {
-        // Calculate potential score paths.  Calculate the scores as done originally, but only
-        // follow scores that match what was actually used.
-        int current_score =  score_at(row, column);
-        int diagonal_score = score_at(row - 1, column - 1) + m_score_policy(m_sequence2[row - 1], m_sequence1[column - 1]);
-        int above_score =    score_at(row - 1, column)     + m_score_policy(m_sequence2[row - 1], gap_character);
-        int left_score =     score_at(row, column - 1)     + m_score_policy(gap_character,        m_sequence1[column - 1]);
+        // Only the row's residue varies the scores, so look up its profile row once.
+        const uint8_t code2 = m_codes2[row - 1];
+        const int* diagonal_scores = m_profile.scores(code2);
+        const int above_gap_score = m_profile.residue_gap_score(code2);
 
-        // Matching scores are not expected to be less than 0, but don't follow a trace of 0's.
-        //
-        // The way this works is that a residue pair is pushed into the optimial_alignment list,
-        // and a _copy_ of the list is sent to each recursion.  This way, each trace can be followed independently.
-        //
-        // TODO: There is an inefficiency here in that the list is copied for each pair instead of
-        // for each branch taken.  This is fine since the running cost is mostly in building the table,
-        // rather than the trace back.  This could be an area for improvement.
-        if((above_score == current_score) && (above_score > 0))
+        int row_max_score = 0;
+        size_t row_max_column = 0;
+
+        for(size_t column = tile.first_column; column < tile.last_column; ++column)
         {
-            residue_pair pair;
-            pair.residue1 = gap_character;
-            pair.residue2 = m_sequence2[row - 1];
+            int diagonal_score = score_at(row - 1, column - 1) + diagonal_scores[column - 1];
+            int above_score =    score_at(row - 1, column)     + above_gap_score;
+            int left_score =     score_at(row, column - 1)     + left_gap_scores[column - 1];
+
+            // Take the max score of 0 and the three potential scores and save it.
+            int score = std::max(0, diagonal_score);
+            score = std::max(score, left_score);
+            score = std::max(score, above_score);
 
-            optimal_alignment.push_back(pair);
+            set_score_at(score, row, column);
+
+            // Record which neighbors produced the score, for the trace back.
+            m_trace_table[row * m_columns + column] = trace_directions(score, diagonal_score, above_score, left_score);
 
-            print_trace_back(output_stream, row - 1, column, optimal_alignment);
+            // Record the cells with the max score as they are found, in the
+            // same row-major order that a scan of the tile would find them.
+            if(score > 0 && score >= maxima.max_score)
+            {
+                if(score > maxima.max_score)
+                {
+                    maxima.max_score = score;
+                    maxima.max_score_cells.clear();
+                }
 
-            optimal_alignment.pop_back();
+                maxima.max_score_cells.push_back(table_cell { row, column });
+            }
 
-            print_when_done = false;
+            if(score > row_max_score)
+            {
+                row_max_score = score;
+                row_max_column = column;
+            }
         }
 
-        if((left_score == current_score) && (left_score > 0))
-        {
-            residue_pair pair;
-            pair.residue1 = m_sequence1[column - 1];
-            pair.residue2 = gap_character;
+        maxima.row_max_columns[row - tile.first_row] = row_max_column;
+    }
+}
 
-            optimal_alignment.push_back(pair);
+//---------------------------------------------------------------------------
+// Score every entry of the table.
+//
+// Small tables, or a thread_count of 1, fill the table as a single tile in
+// row-major order.  Otherwise the table is split into cache-sized tiles.  A tile
+// only depends on the tiles above and to the left of it, so every tile on an
+// anti-diagonal of tiles can be filled at the same time.  Each tile records its
+// own maxima, and these are merged in row-major order, so the max score cells
+// are the same as the single tile fill.
+void Alignment_table::fill_table(unsigned int thread_count)
+{
+    constexpr size_t tile_rows = 256;
+    constexpr size_t tile_columns = 256;
 
-            print_trace_back(output_stream, row, column - 1, optimal_alignment);
+    // Create and init entries to 0 score, with no trace back directions.
+    m_score_table.resize(m_columns * m_rows);
+    m_trace_table.resize(m_columns * m_rows);
+    m_row_max_columns.resize(m_rows);
+    m_codes2 = m_profile.encode(m_sequence2);
 
-            optimal_alignment.pop_back();
+    const size_t tile_row_count = (m_rows + tile_rows - 2) / tile_rows;
+    const size_t tile_column_count = (m_columns + tile_columns - 2) / tile_columns;
 
-            print_when_done = false;
+    std::vector<table_tile> tiles;
+    if((thread_count != 1) && (tile_row_count > 1) && (tile_column_count > 1))
+    {
+        for(size_t tile_row = 0; tile_row < tile_row_count; ++tile_row)
+        {
+            for(size_t tile_column = 0; tile_column < tile_column_count; ++tile_column)
+            {
+                tiles.push_back(table_tile {
+                    1 + tile_row * tile_rows,
+                    std::min(m_rows, 1 + (tile_row + 1) * tile_rows),
+                    1 + tile_column * tile_columns,
+                    std::min(m_columns, 1 + (tile_column + 1) * tile_columns) });
+            }
         }
+    }
+    else
+    {
+        tiles.push_back(table_tile { 1, m_rows, 1, m_columns });
+    }
+
+    // Tiles are stored in row-major order, the same order the maxima are merged in.
+    std::vector<tile_maxima> maxima(tiles.size());
+    const size_t tile_row_stride = (tiles.size() == 1) ? 1 : tile_column_count;
+
+    if(tiles.size() == 1)
+    {
+        fill_tile(tiles[0], maxima[0]);
+    }
+    else
+    {
+        Work_stealing_pool pool(thread_count);
 
-        if((diagonal_score == current_score) && (diagonal_score > 0))
+        const size_t diagonal_count = tile_row_count + tile_column_count - 1;
+        for(size_t diagonal = 0; diagonal < diagonal_count; ++diagonal)
         {
-            residue_pair pair;
-            pair.residue1 = m_sequence1[column - 1];
-            pair.residue2 = m_sequence2[row - 1];
+            const size_t first_tile_row = (diagonal < tile_column_count) ? 0 : diagonal - tile_column_count + 1;
+            const size_t last_tile_row = std::min(diagonal + 1, tile_row_count);
 
-            optimal_alignment.push_back(pair);
+            for(size_t tile_row = first_tile_row; tile_row < last_tile_row; ++tile_row)
+            {
+                const size_t tile = tile_row * tile_row_stride + (diagonal - tile_row);
+                pool.submit([this, &tiles, &maxima, tile](unsigned int)
+                {
+                    fill_tile(tiles[tile], maxima[tile]);
+                });
+            }
 
-            print_trace_back(output_stream, row - 1, column - 1, optimal_alignment);
+            // The next anti-diagonal depends on this one.
+            pool.wait();
+        }
+    }
 
-            optimal_alignment.pop_back();
+    // Merge the maxima of the tiles.  Within a row of tiles, the max score cells
+    // of each tile are in row-major order, so merge them by row.
+    m_max_score = 0;
+    for(const auto& tile : maxima)
+    {
+        m_max_score = std::max(m_max_score, tile.max_score);
+    }
 
-            print_when_done = false;
+    m_max_score_cells.clear();
+    for(size_t first = 0; first < tiles.size(); first += tile_row_stride)
+    {
+        const size_t first_cell = m_max_score_cells.size();
+        for(size_t tile = first; tile < first + tile_row_stride; ++tile)
+        {
+            if((maxima[tile].max_score == m_max_score) && (m_max_score > 0))
+            {
+                m_max_score_cells.insert(m_max_score_cells.end(), maxima[tile].max_score_cells.cbegin(), maxima[tile].max_score_cells.cend());
+            }
         }
+
+        std::stable_sort(m_max_score_cells.begin() + first_cell, m_max_score_cells.end(), [](const table_cell& cell1, const table_cell& cell2)
+        {
+            return cell1.row < cell2.row;
+        });
     }
 
-    // If no work was done, then the end of the local alignment has been reached.  Print it out.
-    if(print_when_done)
+    // The first column with a row's max score is in the leftmost tile that holds it.
+    for(size_t tile = 0; tile < tiles.size(); ++tile)
     {
-        print_alignment(output_stream, optimal_alignment);
+        for(size_t row = tiles[tile].first_row; row < tiles[tile].last_row; ++row)
+        {
+            const size_t column = maxima[tile].row_max_columns[row - tiles[tile].first_row];
+            if(score_at(row, column) > score_at(row, m_row_max_columns[row]))
+            {
+                m_row_max_columns[row] = column;
+            }
+        }
     }
 }
 
 //---------------------------------------------------------------------------
-void Alignment_table::print_alignment(std::ostream& output_stream, const std::vector<residue_pair>& alignment) const
+int Alignment_table::max_score() const
+{
+    return m_max_score;
+}
+
+//---------------------------------------------------------------------------
+// Return the cells that hold the max score, in row-major order.
+// These are the end points of every optimal local alignment.
+// A table with no positive scores has no local alignment, so no cells.
+const std::vector<Alignment_table::table_cell>& Alignment_table::max_score_cells() const
+{
+    return m_max_score_cells;
+}
+
+//---------------------------------------------------------------------------
+size_t Alignment_table::row_count() const
+{
+    return m_rows;
+}
+
+//---------------------------------------------------------------------------
+size_t Alignment_table::column_count() const
 {
-    // The vector contains a reverse list of residue pair alignments.  Walk it backwards
-    // and print each character.
-    for(auto residue = alignment.rbegin(); residue != alignment.rend(); ++residue)
+    return m_columns;
+}
+
+//---------------------------------------------------------------------------
+// Return the optimal alignments that print_trace_back prints, in the same order.
+// Return at most max_alignments alignments, or all of them if max_alignments is 0.
+std::vector<Local_alignment> Alignment_table::co_optimal_alignments(size_t max_alignments) const
+{
+    std::vector<Local_alignment> alignments;
+
+    for(const table_cell& cell : m_max_score_cells)
     {
-        output_stream << residue->residue1;
+        const size_t remaining = (0 == max_alignments) ? 0 : max_alignments - alignments.size();
+        visit_trace_backs(m_sequence1, m_sequence2, cell.row, cell.column, remaining, [this](size_t trace_row, size_t trace_column)
+        {
+            return m_trace_table[trace_row * m_columns + trace_column];
+        },
+        [this, &cell, &alignments](const std::vector<Trace_node>& nodes, size_t first_node, size_t begin_row, size_t begin_column)
+        {
+            Local_alignment alignment;
+            alignment.score = m_max_score;
+            alignment.begin1 = begin_column;
+            alignment.end1 = cell.column;
+            alignment.begin2 = begin_row;
+            alignment.end2 = cell.row;
+            trace_node_strings(nodes, first_node, alignment.aligned1, alignment.aligned2);
+            alignments.push_back(std::move(alignment));
+        });
+
+        if(alignments.size() == max_alignments)
+        {
+            break;
+        }
     }
 
-    output_stream << "\n";
+    return alignments;
+}
 
-    for(auto residue = alignment.rbegin(); residue != alignment.rend(); ++residue)
+//---------------------------------------------------------------------------
+// Results of the top_alignments alignments, without the aligned strings.
+std::vector<Alignment_result> Alignment_table::alignment_results(size_t count) const
+{
+    std::vector<Alignment_result> results;
+    for(const Local_alignment& alignment : top_alignments(count))
     {
-        output_stream << residue->residue2;
+        results.push_back(make_alignment_result(alignment));
     }
 
-    output_stream << "\n";
+    return results;
 }
 
 //---------------------------------------------------------------------------
-// Method to permute a sequence.
-// TODO: The choice of rand() may have an effect here.  Something to test would be
-// a mersenne twister rand() which has equidistribution properties, and see if the p-value
-// is significantly changed.
-void permute_sequence(std::string& sequence)
+// Print all of the trace backs.  Call a helper method to print
+// all of the traces from each cell that holds the max score.
+// Stop after max_alignments alignments, or print all of them if max_alignments is 0.
+void Alignment_table::print_trace_back(std::ostream& output_stream, size_t max_alignments) const
 {
-    for(size_t ix = sequence.size(); ix > 0; --ix)
+    output_stream << "Optimal score: " << m_max_score << "\nTrace back sequences:\n";
+
+    size_t alignment_count = 0;
+
+    for(const table_cell& cell : m_max_score_cells)
     {
-        std::swap(sequence[ix - 1], sequence[rand() % ix]);
+        const size_t remaining = (0 == max_alignments) ? 0 : max_alignments - alignment_count;
+        alignment_count += print_trace_back(output_stream, cell.row, cell.column, remaining);
+
+        if(alignment_count == max_alignments)
+        {
+            return;
+        }
     }
 }
 
 //---------------------------------------------------------------------------
-// Constructor that takes a pair of sequences to align.
-Alignment_table::Alignment_table(const std::string& sequence1, const std::string& sequence2, int (*score_policy)(char char1, char char2))
-    : m_columns(sequence1.length() + 1)
-    , m_rows(sequence2.length() + 1)
-    , m_sequence1(sequence1)
-    , m_sequence2(sequence2)
-    , m_score_policy(score_policy)
+// Rescore one row of a working copy of the table, from first_column to the end.
+// Cells used by an earlier alignment score 0, so no later alignment passes through them.
+// Returns true if any score in the row changed.
+bool Alignment_table::rescore_row(
+    std::vector<int>& scores,
+    std::vector<uint8_t>& trace,
+    const std::vector<bool>& used_cells,
+    size_t row,
+    size_t first_column) const
 {
-    // Create and init entries to 0 score.
-    m_score_table.resize(m_columns * m_rows);
+    const uint8_t code2 = m_codes2[row - 1];
+    const int* diagonal_scores = m_profile.scores(code2);
+    const int above_gap_score = m_profile.residue_gap_score(code2);
+    const int* left_gap_scores = m_profile.query_gap_scores();
+
+    bool changed = false;
 
-    // Visit each entry in the table (besides the base cases) and score each.
-    for(size_t row = 1; row < m_rows; ++row)
+    for(size_t column = first_column; column < m_columns; ++column)
     {
-        for(size_t column = 1; column < m_columns; ++column)
+        const size_t cell = row * m_columns + column;
+
+        int score = 0;
+        uint8_t directions = 0;
+        if(!used_cells[cell])
         {
-            int diagonal_score = score_at(row - 1, column - 1) + m_score_policy(m_sequence2[row - 1], m_sequence1[column - 1]);
-            int above_score =    score_at(row - 1, column)     + m_score_policy(m_sequence2[row - 1], gap_character);
-            int left_score =     score_at(row, column - 1)     + m_score_policy(gap_character,        m_sequence1[column - 1]);
+            int diagonal_score = scores[cell - m_columns - 1] + diagonal_scores[column - 1];
+            int above_score =    scores[cell - m_columns]     + above_gap_score;
+            int left_score =     scores[cell - 1]             + left_gap_scores[column - 1];
 
-            // Take the max score of 0 and the three potential scores and save it.
-            int score = std::max(0, diagonal_score);
+            score = std::max(0, diagonal_score);
             score = std::max(score, left_score);
             score = std::max(score, above_score);
 
-            m_max_score = std::max(m_max_score, score);
-            set_score_at(score, row, column);
+            directions = trace_directions(score, diagonal_score, above_score, left_score);
         }
+
+        changed = changed || (scores[cell] != score);
+        scores[cell] = score;
+        trace[cell] = directions;
     }
+
+    return changed;
 }
 
 //---------------------------------------------------------------------------
-// Print all of the trace backs.  Search the score table
-// for scores that match the maximum and then call a helper
-// method to print all of the traces from that entry.
-void Alignment_table::print_trace_back(std::ostream& output_stream) const
+// Find up to count local alignments, best first, that share no cells of the table
+// (Waterman-Eggert).  After each alignment is traced, its cells are removed and only
+// the part of a working copy of the table that depends on them is rescored.
+// The table itself is left unchanged.
+//
+// The first alignment is the first that print_trace_back prints.
+std::vector<Local_alignment> Alignment_table::top_alignments(size_t count) const
 {
-    output_stream << "Optimal score: " << m_max_score << "\nTrace back sequences:\n";
+    std::vector<Local_alignment> alignments;
 
-    std::vector<residue_pair> optimal_alignment;
+    std::vector<int> scores(m_score_table);
+    std::vector<uint8_t> trace(m_trace_table);
+    std::vector<bool> used_cells(m_score_table.size());
+    std::vector<size_t> row_max_columns(m_row_max_columns);
 
-    for(size_t row = 0; row < m_rows; ++row)
+    while(alignments.size() < count)
     {
-        for(size_t column = 0; column < m_columns; ++column)
+        // Find the best remaining end point.  The first row wins ties, as in a row-major scan.
+        size_t row = 0;
+        size_t column = 0;
+        for(size_t ix = 1; ix < m_rows; ++ix)
+        {
+            if(scores[ix * m_columns + row_max_columns[ix]] > scores[row * m_columns + column])
+            {
+                row = ix;
+                column = row_max_columns[ix];
+            }
+        }
+
+        Local_alignment alignment;
+        alignment.score = scores[row * m_columns + column];
+        if(alignment.score <= 0)
+        {
+            break;
+        }
+
+        alignment.end1 = column;
+        alignment.end2 = row;
+
+        // Trace back one path, preferring the same directions as print_trace_back.
+        for(uint8_t directions = trace[row * m_columns + column]; directions != 0; directions = trace[row * m_columns + column])
+        {
+            used_cells[row * m_columns + column] = true;
+
+            if(directions & trace_above)
+            {
+                alignment.aligned1.push_back(gap_character);
+                alignment.aligned2.push_back(m_sequence2[--row]);
+            }
+            else if(directions & trace_left)
+            {
+                alignment.aligned1.push_back(m_sequence1[--column]);
+                alignment.aligned2.push_back(gap_character);
+            }
+            else
+            {
+                alignment.aligned1.push_back(m_sequence1[--column]);
+                alignment.aligned2.push_back(m_sequence2[--row]);
+            }
+        }
+
+        alignment.begin1 = column;
+        alignment.begin2 = row;
+        std::reverse(alignment.aligned1.begin(), alignment.aligned1.end());
+        std::reverse(alignment.aligned2.begin(), alignment.aligned2.end());
+
+        // Scores only depend on cells above and to the left, so rescore below and to the right
+        // of the start of the alignment.  Past the end of the alignment, stop at the first
+        // row that did not change, since the rows below it cannot change either.
+        for(size_t rescore = alignment.begin2 + 1; rescore < m_rows; ++rescore)
         {
-            if(score_at(row, column) == m_max_score)
+            const bool changed = rescore_row(scores, trace, used_cells, rescore, alignment.begin1 + 1);
+
+            size_t& max_column = row_max_columns[rescore];
+            max_column = 0;
+            for(size_t ix = 1; ix < m_columns; ++ix)
+            {
+                if(scores[rescore * m_columns + ix] > scores[rescore * m_columns + max_column])
+                {
+                    max_column = ix;
+                }
+            }
+
+            if(!changed && (rescore > alignment.end2))
             {
-                print_trace_back(output_stream, row, column, optimal_alignment);
+                break;
             }
         }
+
+        alignments.push_back(std::move(alignment));
     }
+
+    return alignments;
 }
 
 //---------------------------------------------------------------------------
@@ -195,6 +478,48 @@ void Alignment_table::print_table(std::ostream& output_stream) const
     output_stream << "\n";
 }
 
+// Number of permutations that are drawn and scored together.
+constexpr unsigned int permutations_per_block = 64;
+
+//---------------------------------------------------------------------------
+// Score count permutations of m_sequence2 against m_sequence1.
+//
+// Only the max score of each permutation is needed.  When the score policy
+// allows it, the block of permutations is scored together by the batch
+// kernel, one permutation per SIMD lane.  Otherwise the two-row kernel scores
+// them one at a time.  Neither keeps a score table, and each thread reuses one
+// workspace for all of its permutations.
+//
+// Each block seeds its own generator from (seed, block index) and starts from
+// the unpermuted sequence, so the permutations of a block do not depend on
+// which thread scores it, or on which blocks were scored before.
+void Alignment_table::score_permutations(const Batch_profile& profile, unsigned int block, unsigned int count, uint32_t seed, Score_workspace& workspace, std::vector<int>& max_scores) const
+{
+    std::seed_seq block_seed { seed, block };
+    std::mt19937 generator(block_seed);
+    std::string permuted_sequence = m_sequence2;
+
+    std::vector<std::string> permuted_sequences(count);
+    for(size_t ix = 0; ix < permuted_sequences.size(); ++ix)
+    {
+        permute_sequence(permuted_sequence, generator);
+        permuted_sequences[ix] = permuted_sequence;
+    }
+
+    if(profile.is_valid())
+    {
+        max_scores = profile.max_scores(permuted_sequences, workspace);
+    }
+    else
+    {
+        max_scores.resize(permuted_sequences.size());
+        for(size_t ix = 0; ix < permuted_sequences.size(); ++ix)
+        {
+            max_scores[ix] = linear_max_score(m_sequence1, permuted_sequences[ix], m_score_policy, workspace);
+        }
+    }
+}
+
 //---------------------------------------------------------------------------
 // Calculate p-value for current sequence pair.
 // A sequence is chosen, permuted, and scored against the other sequence.
@@ -204,23 +529,129 @@ void Alignment_table::print_table(std::ostream& output_stream) const
 //
 // There are multiple alignments resulting from multiple trace backs, but
 // only the score the mostly recently cached alignment.
-void Alignment_table::calc_pvalue(std::ostream& output_stream, unsigned int num_permutations) const
+//
+// The permutations are split into fixed size blocks which threads take in turn,
+// so a given seed produces the same k/N for any thread_count.  A thread_count
+// of 0 uses every hardware thread.
+Pvalue_estimate Alignment_table::permutation_pvalue(unsigned int num_permutations, unsigned int thread_count, uint32_t seed) const
 {
-    unsigned int num_better_scores = 0;
+    const unsigned int num_blocks = (num_permutations + permutations_per_block - 1) / permutations_per_block;
+
+    // Permutations only reorder m_sequence2, so one profile covers them all.
+    const Batch_profile profile(m_sequence1, m_sequence2, m_score_policy);
+
+    std::atomic<unsigned int> next_block(0);
+    std::atomic<unsigned int> num_better_scores(0);
 
-    std::string permuted_sequence(m_sequence2);
-    for(unsigned int ix = 0; ix < num_permutations; ++ix)
+    const auto score_blocks = [&]()
     {
-        permute_sequence(permuted_sequence);
-        Alignment_table test_table(m_sequence1, permuted_sequence, m_score_policy);
+        Score_workspace workspace;
+        std::vector<int> max_scores;
+        unsigned int thread_better_scores = 0;
 
-        if(test_table.m_max_score > m_max_score)
+        for(unsigned int block = next_block++; block < num_blocks; block = next_block++)
         {
-            ++num_better_scores;
+            const unsigned int first = block * permutations_per_block;
+            const unsigned int last = std::min(first + permutations_per_block, num_permutations);
+            score_permutations(profile, block, last - first, seed, workspace, max_scores);
+
+            thread_better_scores += static_cast<unsigned int>(std::count_if(max_scores.cbegin(), max_scores.cend(), [this](int max_score)
+            {
+                return max_score > m_max_score;
+            }));
         }
+
+        num_better_scores += thread_better_scores;
+    };
+
+    run_workers(thread_count, num_blocks, score_blocks);
+
+    Pvalue_estimate estimate;
+    estimate.permutations = num_permutations;
+    estimate.better_scores = num_better_scores;
+    estimate.pvalue = static_cast<double>(estimate.better_scores) / num_permutations;
+
+    return estimate;
+}
+
+//---------------------------------------------------------------------------
+// Print the p-value of permutation_pvalue.
+void Alignment_table::calc_pvalue(std::ostream& output_stream, unsigned int num_permutations, unsigned int thread_count, uint32_t seed) const
+{
+    print_pvalue_estimate(output_stream, permutation_pvalue(num_permutations, thread_count, seed));
+}
+
+//---------------------------------------------------------------------------
+// Estimate the p-value with as few permutations as the options allow.
+// Blocks are scored a round at a time, then checked in block order against
+// the sequential stopping rule, and the estimate stops at the first block
+// where the rule holds.  Blocks of the last round past that one are dropped,
+// so the estimate is the same for any thread_count, and is the calc_pvalue
+// estimate of the permutations that were drawn.
+//
+// A Gumbel distribution is fit to the max scores of every drawn permutation,
+// which estimates p-values far smaller than 1/N.
+Pvalue_estimate Alignment_table::estimate_pvalue(const Pvalue_options& options, unsigned int thread_count, uint32_t seed) const
+{
+    const unsigned int num_blocks = (options.max_permutations + permutations_per_block - 1) / permutations_per_block;
+    const unsigned int blocks_per_round = std::max(16u, resolve_thread_count(thread_count));
+
+    const Batch_profile profile(m_sequence1, m_sequence2, m_score_policy);
+
+    Pvalue_estimate estimate;
+    std::vector<int> scores;
+    std::vector<std::vector<int>> round_scores(blocks_per_round);
+    bool is_settled = false;
+
+    for(unsigned int first_block = 0; (first_block < num_blocks) && !is_settled; first_block += blocks_per_round)
+    {
+        const unsigned int round_block_count = std::min(blocks_per_round, num_blocks - first_block);
+        std::atomic<unsigned int> next_block(0);
+
+        const auto score_blocks = [&]()
+        {
+            Score_workspace workspace;
+            for(unsigned int block = next_block++; block < round_block_count; block = next_block++)
+            {
+                const unsigned int first = (first_block + block) * permutations_per_block;
+                const unsigned int last = std::min(first + permutations_per_block, options.max_permutations);
+                score_permutations(profile, first_block + block, last - first, seed, workspace, round_scores[block]);
+            }
+        };
+
+        run_workers(thread_count, round_block_count, score_blocks);
+
+        for(unsigned int block = 0; (block < round_block_count) && !is_settled; ++block)
+        {
+            for(int max_score : round_scores[block])
+            {
+                estimate.better_scores += (max_score > m_max_score) ? 1 : 0;
+            }
+
+            estimate.permutations += static_cast<unsigned int>(round_scores[block].size());
+            scores.insert(scores.end(), round_scores[block].cbegin(), round_scores[block].cend());
+            is_settled = pvalue_is_settled(estimate.better_scores, estimate.permutations, options);
+        }
+    }
+
+    if(estimate.permutations > 0)
+    {
+        estimate.pvalue = static_cast<double>(estimate.better_scores) / estimate.permutations;
     }
 
-    output_stream << "p-value: " << static_cast<float>(num_better_scores) / num_permutations
-                  << " (" << num_better_scores << " / " << num_permutations << ")\n\n";
+    estimate.fit = fit_gumbel(scores);
+    if(estimate.fit.is_valid)
+    {
+        estimate.tail_pvalue = gumbel_pvalue(estimate.fit, m_max_score);
+        estimate.karlin_altschul_K = std::exp(estimate.fit.lambda * estimate.fit.mu) / (static_cast<double>(m_sequence1.size()) * m_sequence2.size());
+    }
+
+    return estimate;
 }
 
+//---------------------------------------------------------------------------
+// Print the p-value of estimate_pvalue.
+void Alignment_table::calc_adaptive_pvalue(std::ostream& output_stream, const Pvalue_options& options, unsigned int thread_count, uint32_t seed) const
+{
+    print_pvalue_estimate(output_stream, estimate_pvalue(options, thread_count, seed));
+}
@@ -1,19 +1,43 @@
 #pragma once
 
+#include "QueryProfile.h"
+#include "Hirschberg.h"
+#include "AlignmentResult.h"
+#include "Significance.h"
+
+class Batch_profile;
+class Score_workspace;
+
 //---------------------------------------------------------------------------
 // Definition of a sequence alignment table.
 class Alignment_table
 {
+public:
+    struct table_cell
+    {
+        size_t row;       // index on i axis, one past the residue of sequence2
+        size_t column;    // index on j axis, one past the residue of sequence1
+    };
+
+private:
     std::vector<int> m_score_table; // 2D matrix of scores
+    std::vector<uint8_t> m_trace_table; // 2D matrix of trace back directions
     const size_t m_columns;         // width of matrix
     const size_t m_rows;            // height of matrix
     int m_max_score = 0;            // maximum score in this matrix
     std::string m_sequence1;        // represents sequence on j axis
     std::string m_sequence2;        // represents sequence on i axis
+    std::vector<table_cell> m_max_score_cells;  // cells with m_max_score, in row-major order
+    std::vector<size_t> m_row_max_columns;      // first column with the max score of each row
 
     // This is a function that represents the scoring policy (BLOSUM-62 or otherwise)
     int (*m_score_policy)(char char1, char char2);
 
+    // Scores of m_sequence1 against each residue of m_sequence2, and the codes
+    // of m_sequence2 in that profile.  The table fill only reads from these.
+    Query_profile m_profile;
+    std::vector<uint8_t> m_codes2;
+
     // Not implemented to prevent accidental copying/moving.
     Alignment_table(const Alignment_table&) = delete;
     Alignment_table(Alignment_table&&) noexcept = delete;
@@ -21,22 +45,63 @@ class Alignment_table
     Alignment_table& operator=(Alignment_table&&) noexcept = delete;
 
 protected:
-    struct residue_pair
+    struct table_tile
     {
-        char residue1;    // residue on j axis
-        char residue2;    // residue on i axis
+        size_t first_row;
+        size_t last_row;        // one past the last row
+        size_t first_column;
+        size_t last_column;     // one past the last column
     };
 
-    int score_at(size_t row, size_t column) const;
+    struct tile_maxima
+    {
+        int max_score;
+        std::vector<table_cell> max_score_cells;
+        std::vector<size_t> row_max_columns;    // per row of the tile, or 0 if no score is positive
+    };
+
+    void fill_table(unsigned int thread_count);
+    void fill_tile(const table_tile& tile, tile_maxima& maxima);
     void set_score_at(int score, size_t row, size_t column);
-    void print_trace_back(std::ostream& output_stream, size_t row, size_t column, std::vector<residue_pair> optimal_alignment) const;
-    void print_alignment(std::ostream& output_stream, const std::vector<residue_pair>& alignment) const;
+    size_t print_trace_back(std::ostream& output_stream, size_t row, size_t column, size_t max_alignments) const;
+    void score_permutations(const Batch_profile& profile, unsigned int block, unsigned int count, uint32_t seed, Score_workspace& workspace, std::vector<int>& max_scores) const;
+    bool rescore_row(std::vector<int>& scores, std::vector<uint8_t>& trace, const std::vector<bool>& used_cells, size_t row, size_t first_column) const;
 
 public:
-    Alignment_table(const std::string& sequence1, const std::string& sequence2, int (score_policy)(char char1, char char2));
+    Alignment_table(const std::string& sequence1, const std::string& sequence2, int (score_policy)(char char1, char char2), unsigned int thread_count = 1);
+    template<typename Score_policy>
+    Alignment_table(const std::string& sequence1, const std::string& sequence2, Score_policy score_policy, unsigned int thread_count = 1);
     ~Alignment_table() = default;
-    void print_trace_back(std::ostream& output_stream) const;
+    int max_score() const;
+    const std::vector<table_cell>& max_score_cells() const;
+    size_t row_count() const;
+    size_t column_count() const;
+    int score_at(size_t row, size_t column) const;
+    std::vector<Local_alignment> co_optimal_alignments(size_t max_alignments) const;
+    std::vector<Local_alignment> top_alignments(size_t count) const;
+    std::vector<Alignment_result> alignment_results(size_t count) const;
+    Pvalue_estimate permutation_pvalue(unsigned int num_permutations, unsigned int thread_count, uint32_t seed) const;
+    void print_trace_back(std::ostream& output_stream, size_t max_alignments) const;
     void print_table(std::ostream& output_stream) const;
-    void calc_pvalue(std::ostream& output_stream, unsigned int cSequences) const;
+    void calc_pvalue(std::ostream& output_stream, unsigned int num_permutations, unsigned int thread_count, uint32_t seed) const;
+    Pvalue_estimate estimate_pvalue(const Pvalue_options& options, unsigned int thread_count, uint32_t seed) const;
+    void calc_adaptive_pvalue(std::ostream& output_stream, const Pvalue_options& options, unsigned int thread_count, uint32_t seed) const;
 };
 
+//---------------------------------------------------------------------------
+// Constructor that takes a pair of sequences to align, and a score policy
+// type such as BLOSUM62_score_policy<-4>.  The p-values score with a default
+// constructed Score_policy, so the policy must not hold any state.
+template<typename Score_policy>
+Alignment_table::Alignment_table(const std::string& sequence1, const std::string& sequence2, Score_policy score_policy, unsigned int thread_count)
+    : m_columns(sequence1.length() + 1)
+    , m_rows(sequence2.length() + 1)
+    , m_sequence1(sequence1)
+    , m_sequence2(sequence2)
+    , m_score_policy([](char char1, char char2) { return Score_policy()(char1, char2); })
+    , m_profile(sequence1, sequence2, score_policy)
+{
+    static_assert(std::is_empty<Score_policy>::value, "Score policies must be stateless, since only their type is kept.");
+
+    fill_table(thread_count);
+}
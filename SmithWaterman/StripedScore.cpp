@@ -0,0 +1,259 @@
+#include "PreCompile.h"
+#include "ScorePolicy.h"
+#include "LinearScore.h"
+#include "StripedScore.h"   // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+// Lay out the query scores for each target residue in striped order.
+// Positions past the end of the query are padded with the lowest score,
+// which can never raise the maximum.
+template<typename Vector>
+static void build_layout(
+    Striped_layout<Vector>& layout,
+    const std::string& query,
+    const std::string& residues,
+    int gap_penalty,
+    int (*score_policy)(char char1, char char2))
+{
+    typedef typename Vector::element_type element_type;
+    const size_t lanes = Vector::lanes;
+
+    int min_score = 0;
+    int max_score = 0;
+    for(size_t residue = 0; residue < residues.size(); ++residue)
+    {
+        for(size_t position = 0; position < query.size(); ++position)
+        {
+            const int score = score_policy(residues[residue], query[position]);
+            min_score = std::min(min_score, score);
+            max_score = std::max(max_score, score);
+        }
+    }
+
+    layout.bias = Vector::biased ? -min_score : 0;
+    layout.max_score = max_score + layout.bias;
+
+    // Check that every score (and the gap penalty) fits in an element.
+    if(Vector::saturates)
+    {
+        const long long element_min = std::numeric_limits<element_type>::min();
+        const long long element_max = std::numeric_limits<element_type>::max();
+        if((min_score + layout.bias < element_min) ||
+           (layout.max_score > element_max) ||
+           (gap_penalty > element_max))
+        {
+            layout.valid = false;
+            return;
+        }
+    }
+
+    layout.segment_count = (query.size() + lanes - 1) / lanes;
+    const size_t stride = layout.segment_count * lanes;
+
+    layout.scores.assign(residues.size() * stride, static_cast<element_type>(min_score + layout.bias));
+    for(size_t residue = 0; residue < residues.size(); ++residue)
+    {
+        for(size_t segment = 0; segment < layout.segment_count; ++segment)
+        {
+            for(size_t lane = 0; lane < lanes; ++lane)
+            {
+                const size_t position = lane * layout.segment_count + segment;
+                if(position < query.size())
+                {
+                    const int score = score_policy(residues[residue], query[position]) + layout.bias;
+                    layout.scores[residue * stride + segment * lanes + lane] = static_cast<element_type>(score);
+                }
+            }
+        }
+    }
+
+    layout.valid = true;
+}
+
+//---------------------------------------------------------------------------
+// Striped Smith-Waterman fill (Farrar, 2007) returning only the maximum score.
+//
+// Each target residue is one pass over the striped query.  The gap along the
+// query (left_gap) is carried between segments in the inner loop, and then
+// any gap that must cross from one lane to the next is fixed up by the "lazy F"
+// loop, which usually exits after a single check.
+//
+// Returns false if the lanes saturated, in which case max_score is not reliable.
+template<typename Vector>
+static bool striped_max_score(
+    const Striped_layout<Vector>& layout,
+    const std::array<uint8_t, UCHAR_MAX + 1>& residue_index,
+    const std::string& target,
+    int gap_penalty,
+    Score_workspace& workspace,
+    int& max_score)
+{
+    typedef typename Vector::element_type element_type;
+    typedef typename Vector::vector_type vector_type;
+
+    const size_t lanes = Vector::lanes;
+    const size_t segment_count = layout.segment_count;
+    const size_t stride = segment_count * lanes;
+
+    // Scores for the previous and current target residue, and the gap scores
+    // carried from the previous target residue.
+    element_type* load_scores = workspace.zeroed_scores<element_type>(stride * 3);
+    element_type* store_scores = load_scores + stride;
+    element_type* up_gap_scores = store_scores + stride;
+
+    const vector_type zero = Vector::zero();
+    const vector_type gap = Vector::splat(gap_penalty);
+    const vector_type bias = Vector::splat(layout.bias);
+    vector_type max_vector = zero;
+
+    for(size_t ix = 0; ix < target.size(); ++ix)
+    {
+        const size_t residue = residue_index[static_cast<uint8_t>(target[ix])];
+        assert(residue != UINT8_MAX);
+        const element_type* profile = &layout.scores[residue * stride];
+
+        // The diagonal for the first segment is the last segment of the
+        // previous pass, moved up one lane.
+        vector_type score = Vector::shift_in_zero(Vector::load(&store_scores[stride - lanes]));
+        vector_type left_gap = zero;
+        std::swap(load_scores, store_scores);
+
+        for(size_t segment = 0; segment < segment_count; ++segment)
+        {
+            const size_t offset = segment * lanes;
+
+            score = Vector::add_score(score, Vector::load(profile + offset), bias);
+
+            const vector_type up_gap = Vector::load(&up_gap_scores[offset]);
+            score = Vector::max(score, up_gap);
+            score = Vector::max(score, left_gap);
+            max_vector = Vector::max(max_vector, score);
+            Vector::store(&store_scores[offset], score);
+
+            // Open or extend the gaps from this cell.
+            score = Vector::subtract_gap(score, gap);
+            Vector::store(&up_gap_scores[offset], Vector::max(Vector::subtract_gap(up_gap, gap), score));
+            left_gap = Vector::max(Vector::subtract_gap(left_gap, gap), score);
+
+            score = Vector::load(&load_scores[offset]);
+        }
+
+        // Lazy F loop.  Carry the gap along the query into the next lane until
+        // it no longer improves any score.
+        left_gap = Vector::shift_in_zero(left_gap);
+        size_t segment = 0;
+        while(Vector::any_greater(left_gap, Vector::subtract_gap(Vector::load(&store_scores[segment * lanes]), gap)))
+        {
+            const size_t offset = segment * lanes;
+
+            score = Vector::max(Vector::load(&store_scores[offset]), left_gap);
+            max_vector = Vector::max(max_vector, score);
+            Vector::store(&store_scores[offset], score);
+            Vector::store(&up_gap_scores[offset], Vector::max(Vector::load(&up_gap_scores[offset]), Vector::subtract_gap(score, gap)));
+
+            left_gap = Vector::subtract_gap(left_gap, gap);
+            if(++segment == segment_count)
+            {
+                segment = 0;
+                left_gap = Vector::shift_in_zero(left_gap);
+            }
+        }
+    }
+
+    max_score = Vector::horizontal_max(max_vector);
+
+    // If adding the largest score to the maximum could reach the top of the
+    // element range, some lane may have saturated.
+    return !Vector::saturates ||
+           (static_cast<long long>(max_score) + layout.max_score < std::numeric_limits<element_type>::max());
+}
+
+//---------------------------------------------------------------------------
+// Build the profile of query against each residue in target_residues.
+// Targets scored against this profile may only contain those residues.
+Striped_profile::Striped_profile(const std::string& query, const std::string& target_residues, int (*score_policy)(char char1, char char2))
+    : m_query_length(query.size())
+{
+    // Collect the distinct target residues.
+    m_residue_index.fill(UINT8_MAX);
+    std::string residues;
+    for(size_t ix = 0; ix < target_residues.size(); ++ix)
+    {
+        const uint8_t residue = static_cast<uint8_t>(target_residues[ix]);
+        if(m_residue_index[residue] == UINT8_MAX)
+        {
+            assert(residues.size() < UINT8_MAX);
+            m_residue_index[residue] = static_cast<uint8_t>(residues.size());
+            residues.push_back(target_residues[ix]);
+        }
+    }
+
+    // The striped kernel needs a single linear gap penalty.  Check that the
+    // policy scores a gap the same against every residue in either sequence.
+    const int gap_score = score_policy(gap_character, query.empty() ? gap_character : query[0]);
+    bool uniform_gap = gap_score < 0;
+    for(size_t ix = 0; uniform_gap && (ix < query.size()); ++ix)
+    {
+        uniform_gap = score_policy(gap_character, query[ix]) == gap_score;
+    }
+    for(size_t ix = 0; uniform_gap && (ix < residues.size()); ++ix)
+    {
+        uniform_gap = score_policy(residues[ix], gap_character) == gap_score;
+    }
+
+    if(!uniform_gap)
+    {
+        return;
+    }
+
+    m_gap_penalty = -gap_score;
+
+#if defined(SIMD_VECTOR_ENABLED)
+    build_layout(m_byte_layout, query, residues, m_gap_penalty, score_policy);
+    build_layout(m_word_layout, query, residues, m_gap_penalty, score_policy);
+#endif
+    build_layout(m_int_layout, query, residues, m_gap_penalty, score_policy);
+}
+
+//---------------------------------------------------------------------------
+// The profile is unusable if the score policy does not have a uniform gap penalty.
+bool Striped_profile::is_valid() const
+{
+    return m_gap_penalty > 0;
+}
+
+//---------------------------------------------------------------------------
+int Striped_profile::gap_penalty() const
+{
+    return m_gap_penalty;
+}
+
+//---------------------------------------------------------------------------
+// Return the maximum local alignment score of the query against target.
+// This matches the max score of an Alignment_table of the same pair.
+int Striped_profile::max_score(const std::string& target, Score_workspace& workspace) const
+{
+    assert(is_valid());
+
+    int max_score = 0;
+    if((0 == m_query_length) || target.empty())
+    {
+        return max_score;
+    }
+
+#if defined(SIMD_VECTOR_ENABLED)
+    // Most alignments fit in bytes.  Only rerun with wider lanes on overflow.
+    if(m_byte_layout.valid && striped_max_score(m_byte_layout, m_residue_index, target, m_gap_penalty, workspace, max_score))
+    {
+        return max_score;
+    }
+
+    if(m_word_layout.valid && striped_max_score(m_word_layout, m_residue_index, target, m_gap_penalty, workspace, max_score))
+    {
+        return max_score;
+    }
+#endif
+
+    striped_max_score(m_int_layout, m_residue_index, target, m_gap_penalty, workspace, max_score);
+    return max_score;
+}
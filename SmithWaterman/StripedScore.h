@@ -0,0 +1,45 @@
+#pragma once
+
+#include "SimdVector.h"
+
+class Score_workspace;
+
+//---------------------------------------------------------------------------
+// Scores of one query against every residue of a target alphabet, laid out for
+// a vector type.  Lane k of segment s holds query position k * segment_count + s.
+template<typename Vector>
+struct Striped_layout
+{
+    std::vector<typename Vector::element_type> scores;  // [residue][segment][lane]
+    size_t segment_count = 0;                           // Number of vectors per residue.
+    int bias = 0;                                       // Added to each score to keep it non-negative.
+    int max_score = 0;                                  // Largest (biased) score in the layout.
+    bool valid = false;                                 // False if the scores do not fit the element type.
+};
+
+//---------------------------------------------------------------------------
+// Query profile for the striped score-only kernel (Farrar, 2007).
+// The profile is built once per query, and can then score any number of
+// targets drawn from the same alphabet (e.g. permutations of a sequence).
+//
+// Only the maximum score is computed, so no score table is kept, and the
+// linear gap penalty must be the same for every residue.
+class Striped_profile
+{
+    std::array<uint8_t, UCHAR_MAX + 1> m_residue_index; // Maps a target residue to its row in the profile.
+    size_t m_query_length;                              // Number of residues in the query.
+    int m_gap_penalty = 0;                              // Cost of a gap (positive), or 0 if gaps are not uniform.
+
+#if defined(SIMD_VECTOR_ENABLED)
+    Striped_layout<Simd_byte_vector> m_byte_layout;     // Tried first.
+    Striped_layout<Simd_word_vector> m_word_layout;     // Used if the byte scores overflow.
+#endif
+    Striped_layout<Scalar_int_vector> m_int_layout;     // Used if the word scores overflow.
+
+public:
+    Striped_profile(const std::string& query, const std::string& target_residues, int (*score_policy)(char char1, char char2));
+
+    bool is_valid() const;
+    int gap_penalty() const;
+    int max_score(const std::string& target, Score_workspace& workspace) const;
+};
@@ -0,0 +1,144 @@
+#include "PreCompile.h"
+#include "ThreadPool.h"     // Pick up forward declarations to ensure correctness.
+#include <Shared/Threads.h>
+
+//---------------------------------------------------------------------------
+Work_stealing_pool::Work_stealing_pool(unsigned int thread_count, size_t max_queued_per_thread)
+{
+    thread_count = resolve_thread_count(thread_count);
+    m_max_queued_count = std::max<size_t>(1, max_queued_per_thread) * thread_count;
+
+    for(unsigned int worker = 0; worker < thread_count; ++worker)
+    {
+        m_queues.push_back(std::unique_ptr<Task_queue>(new Task_queue));
+    }
+
+    for(unsigned int worker = 0; worker < thread_count; ++worker)
+    {
+        m_threads.emplace_back(&Work_stealing_pool::run_worker, this, worker);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Finish every submitted task, then stop the workers.
+Work_stealing_pool::~Work_stealing_pool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_changed.notify_all();
+
+    for(auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+//---------------------------------------------------------------------------
+unsigned int Work_stealing_pool::thread_count() const
+{
+    return static_cast<unsigned int>(m_threads.size());
+}
+
+//---------------------------------------------------------------------------
+// Queue a task, waiting first if the queues are full.
+// Tasks are dealt to the workers' queues in turn.
+void Work_stealing_pool::submit(Task task)
+{
+    unsigned int queue;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return m_queued_count < m_max_queued_count; });
+
+        queue = m_next_queue;
+        m_next_queue = (m_next_queue + 1) % thread_count();
+        ++m_queued_count;
+        ++m_pending_count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_queues[queue]->mutex);
+        m_queues[queue]->tasks.push_back(std::move(task));
+    }
+
+    m_changed.notify_all();
+}
+
+//---------------------------------------------------------------------------
+// Wait until every submitted task has run.
+void Work_stealing_pool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this]() { return 0 == m_pending_count; });
+}
+
+//---------------------------------------------------------------------------
+// Take the newest task from the worker's own queue, which is the most likely
+// to still be in cache.  Otherwise steal the oldest task of another worker.
+bool Work_stealing_pool::try_pop(unsigned int worker, Task& task)
+{
+    {
+        Task_queue& own_queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(own_queue.mutex);
+        if(!own_queue.tasks.empty())
+        {
+            task = std::move(own_queue.tasks.back());
+            own_queue.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for(size_t offset = 1; offset < m_queues.size(); ++offset)
+    {
+        Task_queue& victim_queue = *m_queues[(worker + offset) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim_queue.mutex);
+        if(!victim_queue.tasks.empty())
+        {
+            task = std::move(victim_queue.tasks.front());
+            victim_queue.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//---------------------------------------------------------------------------
+void Work_stealing_pool::run_worker(unsigned int worker)
+{
+    Task task;
+
+    for(;;)
+    {
+        if(try_pop(worker, task))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_queued_count;
+            }
+            m_changed.notify_all();
+
+            task(worker);
+            task = nullptr;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_pending_count;
+            }
+            m_changed.notify_all();
+            continue;
+        }
+
+        // Sleep until a task is queued.  A task counted here may already be
+        // taken by another worker, in which case the loop comes back here.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return (m_queued_count > 0) || m_stopping; });
+        if(m_stopping && (0 == m_queued_count))
+        {
+            return;
+        }
+    }
+}
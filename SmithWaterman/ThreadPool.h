@@ -0,0 +1,55 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// Fixed set of worker threads that run submitted tasks.  Each worker has its
+// own queue, and takes its newest task first.  A worker with an empty queue
+// steals the oldest task from another worker's queue, so uneven tasks (e.g.
+// batches of database records of very different lengths) still keep every
+// worker busy.
+//
+// Tasks are given the index of the worker that runs them, so callers can
+// keep per-worker state (workspaces, partial results) without locking.
+// A task must not submit more tasks, since submit() may wait for a worker.
+class Work_stealing_pool
+{
+public:
+    typedef std::function<void(unsigned int worker)> Task;
+
+private:
+    struct Task_queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Task_queue>> m_queues;  // One per worker.
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;                     // Guards the counts below.
+    std::condition_variable m_changed;      // Signaled when a count changes.
+    size_t m_queued_count = 0;              // Tasks waiting in a queue.
+    size_t m_pending_count = 0;             // Tasks queued or running.
+    size_t m_max_queued_count;              // submit() blocks above this.
+    unsigned int m_next_queue = 0;          // Queue for the next submitted task.
+    bool m_stopping = false;
+
+    // Not implemented to prevent accidental copying/moving.
+    Work_stealing_pool(const Work_stealing_pool&) = delete;
+    Work_stealing_pool(Work_stealing_pool&&) noexcept = delete;
+    Work_stealing_pool& operator=(const Work_stealing_pool&) = delete;
+    Work_stealing_pool& operator=(Work_stealing_pool&&) noexcept = delete;
+
+    bool try_pop(unsigned int worker, Task& task);
+    void run_worker(unsigned int worker);
+
+public:
+    // A thread_count of 0 uses every hardware thread.  At most
+    // max_queued_per_thread tasks per thread wait in the queues, which
+    // bounds the memory held by a producer that outpaces the workers.
+    explicit Work_stealing_pool(unsigned int thread_count, size_t max_queued_per_thread = 4);
+    ~Work_stealing_pool();
+
+    unsigned int thread_count() const;
+    void submit(Task task);
+    void wait();
+};
@@ -0,0 +1,27 @@
+#include "PreCompile.h"
+#include "TraceBack.h"      // Pick up forward declarations to ensure correctness.
+
+//---------------------------------------------------------------------------
+void trace_node_strings(const std::vector<Trace_node>& nodes, size_t first_node, std::string& aligned1, std::string& aligned2)
+{
+    aligned1.clear();
+    aligned2.clear();
+
+    // The trace back ends at the start of the alignment, and each node links to
+    // the pair after it, so following the links gives the alignment in order.
+    for(size_t node = first_node; node != no_trace_node; node = nodes[node].next)
+    {
+        aligned1.push_back(nodes[node].residue1);
+        aligned2.push_back(nodes[node].residue2);
+    }
+}
+
+//---------------------------------------------------------------------------
+void print_trace_nodes(std::ostream& output_stream, const std::vector<Trace_node>& nodes, size_t first_node)
+{
+    std::string aligned1;
+    std::string aligned2;
+    trace_node_strings(nodes, first_node, aligned1, aligned2);
+
+    output_stream << aligned1 << "\n" << aligned2 << "\n";
+}
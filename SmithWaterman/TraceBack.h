@@ -0,0 +1,146 @@
+#pragma once
+
+#include "ScorePolicy.h"
+
+//---------------------------------------------------------------------------
+// Directions recorded for each cell of a score table.  A cell may have several,
+// one for each neighbor that produced its score (co-optimal alignments branch there).
+constexpr uint8_t trace_diagonal = 1;
+constexpr uint8_t trace_above = 2;
+constexpr uint8_t trace_left = 4;
+
+// Return the directions to the neighbors that produced score.
+// Matching scores are not expected to be less than 0, but don't follow a trace of 0's.
+inline uint8_t trace_directions(int score, int diagonal_score, int above_score, int left_score)
+{
+    uint8_t directions = 0;
+    if(score > 0)
+    {
+        directions |= (diagonal_score == score) ? trace_diagonal : 0;
+        directions |= (above_score == score) ? trace_above : 0;
+        directions |= (left_score == score) ? trace_left : 0;
+    }
+
+    return directions;
+}
+
+//---------------------------------------------------------------------------
+// One residue pair of a trace back, linked to the pair after it in the alignment.
+struct Trace_node
+{
+    char residue1;      // residue on j axis
+    char residue2;      // residue on i axis
+    size_t next;        // node of the following pair, or no_trace_node
+};
+
+// Node index that marks the end cell of a trace back.
+constexpr size_t no_trace_node = SIZE_MAX;
+
+// Collect the residues of the alignment that starts at first_node.
+void trace_node_strings(const std::vector<Trace_node>& nodes, size_t first_node, std::string& aligned1, std::string& aligned2);
+
+// Print the alignment that starts at first_node.
+void print_trace_nodes(std::ostream& output_stream, const std::vector<Trace_node>& nodes, size_t first_node);
+
+//---------------------------------------------------------------------------
+// Visit the alignments traced back from one cell of a score table, where
+// directions_at(row, column) returns the trace directions of a cell (0 at the
+// start of an alignment).  Each is passed to
+//      visit_alignment(nodes, first_node, begin_row, begin_column)
+// where the cell (begin_row, begin_column) is just before its first pair.
+// Visits at most max_alignments alignments (0 for no limit), and returns the
+// number visited.
+//
+// The trace is walked with an explicit stack rather than recursion, so long
+// alignments cannot overflow the call stack.  Each residue pair is stored once as a
+// node linked to the pair after it, so branches share the path back to the branch point.
+template<typename Directions_at, typename Visit_alignment>
+size_t visit_trace_backs(
+    const std::string& sequence1,
+    const std::string& sequence2,
+    size_t row,
+    size_t column,
+    size_t max_alignments,
+    Directions_at directions_at,
+    Visit_alignment visit_alignment)
+{
+    struct pending_trace
+    {
+        size_t row;
+        size_t column;
+        size_t node;        // Last pair added on the way to this cell.
+    };
+
+    std::vector<Trace_node> nodes;
+    std::vector<pending_trace> pending(1, pending_trace { row, column, no_trace_node });
+    size_t alignment_count = 0;
+
+    while(!pending.empty())
+    {
+        const pending_trace trace = pending.back();
+        pending.pop_back();
+
+        // Base cases have no directions, and scores of 0 are not followed.
+        const uint8_t directions = directions_at(trace.row, trace.column);
+
+        // If there is nowhere to go, then the end of the local alignment has been reached.
+        if(0 == directions)
+        {
+            visit_alignment(nodes, trace.node, trace.row, trace.column);
+            if(++alignment_count == max_alignments)
+            {
+                break;
+            }
+
+            // Only nodes on the paths of pending traces are needed from here on.
+            // Nodes are created in stack order, so they are all before the top's node.
+            nodes.resize(pending.empty() ? 0 : pending.back().node + 1);
+            continue;
+        }
+
+        // Push the directions in reverse order, so that they are followed
+        // above first, then left, then diagonal.
+        const char residue1 = sequence1[trace.column - 1];
+        const char residue2 = sequence2[trace.row - 1];
+
+        if(directions & trace_diagonal)
+        {
+            nodes.push_back(Trace_node { residue1, residue2, trace.node });
+            pending.push_back(pending_trace { trace.row - 1, trace.column - 1, nodes.size() - 1 });
+        }
+
+        if(directions & trace_left)
+        {
+            nodes.push_back(Trace_node { residue1, gap_character, trace.node });
+            pending.push_back(pending_trace { trace.row, trace.column - 1, nodes.size() - 1 });
+        }
+
+        if(directions & trace_above)
+        {
+            nodes.push_back(Trace_node { gap_character, residue2, trace.node });
+            pending.push_back(pending_trace { trace.row - 1, trace.column, nodes.size() - 1 });
+        }
+    }
+
+    return alignment_count;
+}
+
+//---------------------------------------------------------------------------
+// Print the alignments traced back from one cell, as visit_trace_backs visits
+// them, and return the number printed.
+template<typename Directions_at>
+size_t print_trace_backs(
+    std::ostream& output_stream,
+    const std::string& sequence1,
+    const std::string& sequence2,
+    size_t row,
+    size_t column,
+    size_t max_alignments,
+    Directions_at directions_at)
+{
+    return visit_trace_backs(sequence1, sequence2, row, column, max_alignments, directions_at,
+        [&output_stream](const std::vector<Trace_node>& nodes, size_t first_node, size_t, size_t)
+    {
+        print_trace_nodes(output_stream, nodes, first_node);
+    });
+}
@@ -8,6 +8,15 @@
 #include "PreCompile.h"
 #include "ScorePolicy.h"
 #include "SmithWaterman.h"
+#include "LinearScore.h"
+#include "BatchScore.h"
+#include "Hirschberg.h"
+#include "DatabaseSearch.h"
+#include "BandedAlignment.h"
+#include "NucleotideSearch.h"
+#include "PairwiseScores.h"
+#include "ProfileHmm.h"
+#include <Shared/fasta.h>
 
 //---------------------------------------------------------------------------
 // These sample hemoglobins were taken from ExPASy.org/SwissProt.
@@ -50,8 +59,268 @@ static std::string INSL3_HUMAN("MDPRLPAWALVLLGPALVFALGPAPTPEMREKLCGHHFVRALVRVCGG
                                "TQQDLLTLCPY");
 
 //---------------------------------------------------------------------------
-int main()
+// Search each query of a FASTA file against every record of a database, and
+// print the best hits of each query.  The database is either a FASTA file, or
+// a seed index written by write_index_file, in which case only the records
+// that pass the seed filter are aligned.
+//
+// The format is "text" for printed alignments, "tsv", "sam" or "binary" for
+// one result per line (or record), or "scores" for TSV without trace backs.
+static int search_database_files(const char* query_filename, const char* database_filename, size_t top_count, const std::string& format, unsigned int thread_count)
 {
+    std::ifstream query_file(query_filename);
+    std::ifstream database_file(database_filename, std::ifstream::binary);
+    if(!query_file || !database_file)
+    {
+        std::cerr << "Unable to open " << (!query_file ? query_filename : database_filename) << ".\n";
+        return 1;
+    }
+
+    static const std::pair<const char*, Result_format> result_formats[] =
+    {
+        { "tsv", Result_format::tsv },
+        { "scores", Result_format::tsv },
+        { "sam", Result_format::sam },
+        { "binary", Result_format::binary },
+    };
+
+    const auto result_format = std::find_if(std::begin(result_formats), std::end(result_formats), [&format](const std::pair<const char*, Result_format>& entry)
+    {
+        return format == entry.first;
+    });
+
+    if((format != "text") && (result_format == std::end(result_formats)))
+    {
+        std::cerr << "Unknown output format " << format << ".\n";
+        return 1;
+    }
+
+    std::vector<std::string> query_names;
+    std::vector<std::string> queries;
+
+    Fasta_reader reader(query_file);
+    Fasta_record record;
+    while(reader.read_record(record))
+    {
+        query_names.push_back(std::move(record.name));
+        queries.push_back(std::move(record.sequence));
+    }
+
+    const bool trace_back = (format != "scores");
+    const Seed_index index(database_filename);
+    const auto results = index.is_valid() ?
+        search_database(index, queries, &BLOSUM62_calc_score<-4>, top_count, thread_count, Seed_options(), trace_back) :
+        search_database(database_file, queries, &BLOSUM62_calc_score<-4>, top_count, thread_count, trace_back);
+
+    if(format == "text")
+    {
+        for(size_t query = 0; query < queries.size(); ++query)
+        {
+            print_database_hits(std::cout, query_names[query], results[query]);
+        }
+    }
+    else
+    {
+        Result_writer writer(std::cout, result_format->second);
+        for(size_t query = 0; query < queries.size(); ++query)
+        {
+            write_database_hits(writer, query_names[query], results[query]);
+        }
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Write a seed index of a FASTA database, for later searches to map.
+static int write_index_file(const char* database_filename, const char* index_filename, size_t word_length)
+{
+    std::ifstream database_file(database_filename);
+    if(!database_file)
+    {
+        std::cerr << "Unable to open " << database_filename << ".\n";
+        return 1;
+    }
+
+    if(!Seed_index::write(database_file, index_filename, word_length))
+    {
+        std::cerr << "Unable to write " << index_filename << ".\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Print every occurrence of a nucleotide pattern in either strand of a genome,
+// within max_distance edits.  Positions are one-based and inclusive, on the
+// forward strand.
+static int search_genome_file(const char* genome_filename, const std::string& pattern, int max_distance)
+{
+    const std::string genome = read_fasta_file(genome_filename);
+    if(genome.empty())
+    {
+        std::cerr << "Unable to read " << genome_filename << ".\n";
+        return 1;
+    }
+
+    // Search the reverse strand with the reverse complement of the pattern,
+    // so only one strand of the genome is packed.
+    const Packed_genome packed_genome(genome);
+    const std::string strand_patterns[] = { pattern, reverse_complement(pattern) };
+    const char strands[] = { '+', '-' };
+
+    for(size_t strand = 0; strand < 2; ++strand)
+    {
+        const Bit_parallel_pattern searcher(strand_patterns[strand]);
+        for(const auto& occurrence : searcher.search(packed_genome, max_distance))
+        {
+            std::cout << strands[strand] << '\t' << (occurrence.begin + 1) << '\t' << occurrence.end << '\t'
+                      << occurrence.distance << '\t' << packed_genome.substring(occurrence.begin, occurrence.end) << '\n';
+        }
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Write the score matrix of every pair of sequences in a FASTA file, as TSV
+// or binary, with p-values if pvalue_samples is not 0.
+static int write_score_matrix_file(const char* sequences_filename, const char* matrix_filename, const std::string& format, unsigned int pvalue_samples, unsigned int thread_count, uint32_t seed)
+{
+    std::ifstream sequences_file(sequences_filename);
+    if(!sequences_file)
+    {
+        std::cerr << "Unable to open " << sequences_filename << ".\n";
+        return 1;
+    }
+
+    if((format != "tsv") && (format != "binary"))
+    {
+        std::cerr << "Unknown matrix format " << format << ".\n";
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::string> sequences;
+
+    Fasta_reader reader(sequences_file);
+    Fasta_record record;
+    while(reader.read_record(record))
+    {
+        names.push_back(std::move(record.name));
+        sequences.push_back(std::move(record.sequence));
+    }
+
+    const Score_matrix matrix = all_vs_all_scores(sequences, &BLOSUM62_calc_score<-4>, thread_count, pvalue_samples, seed);
+
+    std::ofstream matrix_file(matrix_filename, std::ofstream::binary);
+    if(format == "tsv")
+    {
+        matrix.write_tsv(matrix_file, names);
+    }
+    else
+    {
+        matrix.write_binary(matrix_file, names);
+    }
+
+    if(!matrix_file)
+    {
+        std::cerr << "Unable to write " << matrix_filename << ".\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Build a profile HMM from an aligned FASTA file of a family, and print the
+// records of a database that it finds.
+static int search_hmm_file(const char* alignment_filename, const char* database_filename, unsigned int thread_count, uint32_t seed)
+{
+    std::ifstream alignment_file(alignment_filename);
+    if(!alignment_file)
+    {
+        std::cerr << "Unable to open " << alignment_filename << ".\n";
+        return 1;
+    }
+
+    std::vector<std::string> alignment;
+
+    Fasta_reader reader(alignment_file);
+    Fasta_record record;
+    while(reader.read_record(record))
+    {
+        alignment.push_back(std::move(record.sequence));
+    }
+
+    const Profile_hmm model(alignment, seed);
+    if(!model.is_valid())
+    {
+        std::cerr << alignment_filename << " is not a multiple alignment.\n";
+        return 1;
+    }
+
+    std::ifstream database_file(database_filename);
+    if(!database_file)
+    {
+        std::cerr << "Unable to open " << database_filename << ".\n";
+        return 1;
+    }
+
+    Hmm_search_statistics statistics;
+    const std::vector<Hmm_hit> hits = search_profile_hmm(model, database_file, Hmm_search_options(), thread_count, statistics);
+    print_hmm_hits(std::cout, hits, statistics);
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// With no arguments, align the sample hemoglobins.
+// With "query.fasta database [top_count [format]]", search a protein database (FASTA or seed index).
+// With "--index database.fasta database.index [word_length]", write a seed index.
+// With "--genome genome.fna pattern max_distance", search a genome for a nucleotide pattern.
+// With "--all-vs-all sequences.fasta matrix_file tsv|binary [pvalue_samples]", score every pair.
+// With "--hmm alignment.fasta database.fasta", search a database with a profile HMM of a family.
+int main(int argc, char* argv[])
+{
+    // Spread p-value permutations over every hardware thread.  The seed fixes
+    // the permutations, so the p-values do not depend on the thread count.
+    constexpr unsigned int thread_count = 0;
+    constexpr uint32_t seed = 5489;
+
+    // Print every co-optimal alignment.
+    constexpr size_t max_alignments = 0;
+
+    if((argc >= 4) && (std::string(argv[1]) == "--index"))
+    {
+        const size_t word_length = (argc >= 5) ? std::strtoul(argv[4], nullptr, 10) : 3;
+        return write_index_file(argv[2], argv[3], word_length);
+    }
+
+    if((argc >= 5) && (std::string(argv[1]) == "--genome"))
+    {
+        return search_genome_file(argv[2], argv[3], std::atoi(argv[4]));
+    }
+
+    if((argc >= 5) && (std::string(argv[1]) == "--all-vs-all"))
+    {
+        const unsigned int pvalue_samples = (argc >= 6) ? std::strtoul(argv[5], nullptr, 10) : 0;
+        return write_score_matrix_file(argv[2], argv[3], argv[4], pvalue_samples, thread_count, seed);
+    }
+
+    if((argc >= 4) && (std::string(argv[1]) == "--hmm"))
+    {
+        return search_hmm_file(argv[2], argv[3], thread_count, seed);
+    }
+
+    if(argc >= 3)
+    {
+        const size_t top_count = (argc >= 4) ? std::strtoul(argv[3], nullptr, 10) : 10;
+        const std::string format = (argc >= 5) ? argv[4] : "text";
+        return search_database_files(argv[1], argv[2], top_count, format, thread_count);
+    }
+
 #ifndef NDEBUG
     // Exercise the local alignment algorithm with sample vectors.
     {
@@ -63,7 +332,65 @@ int main()
 
         table.print_table(std::cout);
 
-        table.print_trace_back(std::cout);
+        table.print_trace_back(std::cout, max_alignments);
+
+        // The score-only kernels must agree with the full table.
+        Score_workspace workspace;
+        const Striped_profile profile(test_vector1, test_vector2, &basic_calc_score);
+        assert(profile.max_score(test_vector2, workspace) == table.max_score());
+        assert(linear_max_score(test_vector1, test_vector2, &basic_calc_score, workspace) == table.max_score());
+
+        const Batch_profile batch_profile(test_vector1, test_vector2, &basic_calc_score);
+        const std::vector<std::string> targets(3, test_vector2);
+        assert(batch_profile.max_scores(targets, workspace) == std::vector<int>(3, table.max_score()));
+
+        // A policy type builds the same table as its function.
+        Alignment_table policy_table(test_vector1, test_vector2, Basic_score_policy());
+        assert(policy_table.max_score() == table.max_score());
+
+        // The linear space aligner finds one of the optimal alignments.
+        std::cout << "Linear space alignment:\n";
+        const Local_alignment alignment = linear_space_align(test_vector1, test_vector2, &basic_calc_score);
+        assert(alignment.score == table.max_score());
+        print_local_alignment(std::cout, alignment);
+
+        // The best non-overlapping alignment is an optimal one, and ends at an optimal cell.
+        const std::vector<Local_alignment> alignments = table.top_alignments(3);
+        assert(!alignments.empty() && alignments[0].score == table.max_score());
+        assert(alignments[0].end1 == table.max_score_cells()[0].column);
+        assert(alignments[0].end2 == table.max_score_cells()[0].row);
+
+        // The structured results match the printed trace backs.
+        const std::vector<Local_alignment> co_optimal = table.co_optimal_alignments(0);
+        assert(co_optimal.size() == 2);
+        assert(co_optimal[0].aligned1 == "c-de" && co_optimal[0].aligned2 == "cxde");
+        assert(alignment_cigar(co_optimal[0]) == "1M1I2M");
+        assert(table.alignment_results(1)[0].score == table.max_score());
+        assert(table.score_at(table.max_score_cells()[0].row, table.max_score_cells()[0].column) == table.max_score());
+    }
+
+    // The bit-parallel nucleotide search finds a one-edit occurrence of a pattern.
+    {
+        const Packed_genome genome("TTGACCTAGGTACGNNTT");
+        const auto occurrences = Bit_parallel_pattern("CCTAGCTA").search(genome, 1);
+        assert(occurrences.size() == 1);
+        assert(occurrences[0].begin == 4 && occurrences[0].end == 12 && occurrences[0].distance == 1);
+        assert(genome.substring(12, 16) == "CGNN");
+        assert(reverse_complement("ACGTN") == "NACGT");
+    }
+
+    // A profile HMM of the beta globins finds a beta globin, but not an unrelated protein.
+    {
+        const std::vector<std::string> alignment = { HBB_HUMAN, HBB_PANTR, HBB1_MOUSE, HBB_CHICK };
+        const Profile_hmm model(alignment, seed);
+        assert(model.is_valid() && model.length() == HBB_HUMAN.size());
+
+        Score_workspace workspace;
+        const Hmm_search_options options;
+        assert(model.msv_pvalue(model.msv_score(Q802A3_FUGRU, workspace)) <= options.msv_pvalue);
+        assert(model.viterbi_pvalue(model.viterbi_score(Q802A3_FUGRU, workspace)) <= options.viterbi_pvalue);
+        assert(model.forward_pvalue(model.forward_score(Q802A3_FUGRU, workspace)) <= options.report_pvalue);
+        assert(model.forward_pvalue(model.forward_score(INSL3_HUMAN, workspace)) > options.report_pvalue);
     }
 #endif
 
@@ -72,62 +399,85 @@ int main()
         static std::string sequence2("ddgearlyk");
 
         std::cout << "\nAligning " << sequence1 << " and " << sequence2 << ":\n";
-        Alignment_table table(sequence1, sequence2, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(sequence1, sequence2, BLOSUM62_score_policy<-4>());
 
         table.print_table(std::cout);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, 1000);
+        table.print_trace_back(std::cout, max_alignments);
+
+        std::cout << "Non-overlapping alignments:\n";
+        for(const Local_alignment& alignment : table.top_alignments(3))
+        {
+            print_local_alignment(std::cout, alignment);
+        }
+
+        table.calc_pvalue(std::cout, 1000, thread_count, seed);
     }
 
-    constexpr unsigned int num_permutations = 10000;
+    // Stop drawing permutations once the p-value is settled, and fit the
+    // permutation scores for p-values too small to count.
+    Pvalue_options pvalue_options;
+    pvalue_options.max_permutations = 10000;
 
     {
         std::cout << "\nAligning  HBB_HUMAN and HBB_PANTR:\n";
-        Alignment_table table(HBB_HUMAN, HBB_PANTR, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(HBB_HUMAN, HBB_PANTR, BLOSUM62_score_policy<-4>(), thread_count);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, num_permutations);
+        table.print_trace_back(std::cout, max_alignments);
+
+#ifndef NDEBUG
+        // Close homologs stay near the diagonal, so a narrow band and X-drop find the same score.
+        Band_options band_options;
+        const Banded_alignment_table banded_table(HBB_HUMAN, HBB_PANTR, BLOSUM62_score_policy<-4>(), band_options);
+        assert(banded_table.max_score() == table.max_score());
+
+        band_options.band_width = 0;
+        band_options.x_drop = 20;
+        const Banded_alignment_table x_drop_table(HBB_HUMAN, HBB_PANTR, BLOSUM62_score_policy<-4>(), band_options);
+        assert(x_drop_table.max_score() == table.max_score());
+        assert(x_drop_table.computed_cell_count() < HBB_HUMAN.size() * HBB_PANTR.size());
+#endif
+        table.calc_adaptive_pvalue(std::cout, pvalue_options, thread_count, seed);
     }
 
     {
         std::cout << "\nAligning and HBB1_MOUSE:\n";
-        Alignment_table table(HBB_HUMAN, HBB1_MOUSE, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(HBB_HUMAN, HBB1_MOUSE, BLOSUM62_score_policy<-4>(), thread_count);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, num_permutations);
+        table.print_trace_back(std::cout, max_alignments);
+        table.calc_adaptive_pvalue(std::cout, pvalue_options, thread_count, seed);
     }
 
     {
         std::cout << "\nAligning HBB_HUMAN and HBB_CHICK:\n";
-        Alignment_table table(HBB_HUMAN, HBB_CHICK, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(HBB_HUMAN, HBB_CHICK, BLOSUM62_score_policy<-4>(), thread_count);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, num_permutations);
+        table.print_trace_back(std::cout, max_alignments);
+        table.calc_adaptive_pvalue(std::cout, pvalue_options, thread_count, seed);
     }
 
     {
         std::cout << "\nAligning HBB_HUMAN and Q802A3_FUGRU:\n";
-        Alignment_table table(HBB_HUMAN, Q802A3_FUGRU, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(HBB_HUMAN, Q802A3_FUGRU, BLOSUM62_score_policy<-4>(), thread_count);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, num_permutations);
+        table.print_trace_back(std::cout, max_alignments);
+        table.calc_adaptive_pvalue(std::cout, pvalue_options, thread_count, seed);
     }
 
     {
         std::cout << "\nAligning HBB_HUMAN and Q540F0_VIGUN:\n";
-        Alignment_table table(HBB_HUMAN, Q540F0_VIGUN, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(HBB_HUMAN, Q540F0_VIGUN, BLOSUM62_score_policy<-4>(), thread_count);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, num_permutations);
+        table.print_trace_back(std::cout, max_alignments);
+        table.calc_adaptive_pvalue(std::cout, pvalue_options, thread_count, seed);
     }
 
     {
         std::cout << "\nAligning HBB_HUMAN and INSL3_HUMAN:\n";
-        Alignment_table table(HBB_HUMAN, INSL3_HUMAN, &BLOSUM62_calc_score<-4>);
+        Alignment_table table(HBB_HUMAN, INSL3_HUMAN, BLOSUM62_score_policy<-4>(), thread_count);
 
-        table.print_trace_back(std::cout);
-        table.calc_pvalue(std::cout, num_permutations);
+        table.print_trace_back(std::cout, max_alignments);
+        table.calc_adaptive_pvalue(std::cout, pvalue_options, thread_count, seed);
     }
 
     std::cout << "Program done." << std::endl;
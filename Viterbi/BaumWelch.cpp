@@ -0,0 +1,394 @@
+#include "PreCompile.h"
+#include "BaumWelch.h"      // Pick up forward declarations to ensure correctness.
+#include <Shared/Threads.h>
+
+//---------------------------------------------------------------------------
+// The parameters, laid out for the passes.  Each column of the passes is
+// state-contiguous, and the loops over the states it computes are innermost,
+// so the compiler can vectorise them.
+struct Forward_backward_model
+{
+    size_t rows;                                    // Number of states.
+    size_t emission_count;                          // Number of potential emissions.
+    const std::vector<double>& initial_probabilities;
+    const std::vector<double>& edges;               // [from x to] matrix of edge probabilities.
+    std::vector<double> emissions;                  // [emission x row] matrix of emission probabilities.
+    size_t (*emission_index)(char);
+
+    const double* emissions_of(char emission) const
+    {
+        return &emissions[emission_index(emission) * rows];
+    }
+};
+
+//---------------------------------------------------------------------------
+// Columns [begin, end) of one sequence.
+struct Sequence_chunk
+{
+    size_t sequence;
+    size_t begin;
+    size_t end;
+};
+
+//---------------------------------------------------------------------------
+// Expected number of times each parameter is used.
+struct Expected_counts
+{
+    std::vector<double> initial;    // [row]
+    std::vector<double> edges;      // [from x to]
+    std::vector<double> emissions;  // [row x emission]
+};
+
+//---------------------------------------------------------------------------
+// Scale probabilities to sum to one, and return the log of the scale.
+static double normalize(double* probabilities, size_t count)
+{
+    double sum = 0.0;
+    for(size_t ii = 0; ii < count; ++ii)
+    {
+        sum += probabilities[ii];
+    }
+
+    // Zero means the sequence cannot be emitted by the model.
+    assert(sum > 0.0);
+
+    for(size_t ii = 0; ii < count; ++ii)
+    {
+        probabilities[ii] /= sum;
+    }
+
+    return log(sum);
+}
+
+//---------------------------------------------------------------------------
+// Forward probabilities of a column from those of the column before it.
+static void forward_column(const Forward_backward_model& model, const double* previous, char emission, double* next)
+{
+    const size_t rows = model.rows;
+    std::fill(next, next + rows, 0.0);
+
+    for(size_t ii = 0; ii < rows; ++ii)
+    {
+        const double prob = previous[ii];
+        const double* edges = &model.edges[ii * rows];
+        for(size_t jj = 0; jj < rows; ++jj)
+        {
+            next[jj] += prob * edges[jj];
+        }
+    }
+
+    const double* emissions = model.emissions_of(emission);
+    for(size_t jj = 0; jj < rows; ++jj)
+    {
+        next[jj] *= emissions[jj];
+    }
+}
+
+//---------------------------------------------------------------------------
+// Normalize each row of counts into probabilities.  A row that was never
+// used keeps its old probabilities.
+static void update_probabilities(const std::vector<double>& counts, size_t columns, std::vector<double>& probabilities)
+{
+    for(size_t row = 0; row < counts.size() / columns; ++row)
+    {
+        double sum = 0.0;
+        for(size_t column = 0; column < columns; ++column)
+        {
+            sum += counts[row * columns + column];
+        }
+
+        if(sum > 0.0)
+        {
+            for(size_t column = 0; column < columns; ++column)
+            {
+                probabilities[row * columns + column] = counts[row * columns + column] / sum;
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+double baum_welch_step(
+    const std::vector<std::string>& sequences,
+    std::vector<double>& initial_probabilities,
+    std::vector<double>& edges,
+    std::vector<double>& emission_probabilities,
+    size_t (*emission_index)(char),
+    const Baum_welch_options& options)
+{
+    const size_t rows = initial_probabilities.size();
+    Forward_backward_model model = { rows, emission_probabilities.size() / rows, initial_probabilities, edges, {}, emission_index };
+    assert(edges.size() == rows * rows);
+    assert(emission_probabilities.size() == rows * model.emission_count);
+
+    model.emissions.resize(emission_probabilities.size());
+    for(size_t ii = 0; ii < rows; ++ii)
+    {
+        for(size_t ee = 0; ee < model.emission_count; ++ee)
+        {
+            model.emissions[ee * rows + ii] = emission_probabilities[ii * model.emission_count + ee];
+        }
+    }
+
+    // Split the sequences into chunks of about options.chunk_size columns.
+    std::vector<Sequence_chunk> chunks;
+    for(size_t sequence = 0; sequence < sequences.size(); ++sequence)
+    {
+        const size_t length = sequences[sequence].length();
+        const size_t chunk_count = (length + std::max<size_t>(1, options.chunk_size) - 1) / std::max<size_t>(1, options.chunk_size);
+        for(size_t chunk = 0; chunk < chunk_count; ++chunk)
+        {
+            chunks.push_back({ sequence, chunk * length / chunk_count, (chunk + 1) * length / chunk_count });
+        }
+    }
+
+    // Find the transfer matrix of each chunk: row a holds the forward
+    // probabilities at its last column, given state a before its first.
+    // The first chunk of a sequence starts from the initial probabilities,
+    // so its "matrix" is one row.  The whole matrix shares one scale.
+    std::vector<std::vector<double>> transfers(chunks.size());
+    std::vector<double> transfer_log_scales(chunks.size());
+    run_tasks(chunks.size(), options.thread_count, [&](size_t ix)
+    {
+        const Sequence_chunk& chunk = chunks[ix];
+        const std::string& sequence = sequences[chunk.sequence];
+        std::vector<double>& transfer = transfers[ix];
+
+        const double* emissions = model.emissions_of(sequence[chunk.begin]);
+        const size_t start_count = (0 == chunk.begin) ? 1 : rows;
+        transfer.resize(start_count * rows);
+        for(size_t start = 0; start < start_count; ++start)
+        {
+            for(size_t jj = 0; jj < rows; ++jj)
+            {
+                const double prob = (0 == chunk.begin) ? initial_probabilities[jj] : edges[start * rows + jj];
+                transfer[start * rows + jj] = prob * emissions[jj];
+            }
+        }
+
+        double log_scale = normalize(&transfer[0], transfer.size());
+
+        std::vector<double> next_transfer(transfer.size());
+        for(size_t column = chunk.begin + 1; column < chunk.end; ++column)
+        {
+            for(size_t start = 0; start < start_count; ++start)
+            {
+                forward_column(model, &transfer[start * rows], sequence[column], &next_transfer[start * rows]);
+            }
+
+            transfer.swap(next_transfer);
+            log_scale += normalize(&transfer[0], transfer.size());
+        }
+
+        transfer_log_scales[ix] = log_scale;
+    });
+
+    // Link the chunks of each sequence.  The forward probabilities at the end
+    // of each chunk are those at the end of the chunk before it times the
+    // chunk's matrix, and the backward probabilities are the matrix times
+    // those at the end of the chunk after it.  Both are scaled to sum to one.
+    std::vector<double> forward_boundaries(chunks.size() * rows);
+    std::vector<double> backward_boundaries(chunks.size() * rows);
+    double log_likelihood = 0.0;
+    for(size_t first = 0; first < chunks.size();)
+    {
+        size_t last = first + 1;
+        while((last < chunks.size()) && (chunks[last].sequence == chunks[first].sequence))
+        {
+            ++last;
+        }
+
+        std::copy(transfers[first].cbegin(), transfers[first].cend(), forward_boundaries.begin() + first * rows);
+        log_likelihood += transfer_log_scales[first];
+        for(size_t ix = first + 1; ix < last; ++ix)
+        {
+            const double* previous = &forward_boundaries[(ix - 1) * rows];
+            for(size_t jj = 0; jj < rows; ++jj)
+            {
+                double prob = 0.0;
+                for(size_t aa = 0; aa < rows; ++aa)
+                {
+                    prob += previous[aa] * transfers[ix][aa * rows + jj];
+                }
+
+                forward_boundaries[ix * rows + jj] = prob;
+            }
+
+            log_likelihood += transfer_log_scales[ix] + normalize(&forward_boundaries[ix * rows], rows);
+        }
+
+        // Nothing follows the last column, so its backward probabilities are all one.
+        std::fill(backward_boundaries.begin() + (last - 1) * rows, backward_boundaries.begin() + last * rows, 1.0 / rows);
+        for(size_t ix = last - 1; ix > first; --ix)
+        {
+            const double* next = &backward_boundaries[ix * rows];
+            for(size_t aa = 0; aa < rows; ++aa)
+            {
+                double prob = 0.0;
+                for(size_t jj = 0; jj < rows; ++jj)
+                {
+                    prob += transfers[ix][aa * rows + jj] * next[jj];
+                }
+
+                backward_boundaries[(ix - 1) * rows + aa] = prob;
+            }
+
+            normalize(&backward_boundaries[(ix - 1) * rows], rows);
+        }
+
+        first = last;
+    }
+
+    // Run forward-backward over each chunk from its boundaries, and sum the
+    // posterior probabilities of each state (emissions) and each pair of
+    // states (edges) in each column.  Posteriors sum to one in each column,
+    // so the scales of the forward and backward probabilities cancel out.
+    std::vector<Expected_counts> counts(chunks.size());
+    run_tasks(chunks.size(), options.thread_count, [&](size_t ix)
+    {
+        const Sequence_chunk& chunk = chunks[ix];
+        const std::string& sequence = sequences[chunk.sequence];
+        const double* start = (0 == chunk.begin) ? nullptr : &forward_boundaries[(ix - 1) * rows];
+
+        Expected_counts& chunk_counts = counts[ix];
+        chunk_counts.initial.resize(rows);
+        chunk_counts.edges.resize(rows * rows);
+        chunk_counts.emissions.resize(rows * model.emission_count);
+
+        std::vector<double> forward((chunk.end - chunk.begin) * rows);
+        if(nullptr == start)
+        {
+            const double* emissions = model.emissions_of(sequence[0]);
+            for(size_t jj = 0; jj < rows; ++jj)
+            {
+                forward[jj] = initial_probabilities[jj] * emissions[jj];
+            }
+        }
+        else
+        {
+            forward_column(model, start, sequence[chunk.begin], &forward[0]);
+        }
+
+        normalize(&forward[0], rows);
+        for(size_t column = chunk.begin + 1; column < chunk.end; ++column)
+        {
+            const size_t offset = (column - chunk.begin) * rows;
+            forward_column(model, &forward[offset - rows], sequence[column], &forward[offset]);
+            normalize(&forward[offset], rows);
+        }
+
+        std::vector<double> backward(backward_boundaries.cbegin() + ix * rows, backward_boundaries.cbegin() + (ix + 1) * rows);
+        std::vector<double> previous_backward(rows);
+        std::vector<double> weighted_backward(rows);
+        for(size_t column = chunk.end; column-- > chunk.begin;)
+        {
+            const double* column_forward = &forward[(column - chunk.begin) * rows];
+
+            double sum = 0.0;
+            for(size_t ii = 0; ii < rows; ++ii)
+            {
+                sum += column_forward[ii] * backward[ii];
+            }
+
+            double* emission_counts = &chunk_counts.emissions[emission_index(sequence[column])];
+            for(size_t ii = 0; ii < rows; ++ii)
+            {
+                const double posterior = column_forward[ii] * backward[ii] / sum;
+                emission_counts[ii * model.emission_count] += posterior;
+                if(0 == column)
+                {
+                    chunk_counts.initial[ii] += posterior;
+                }
+            }
+
+            if(0 == column)
+            {
+                break;
+            }
+
+            // Edges into this column, and the backward probabilities of the column before it.
+            const double* forward_before = (column > chunk.begin) ? column_forward - rows : start;
+            const double* emissions = model.emissions_of(sequence[column]);
+            for(size_t jj = 0; jj < rows; ++jj)
+            {
+                weighted_backward[jj] = emissions[jj] * backward[jj];
+            }
+
+            double edge_sum = 0.0;
+            for(size_t ii = 0; ii < rows; ++ii)
+            {
+                const double* edge_probs = &edges[ii * rows];
+                double prob = 0.0;
+                for(size_t jj = 0; jj < rows; ++jj)
+                {
+                    prob += edge_probs[jj] * weighted_backward[jj];
+                }
+
+                previous_backward[ii] = prob;
+                edge_sum += forward_before[ii] * prob;
+            }
+
+            for(size_t ii = 0; ii < rows; ++ii)
+            {
+                const double scale = forward_before[ii] / edge_sum;
+                const double* edge_probs = &edges[ii * rows];
+                double* edge_counts = &chunk_counts.edges[ii * rows];
+                for(size_t jj = 0; jj < rows; ++jj)
+                {
+                    edge_counts[jj] += scale * edge_probs[jj] * weighted_backward[jj];
+                }
+            }
+
+            backward.swap(previous_backward);
+            normalize(&backward[0], rows);
+        }
+    });
+
+    // Sum the counts in chunk order, and make them the new parameters.
+    Expected_counts total = { std::vector<double>(rows), std::vector<double>(rows * rows), std::vector<double>(rows * model.emission_count) };
+    for(const auto& chunk_counts : counts)
+    {
+        std::transform(total.initial.cbegin(), total.initial.cend(), chunk_counts.initial.cbegin(), total.initial.begin(), std::plus<double>());
+        std::transform(total.edges.cbegin(), total.edges.cend(), chunk_counts.edges.cbegin(), total.edges.begin(), std::plus<double>());
+        std::transform(total.emissions.cbegin(), total.emissions.cend(), chunk_counts.emissions.cbegin(), total.emissions.begin(), std::plus<double>());
+    }
+
+    update_probabilities(total.initial, rows, initial_probabilities);
+    update_probabilities(total.edges, rows, edges);
+    update_probabilities(total.emissions, model.emission_count, emission_probabilities);
+
+    return log_likelihood;
+}
+
+//---------------------------------------------------------------------------
+size_t train_baum_welch(
+    const std::vector<std::string>& sequences,
+    std::vector<double>& initial_probabilities,
+    std::vector<double>& edges,
+    std::vector<double>& emission_probabilities,
+    size_t (*emission_index)(char),
+    const Baum_welch_options& options,
+    std::ostream& output_stream)
+{
+    double previous_log_likelihood = -std::numeric_limits<double>::infinity();
+
+    size_t iteration = 0;
+    while(iteration < options.max_iterations)
+    {
+        const double log_likelihood = baum_welch_step(sequences, initial_probabilities, edges, emission_probabilities, emission_index, options);
+        ++iteration;
+
+        output_stream << "Baum-Welch iteration " << iteration << " log likelihood: " << log_likelihood << "\n";
+
+        // Each iteration can only raise the likelihood, so once it barely
+        // rises, the parameters have converged (to a local maximum).
+        if(log_likelihood - previous_log_likelihood <= options.tolerance * std::abs(log_likelihood))
+        {
+            break;
+        }
+
+        previous_log_likelihood = log_likelihood;
+    }
+
+    return iteration;
+}
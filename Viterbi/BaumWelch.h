@@ -0,0 +1,49 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// Options of Baum-Welch training.
+struct Baum_welch_options
+{
+    double tolerance = 1e-8;        // Stop when an iteration improves the log likelihood by less than this fraction of it.
+    size_t max_iterations = 500;    // Stop after this many iterations, even if the log likelihood has not converged.
+    size_t chunk_size = 1 << 16;    // Columns of a sequence given to one thread at a time.
+    unsigned int thread_count = 0;  // Threads of the E-step (0 for every hardware thread).
+};
+
+// One iteration of Baum-Welch (expectation maximization) training: the
+// expected number of times each edge and emission is used, given the
+// sequences, are found with the forward-backward algorithm, and become the
+// new parameters.  Returns the log likelihood of the sequences under the
+// parameters before the update.
+//
+// The forward and backward probabilities are scaled to sum to one in each
+// column, so sequences of any length neither underflow nor need logs.
+//
+// Every sequence is split into chunks of options.chunk_size columns, and the
+// chunks of every sequence are shared by the threads.  Each thread first
+// finds the transfer matrix of a chunk (the forward probabilities at its end,
+// for each state before it), which links the chunks in a short serial pass.
+// Each thread then runs forward-backward over a chunk from its exact boundary
+// probabilities, and the expected counts of the chunks are summed in order,
+// so the result does not depend on the number of threads.
+//
+// A transfer matrix takes as many forward passes as there are states, so
+// small chunks suit models with few states.
+double baum_welch_step(
+    const std::vector<std::string>& sequences,      // Training data.
+    std::vector<double>& initial_probabilities,     // Probabilities of transition from begin state.
+    std::vector<double>& edges,                     // Probabilities for each edge (transitions between states).
+    std::vector<double>& emission_probabilities,    // Probabilities for each emission for each model.
+    size_t (*emission_index)(char),                 // Function to map emission to an index in the probability vector.
+    const Baum_welch_options& options);
+
+// Repeat baum_welch_step() until the log likelihood converges, printing it
+// after each iteration.  Returns the number of iterations.
+size_t train_baum_welch(
+    const std::vector<std::string>& sequences,
+    std::vector<double>& initial_probabilities,
+    std::vector<double>& edges,
+    std::vector<double>& emission_probabilities,
+    size_t (*emission_index)(char),
+    const Baum_welch_options& options,
+    std::ostream& output_stream);
@@ -2,7 +2,16 @@
 
 #include <cassert>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
@@ -0,0 +1,237 @@
+#include "PreCompile.h"
+#include "StreamingViterbi.h"   // Pick up forward declarations to ensure correctness.
+#include <Shared/fasta.h>
+
+//---------------------------------------------------------------------------
+// Backpointers are bytes, so at most 256 states are supported.
+Streaming_viterbi::Streaming_viterbi(
+    const std::vector<double>& initial_probabilities,   // Probabilities of transition from begin state.
+    const std::vector<double>& edges,                   // Probabilities for each edge (transitions between states).
+    const std::vector<double>& emission_probabilities,  // Probabilities for each emission for each model.
+    size_t (*emission_index)(char))                     // Function to map emission to an index in the probability vector.
+    : m_previous_log_probs(initial_probabilities.size())
+    , m_current_log_probs(initial_probabilities.size())
+    , m_emission_index(emission_index)
+    , m_rows(initial_probabilities.size())
+    , m_best_rows_kernel(select_best_rows_kernel(m_rows))
+{
+    assert(m_rows <= UINT8_MAX + 1);
+
+    // The same log tables as Probability_table::update_log_tables(), with the
+    // edges [from x to] for the column kernel.
+    const size_t emission_count = emission_probabilities.size() / m_rows;
+
+    m_log_initial_probabilities.resize(m_rows);
+    m_log_edges_from.resize(m_rows * m_rows);
+    m_log_emissions.resize(emission_count * m_rows);
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        m_log_initial_probabilities[ii] = log(initial_probabilities[ii]);
+
+        for(size_t kk = 0; kk < m_rows; ++kk)
+        {
+            m_log_edges_from[kk * m_rows + ii] = log(edges[kk * m_rows + ii]);
+        }
+
+        for(size_t ee = 0; ee < emission_count; ++ee)
+        {
+            m_log_emissions[ee * m_rows + ii] = log(emission_probabilities[ii * emission_count + ee]);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+size_t Streaming_viterbi::backpointer_at(size_t row, size_t column) const
+{
+    return m_backpointers[(column - m_window_begin) * m_rows + row];
+}
+
+//---------------------------------------------------------------------------
+// Trace back from a known state, decode every column from the start of the
+// window to it, and free their backpointers.  Runs are held back until they
+// end, since the next columns may continue them.
+void Streaming_viterbi::emit_states(size_t last_column, size_t last_state, std::vector<State_segment>& segments)
+{
+    std::vector<uint8_t> states(last_column - m_window_begin + 1);
+    states.back() = static_cast<uint8_t>(last_state);
+    for(size_t column = last_column; column > m_window_begin; --column)
+    {
+        states[column - m_window_begin - 1] = static_cast<uint8_t>(backpointer_at(states[column - m_window_begin], column));
+    }
+
+    for(size_t ix = 0; ix < states.size(); ++ix)
+    {
+        const size_t column = m_window_begin + ix;
+        if(m_has_pending_segment && (m_pending_segment.state == states[ix]))
+        {
+            m_pending_segment.end = column + 1;
+            continue;
+        }
+
+        if(m_has_pending_segment)
+        {
+            segments.push_back(m_pending_segment);
+        }
+
+        m_pending_segment = { column, column + 1, states[ix] };
+        m_has_pending_segment = true;
+    }
+
+    m_backpointers.erase(m_backpointers.begin(), m_backpointers.begin() + states.size() * m_rows);
+    m_window_begin = last_column + 1;
+}
+
+//---------------------------------------------------------------------------
+void Streaming_viterbi::decode(const std::string& chunk, std::vector<State_segment>& segments)
+{
+    if(chunk.empty())
+    {
+        return;
+    }
+
+    for(char emission : chunk)
+    {
+        const double* log_emissions = &m_log_emissions[m_emission_index(emission) * m_rows];
+
+        // The pointers of the first column are never followed.
+        m_backpointers.resize(m_backpointers.size() + m_rows);
+        uint8_t* pointers = &m_backpointers[(m_column_count - m_window_begin) * m_rows];
+
+        if(0 == m_column_count)
+        {
+            for(size_t ii = 0; ii < m_rows; ++ii)
+            {
+                m_previous_log_probs[ii] = m_log_initial_probabilities[ii] + log_emissions[ii];
+            }
+
+            ++m_column_count;
+            continue;
+        }
+
+        // Ties go to the lowest row, as in Probability_table.
+        m_best_rows_kernel(&m_previous_log_probs[0], &m_log_edges_from[0], log_emissions, m_rows, &m_current_log_probs[0], pointers);
+
+        m_previous_log_probs.swap(m_current_log_probs);
+        ++m_column_count;
+    }
+
+    m_max_window_size = std::max(m_max_window_size, m_column_count - m_window_begin);
+
+    // Follow the paths from every state of the last column back together,
+    // until they merge or reach the start of the window.
+    std::vector<size_t> states(m_rows);
+    std::vector<size_t> previous_states;
+    std::vector<bool> is_previous_state(m_rows);
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        states[ii] = ii;
+    }
+
+    size_t column = m_column_count - 1;
+    while((states.size() > 1) && (column > m_window_begin))
+    {
+        previous_states.clear();
+        for(size_t state : states)
+        {
+            const size_t previous_state = backpointer_at(state, column);
+            if(!is_previous_state[previous_state])
+            {
+                is_previous_state[previous_state] = true;
+                previous_states.push_back(previous_state);
+            }
+        }
+
+        for(size_t state : previous_states)
+        {
+            is_previous_state[state] = false;
+        }
+
+        states.swap(previous_states);
+        --column;
+    }
+
+    if(1 == states.size())
+    {
+        emit_states(column, states[0], segments);
+    }
+}
+
+//---------------------------------------------------------------------------
+double Streaming_viterbi::finish(std::vector<State_segment>& segments)
+{
+    if(0 == m_column_count)
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    // Search the final column for the highest log probability, as trace_back_and_save() does.
+    double max_score = m_previous_log_probs[0];
+    size_t high_row = 0;
+    for(size_t ii = 1; ii < m_rows; ++ii)
+    {
+        if(m_previous_log_probs[ii] > max_score)
+        {
+            max_score = m_previous_log_probs[ii];
+            high_row = ii;
+        }
+    }
+
+    if(m_window_begin < m_column_count)
+    {
+        emit_states(m_column_count - 1, high_row, segments);
+    }
+
+    if(m_has_pending_segment)
+    {
+        segments.push_back(m_pending_segment);
+        m_has_pending_segment = false;
+    }
+
+    return max_score;
+}
+
+//---------------------------------------------------------------------------
+size_t Streaming_viterbi::column_count() const
+{
+    return m_column_count;
+}
+
+//---------------------------------------------------------------------------
+// Most columns whose backpointers were held at once, which bounds the memory used.
+size_t Streaming_viterbi::max_window_size() const
+{
+    return m_max_window_size;
+}
+
+//---------------------------------------------------------------------------
+static void print_state_segments(std::ostream& output_stream, const std::vector<State_segment>& segments)
+{
+    for(const auto& segment : segments)
+    {
+        output_stream << "State " << segment.state << ": location: " << segment.begin << ".." << segment.end - 1
+                      << " length: " << segment.end - segment.begin << "\n";
+    }
+}
+
+//---------------------------------------------------------------------------
+double print_streaming_viterbi(std::istream& input, Streaming_viterbi& decoder, size_t chunk_size, std::ostream& output_stream)
+{
+    Fasta_chunk_reader reader(input);
+    std::string chunk;
+    std::vector<State_segment> segments;
+
+    while(reader.read_chunk(chunk, chunk_size))
+    {
+        decoder.decode(chunk, segments);
+        print_state_segments(output_stream, segments);
+        segments.clear();
+    }
+
+    const double max_score = decoder.finish(segments);
+    print_state_segments(output_stream, segments);
+
+    output_stream << "Viterbi path log probability: " << max_score << "\n";
+    output_stream << "Most columns held: " << decoder.max_window_size() << " of " << decoder.column_count() << "\n";
+
+    return max_score;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ViterbiKernel.h"
+
+//---------------------------------------------------------------------------
+// A run of sample data decoded to one state, [begin, end).
+struct State_segment
+{
+    size_t begin;
+    size_t end;
+    size_t state;
+};
+
+//---------------------------------------------------------------------------
+// Viterbi decoder for sample data that arrives in chunks (online Viterbi).
+// Only the backpointers of columns whose state is not yet known are kept.
+// After each chunk, the paths from every state of the last column are traced
+// back together.  Where they all merge, every column up to that point is on
+// the Viterbi path whatever data follows (traceback convergence), so those
+// columns are decoded and their backpointers freed.  Memory is bounded by how
+// far back the paths merge, not by the length of the sample data.
+//
+// The recurrence and tie breaks are those of Probability_table, so the path
+// is the same one it finds.
+class Streaming_viterbi
+{
+    std::vector<double> m_log_initial_probabilities;    // Log of the initial probabilities.
+    std::vector<double> m_log_edges_from;               // [from x to] matrix of log edge probabilities.
+    std::vector<double> m_log_emissions;                // [emission x row] matrix of log emission probabilities.
+    std::vector<double> m_previous_log_probs;           // Log probabilities of the last column.
+    std::vector<double> m_current_log_probs;            // Column being computed.
+    std::vector<uint8_t> m_backpointers;                // [column - m_window_begin x m_rows] best predecessors.
+
+    size_t (*m_emission_index)(char);                   // Function to map emission to an index in the probability vector.
+    const size_t m_rows;                                // Number of states.
+    const Viterbi_best_rows_kernel m_best_rows_kernel;  // One column of the recurrence for m_rows states.
+
+    size_t m_window_begin = 0;                          // First column whose state is not known.
+    size_t m_column_count = 0;                          // Columns decoded so far.
+    size_t m_max_window_size = 0;                       // Most columns held at once.
+
+    State_segment m_pending_segment = {};               // Decoded run that may continue into the next column.
+    bool m_has_pending_segment = false;
+
+    // Not implemented to prevent accidental copying/moving.
+    Streaming_viterbi(const Streaming_viterbi&) = delete;
+    Streaming_viterbi(Streaming_viterbi&&) noexcept = delete;
+    Streaming_viterbi& operator=(const Streaming_viterbi&) = delete;
+    Streaming_viterbi& operator=(Streaming_viterbi&&) noexcept = delete;
+
+    size_t backpointer_at(size_t row, size_t column) const;
+    void emit_states(size_t last_column, size_t last_state, std::vector<State_segment>& segments);
+
+public:
+    Streaming_viterbi(
+        const std::vector<double>& initial_probabilities,   // Probabilities of transition from begin state.
+        const std::vector<double>& edges,                   // Probabilities for each edge.
+        const std::vector<double>& emission_probabilities,  // Probabilities for each emission for each model.
+        size_t (*emission_index)(char));                    // Function to map emission to an index in the probability vector.
+
+    // Decode the next chunk of sample data, and append the runs of states that are now known to segments.
+    void decode(const std::string& chunk, std::vector<State_segment>& segments);
+
+    // Decode the rest of the path from the best final state, and append the remaining runs to segments.
+    // Returns the log probability of the path.
+    double finish(std::vector<State_segment>& segments);
+
+    size_t column_count() const;
+    size_t max_window_size() const;
+};
+
+// Decode a FASTA stream chunk by chunk, printing each run of states as it becomes known.
+// Returns the log probability of the Viterbi path.
+double print_streaming_viterbi(std::istream& input, Streaming_viterbi& decoder, size_t chunk_size, std::ostream& output_stream);
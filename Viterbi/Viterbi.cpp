@@ -1,17 +1,60 @@
 #include "PreCompile.h"
 #include "Viterbi.h"
-#include <Shared/Probability.h>
+#include <Shared/Threads.h>
 
 //---------------------------------------------------------------------------
 double Probability_table::log_prob_at(size_t row, size_t column)
 {
-    return m_log_prob_matrix[row * m_columns + column];
+    return m_log_prob_matrix[column * m_rows + row];
 }
 
 //---------------------------------------------------------------------------
 void Probability_table::set_log_prob_at(double log_prob, size_t row, size_t column)
 {
-    m_log_prob_matrix[row * m_columns + column] = log_prob;
+    m_log_prob_matrix[column * m_rows + row] = log_prob;
+}
+
+//---------------------------------------------------------------------------
+// Best predecessor of a cell, for the backpointers storage.  With two states
+// each cell takes one bit, so a column takes two.  Past 256 states each cell
+// takes two bytes, low byte first.
+size_t Probability_table::backpointer_at(size_t row, size_t column) const
+{
+    if(2 == m_rows)
+    {
+        const size_t bit = column * 2 + row;
+        return (m_backpointers[bit / 8] >> (bit % 8)) & 1;
+    }
+
+    if(m_rows > UINT8_MAX + 1)
+    {
+        const size_t index = (column * m_rows + row) * 2;
+        return m_backpointers[index] | (static_cast<size_t>(m_backpointers[index + 1]) << 8);
+    }
+
+    return m_backpointers[column * m_rows + row];
+}
+
+//---------------------------------------------------------------------------
+void Probability_table::set_backpointer_at(size_t previous_row, size_t row, size_t column)
+{
+    if(2 == m_rows)
+    {
+        const size_t bit = column * 2 + row;
+        const uint8_t mask = static_cast<uint8_t>(1 << (bit % 8));
+        m_backpointers[bit / 8] = previous_row ? (m_backpointers[bit / 8] | mask) : (m_backpointers[bit / 8] & ~mask);
+        return;
+    }
+
+    if(m_rows > UINT8_MAX + 1)
+    {
+        const size_t index = (column * m_rows + row) * 2;
+        m_backpointers[index] = static_cast<uint8_t>(previous_row);
+        m_backpointers[index + 1] = static_cast<uint8_t>(previous_row >> 8);
+        return;
+    }
+
+    m_backpointers[column * m_rows + row] = static_cast<uint8_t>(previous_row);
 }
 
 //---------------------------------------------------------------------------
@@ -37,55 +80,562 @@ void Probability_table::print_parameters(std::ostream& output_stream)
     }
 }
 
+//---------------------------------------------------------------------------
+// Take the logs of the parameters once, instead of once per cell.  The edges
+// are also transposed so the predecessors of a state are contiguous for the
+// trace back, and emissions are grouped by symbol so one column reads one
+// contiguous row.
+void Probability_table::update_log_tables()
+{
+    m_log_initial_probabilities.resize(m_rows);
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        m_log_initial_probabilities[ii] = log(m_initial_probabilities[ii]);
+    }
+
+    m_log_edges_into.resize(m_rows * m_rows);
+    m_log_edges_from.resize(m_rows * m_rows);
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        for(size_t kk = 0; kk < m_rows; ++kk)
+        {
+            m_log_edges_into[ii * m_rows + kk] = log(m_edges[kk * m_rows + ii]);
+            m_log_edges_from[kk * m_rows + ii] = m_log_edges_into[ii * m_rows + kk];
+        }
+    }
+
+    m_log_emissions.resize(m_emission_count * m_rows);
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        for(size_t ee = 0; ee < m_emission_count; ++ee)
+        {
+            m_log_emissions[ee * m_rows + ii] = log(m_emission_probabilities[ii * m_emission_count + ee]);
+        }
+    }
+}
+
 //---------------------------------------------------------------------------
 // build_table() does the work for unrolling the HMM to a probability table used for dynamic programming.
+// Viterbi is max-product, so in log space each step is a sum, and the best
+// predecessor is a max.  Impossible events are -infinity, which both keep.
 void Probability_table::build_table()
 {
+    if(Viterbi_storage::backpointers == m_storage)
+    {
+        build_backpointers();
+        return;
+    }
+
+    if(Viterbi_storage::checkpoints == m_storage)
+    {
+        build_checkpoints();
+        return;
+    }
+
+    if(Viterbi_storage::chunk_parallel == m_storage)
+    {
+        build_chunk_transfers();
+        return;
+    }
+
     // Initialize the first column with the (log) probability of choosing the node,
     // multiplied by (added to) the (log) probability of emitting what the node emitted.
-    for(size_t ii = 0; ii < m_rows; ++ii)
+    first_column(&m_log_prob_matrix[0]);
+
+    // Visit each entry in the table (besides the base cases) and score each.
+    // Viterbi needs to be done column-by-column (as opposed to row-by-row),
+    // so the columns are contiguous, and each follows the one before it.
+    for(size_t jj = 1; jj < m_columns; ++jj)
     {
-        double prob = log_of_sum_of_logs(log(m_initial_probabilities[ii]),
-                                         log(m_emission_probabilities[ii * m_emission_count + m_emission_index(m_sample_data[0])]));
+        next_column(&m_log_prob_matrix[(jj - 1) * m_rows], &m_log_prob_matrix[jj * m_rows], jj);
+    }
+}
+
+//---------------------------------------------------------------------------
+// The same recurrence as build_table(), but only the previous column is kept,
+// and each cell saves which predecessor won instead of its log probability.
+// The trace back then follows the saved predecessors without rescoring them.
+// The last column is left at the start of m_column_log_probs.
+void Probability_table::build_backpointers()
+{
+    double* previous = &m_column_log_probs[0];
+    double* current = &m_column_log_probs[m_rows];
+    std::vector<uint16_t> best_rows(m_rows);
 
-        set_log_prob_at(prob, ii, 0);
+    first_column(previous);
+
+    for(size_t jj = 1; jj < m_columns; ++jj)
+    {
+        next_column_and_wide_rows(previous, current, jj, &best_rows[0]);
+        for(size_t ii = 0; ii < m_rows; ++ii)
+        {
+            set_backpointer_at(best_rows[ii], ii, jj);
+        }
+
+        std::swap(previous, current);
     }
 
-    // Visit each entry in the table (besides the base cases) and score each.
-    // Viterbi needs to be done column-by-column (as opposed to row-by-row).
+    if(previous != &m_column_log_probs[0])
+    {
+        std::copy(previous, previous + m_rows, m_column_log_probs.begin());
+    }
+}
+
+//---------------------------------------------------------------------------
+// First column of the recurrence: initial plus emission log probabilities.
+void Probability_table::first_column(double* log_probs) const
+{
+    const double* log_emissions = &m_log_emissions[m_emission_index(m_sample_data[0]) * m_rows];
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        log_probs[ii] = m_log_initial_probabilities[ii] + log_emissions[ii];
+    }
+}
+
+//---------------------------------------------------------------------------
+// One column of the recurrence from the column before it.  Every storage
+// computes its columns here, so their log probabilities are identical.
+void Probability_table::next_column(const double* previous, double* log_probs, size_t column) const
+{
+    const double* log_emissions = &m_log_emissions[m_emission_index(m_sample_data[column]) * m_rows];
+    m_column_kernel(previous, &m_log_edges_from[0], log_emissions, m_rows, log_probs);
+}
+
+//---------------------------------------------------------------------------
+// next_column(), which also saves the best predecessor of each row.
+// Ties go to the lowest row, as in trace_back_and_save().
+void Probability_table::next_column_and_rows(const double* previous, double* log_probs, size_t column, uint8_t* best_rows) const
+{
+    const double* log_emissions = &m_log_emissions[m_emission_index(m_sample_data[column]) * m_rows];
+    m_best_rows_kernel(previous, &m_log_edges_from[0], log_emissions, m_rows, log_probs, best_rows);
+}
+
+//---------------------------------------------------------------------------
+// next_column_and_rows(), for any number of rows that backpointers can hold.
+void Probability_table::next_column_and_wide_rows(const double* previous, double* log_probs, size_t column, uint16_t* best_rows) const
+{
+    const double* log_emissions = &m_log_emissions[m_emission_index(m_sample_data[column]) * m_rows];
+    m_wide_best_rows_kernel(previous, &m_log_edges_from[0], log_emissions, m_rows, log_probs, best_rows);
+}
+
+//---------------------------------------------------------------------------
+// Save every m_checkpoint_interval-th column, and leave the last column at the
+// start of m_column_log_probs.
+void Probability_table::build_checkpoints()
+{
+    double* previous = &m_column_log_probs[0];
+    double* current = &m_column_log_probs[m_rows];
+
+    first_column(previous);
+    std::copy(previous, previous + m_rows, m_checkpoint_log_probs.begin());
+
     for(size_t jj = 1; jj < m_columns; ++jj)
     {
+        next_column(previous, current, jj);
+        std::swap(previous, current);
+
+        if(0 == (jj % m_checkpoint_interval))
+        {
+            std::copy(previous, previous + m_rows, m_checkpoint_log_probs.begin() + (jj / m_checkpoint_interval) * m_rows);
+        }
+    }
+
+    if(previous != &m_column_log_probs[0])
+    {
+        std::copy(previous, previous + m_rows, m_column_log_probs.begin());
+    }
+}
+
+//---------------------------------------------------------------------------
+// Recompute the columns of a segment from its checkpoint.
+void Probability_table::rebuild_segment(size_t segment)
+{
+    const size_t first = segment * m_checkpoint_interval;
+    const size_t count = std::min(m_checkpoint_interval, m_columns - first);
+
+    std::copy(m_checkpoint_log_probs.cbegin() + segment * m_rows,
+              m_checkpoint_log_probs.cbegin() + (segment + 1) * m_rows,
+              m_segment_log_probs.begin());
+
+    for(size_t cc = 1; cc < count; ++cc)
+    {
+        next_column(&m_segment_log_probs[(cc - 1) * m_rows], &m_segment_log_probs[cc * m_rows], first + cc);
+    }
+}
+
+//---------------------------------------------------------------------------
+// First column of a chunk.  Chunks are as even as the columns allow.
+size_t Probability_table::chunk_begin(size_t chunk) const
+{
+    return chunk * m_columns / m_chunk_count;
+}
+
+//---------------------------------------------------------------------------
+// Advance start_count columns of log probabilities (one for each row the chunk
+// may start from) from column begin to column end - 1.
+void Probability_table::advance_chunk(std::vector<double>& log_probs, size_t start_count, size_t begin, size_t end) const
+{
+    std::vector<double> next_log_probs(log_probs.size());
+
+    for(size_t jj = begin + 1; jj < end; ++jj)
+    {
+        for(size_t start = 0; start < start_count; ++start)
+        {
+            next_column(&log_probs[start * m_rows], &next_log_probs[start * m_rows], jj);
+        }
+
+        log_probs.swap(next_log_probs);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Log probabilities are sums of nonpositive terms, and a candidate for a cell
+// of column is a sum of at most 2 * column + 2 of them.  However the terms
+// are grouped, the rounded sum is within (2 * column + 2) * epsilon / 2 of
+// its size of the exact one.  So when best beats other by more than twice
+// their rounding errors together, the serial recurrence picks best too.
+static bool is_choice_certain(size_t column, double best, double other)
+{
+    if(-std::numeric_limits<double>::infinity() == other)
+    {
+        return true;
+    }
+
+    const double rounding = (2 * column + 2) * std::numeric_limits<double>::epsilon() * (std::abs(best) + std::abs(other));
+    return best - other > 2.0 * rounding;
+}
+
+//---------------------------------------------------------------------------
+// Run the recurrence over a chunk from the column before it (or from the
+// initial probabilities for the first chunk), and save the best predecessor
+// of each cell, exactly as build_backpointers() does.  For each row of the
+// last column, also save the row before the chunk that its best path leaves
+// from, and, if check_choices, whether every choice on that path is certain.
+// The last column is left in log_probs.
+void Probability_table::build_chunk_rows(size_t chunk, const double* start_log_probs, std::vector<double>& log_probs, bool check_choices)
+{
+    const size_t begin = chunk_begin(chunk);
+    const size_t end = chunk_begin(chunk + 1);
+
+    std::vector<double> current(m_rows);
+    std::vector<size_t> start_rows(m_rows);
+    std::vector<size_t> next_start_rows(m_rows);
+    std::vector<uint8_t> certain_rows(m_rows, 1);
+    std::vector<uint8_t> next_certain_rows(m_rows, 1);
+    log_probs.resize(m_rows);
+
+    size_t jj = begin;
+    if(nullptr == start_log_probs)
+    {
+        first_column(&log_probs[0]);
+        ++jj;
+    }
+    else
+    {
+        std::copy(start_log_probs, start_log_probs + m_rows, log_probs.begin());
+    }
+
+    for(; jj < end; ++jj)
+    {
+        uint8_t* best_rows = &m_chunk_best_rows[jj * m_rows];
+        next_column_and_rows(&log_probs[0], &current[0], jj, best_rows);
+
         for(size_t ii = 0; ii < m_rows; ++ii)
         {
-            // Take the (log) probability of the previous node, multiplied by (added to) the (log) probability of
-            // taking the path/edge of that node to the current node, multiplied by (added to) the (log) probability
-            // of emitting what the current node emitted.
-            double prob = log_of_sum_of_logs(log_prob_at(0, jj - 1), log(m_edges[0 * m_rows + ii]));
-            prob = log_of_sum_of_logs(prob, log(m_emission_probabilities[ii * m_emission_count + m_emission_index(m_sample_data[jj])]));
-
-            // For this node, walk each of the edges that points at this node.
-            // Do the probability calculation for that edge, and take the max of all of the calculations.
-            for(size_t kk = 1; kk < m_rows; ++kk)
+            next_start_rows[ii] = (jj == begin) ? best_rows[ii] : start_rows[best_rows[ii]];
+        }
+        start_rows.swap(next_start_rows);
+
+        if(check_choices)
+        {
+            for(size_t ii = 0; ii < m_rows; ++ii)
             {
-                double new_prob = log_of_sum_of_logs(log_prob_at(kk, jj - 1), log(m_edges[kk * m_rows + ii]));
-                new_prob = log_of_sum_of_logs(new_prob, log(m_emission_probabilities[ii * m_emission_count + m_emission_index(m_sample_data[jj])]));
+                const size_t best_row = best_rows[ii];
+                const double best = log_probs[best_row] + m_log_edges_from[best_row * m_rows + ii];
+                double other = -std::numeric_limits<double>::infinity();
+                for(size_t kk = 0; kk < m_rows; ++kk)
+                {
+                    if(kk != best_row)
+                    {
+                        other = std::max(log_probs[kk] + m_log_edges_from[kk * m_rows + ii], other);
+                    }
+                }
 
-                prob = std::max(new_prob, prob);
+                const bool was_certain = (jj == begin) || (0 != certain_rows[best_row]);
+                next_certain_rows[ii] = was_certain && is_choice_certain(jj, best, other);
             }
+            certain_rows.swap(next_certain_rows);
+        }
 
-            // Save the calculated probability.
-            set_log_prob_at(prob, ii, jj);
+        log_probs.swap(current);
+    }
+
+    if(nullptr != start_log_probs)
+    {
+        std::copy(start_rows.cbegin(), start_rows.cend(), m_chunk_start_rows.begin() + chunk * m_rows);
+        std::copy(certain_rows.cbegin(), certain_rows.cend(), m_chunk_certain_rows.begin() + chunk * m_rows);
+    }
+}
+
+//---------------------------------------------------------------------------
+// True if the path from the best row of the last column back through the
+// chunks is certain to be the serial one.  The first two chunks start from
+// serial columns, so only the choices of later chunks, and of the best row,
+// can differ.
+bool Probability_table::is_chunk_path_certain() const
+{
+    if(m_chunk_count < 3)
+    {
+        return true;
+    }
+
+    // The best row, found as trace_back_and_save() does, and the best of the others.
+    const std::vector<double>& last_column = m_chunk_transfers[m_chunk_count - 1];
+    size_t row = 0;
+    for(size_t ii = 1; ii < m_rows; ++ii)
+    {
+        if(last_column[ii] > last_column[row])
+        {
+            row = ii;
+        }
+    }
+
+    double other = -std::numeric_limits<double>::infinity();
+    for(size_t ii = 0; ii < m_rows; ++ii)
+    {
+        if(ii != row)
+        {
+            other = std::max(last_column[ii], other);
+        }
+    }
+
+    if(!is_choice_certain(m_columns - 1, last_column[row], other))
+    {
+        return false;
+    }
+
+    for(size_t chunk = m_chunk_count - 1; chunk > 1; --chunk)
+    {
+        if(0 == m_chunk_certain_rows[chunk * m_rows + row])
+        {
+            return false;
         }
+
+        row = m_chunk_start_rows[chunk * m_rows + row];
     }
+
+    return true;
 }
 
 //---------------------------------------------------------------------------
+// Viterbi is a product of matrices in the max-plus semiring, where a column
+// is a vector, and max and + take the place of + and *.  So each thread finds
+// the transfer matrix of its chunk: the best log probability of ending the
+// chunk in each row, for each row before it.  The first chunk starts from the
+// initial probabilities, so it runs the recurrence itself, and the last chunk
+// needs no matrix, since nothing follows it.  Then the last column of each
+// chunk is the product of the last column of the chunk before it with the
+// chunk's matrix, which is m_chunk_count small products in turn.
+//
+// Each thread then runs the recurrence over its chunk from the column before
+// it, so every predecessor is chosen by the same rule as the serial kernel.
+// The column before the second chunk is the serial one, but later ones come
+// from the matrices, which add the log probabilities in another order.  So a
+// choice between candidates within rounding of each other may differ from the
+// serial one.  If such a choice is on the path, the later chunks are run again
+// in turn, each from the serial column before it, so the path is always the
+// serial one.  Real data seldom has such close choices.
+//
+// A transfer matrix takes m_rows times the work of the serial recurrence,
+// which pays off for the few states of, e.g., G-C content models.
+void Probability_table::build_chunk_transfers()
+{
+    run_tasks(m_chunk_count, static_cast<unsigned int>(m_chunk_count), [this](size_t chunk)
+    {
+        if(0 == chunk)
+        {
+            build_chunk_rows(0, nullptr, m_chunk_transfers[0], false);
+            return;
+        }
+
+        if(chunk + 1 == m_chunk_count)
+        {
+            return;
+        }
+
+        const size_t begin = chunk_begin(chunk);
+        std::vector<double>& log_probs = m_chunk_transfers[chunk];
+
+        const double* log_emissions = &m_log_emissions[m_emission_index(m_sample_data[begin]) * m_rows];
+        log_probs.resize(m_rows * m_rows);
+        for(size_t start = 0; start < m_rows; ++start)
+        {
+            for(size_t ii = 0; ii < m_rows; ++ii)
+            {
+                log_probs[start * m_rows + ii] = m_log_edges_into[ii * m_rows + start] + log_emissions[ii];
+            }
+        }
+
+        advance_chunk(log_probs, m_rows, begin, chunk_begin(chunk + 1));
+    });
+
+    std::copy(m_chunk_transfers[0].cbegin(), m_chunk_transfers[0].cend(), m_chunk_log_probs.begin());
+    for(size_t chunk = 1; chunk + 1 < m_chunk_count; ++chunk)
+    {
+        const double* previous = &m_chunk_log_probs[(chunk - 1) * m_rows];
+        const std::vector<double>& transfer = m_chunk_transfers[chunk];
+
+        for(size_t ii = 0; ii < m_rows; ++ii)
+        {
+            double prob = previous[0] + transfer[ii];
+            for(size_t kk = 1; kk < m_rows; ++kk)
+            {
+                prob = std::max(previous[kk] + transfer[kk * m_rows + ii], prob);
+            }
+
+            m_chunk_log_probs[chunk * m_rows + ii] = prob;
+        }
+    }
+
+    // The transfer matrices are no longer needed, so each chunk leaves its last column there.
+    run_tasks(m_chunk_count, static_cast<unsigned int>(m_chunk_count), [this](size_t chunk)
+    {
+        if(chunk > 0)
+        {
+            build_chunk_rows(chunk, &m_chunk_log_probs[(chunk - 1) * m_rows], m_chunk_transfers[chunk], chunk > 1);
+        }
+    });
+
+    if(!is_chunk_path_certain())
+    {
+        for(size_t chunk = 2; chunk < m_chunk_count; ++chunk)
+        {
+            build_chunk_rows(chunk, &m_chunk_transfers[chunk - 1][0], m_chunk_transfers[chunk], false);
+        }
+    }
+
+    const std::vector<double>& last_column = m_chunk_transfers[m_chunk_count - 1];
+    std::copy(last_column.cbegin(), last_column.cend(), m_column_log_probs.begin());
+}
+
+//---------------------------------------------------------------------------
+// Follow the saved predecessors from end_row at column end - 1 back to column
+// begin.  Edges into the next chunk are left for trace_back_chunks() to count.
+void Probability_table::trace_back_chunk(size_t begin, size_t end, size_t end_row, Path_counts& counts)
+{
+    reset_path_counts(counts);
+
+    size_t row = end_row;
+    save_path_row(row, end - 1, end, counts);
+    for(size_t jj = end - 1; jj > begin; --jj)
+    {
+        row = m_chunk_best_rows[jj * m_rows + row];
+        save_path_row(row, jj - 1, end, counts);
+    }
+}
+
+//---------------------------------------------------------------------------
+// The row at the end of each chunk follows from the row at the end of the
+// next one, which leaves the chunks independent of each other.
+void Probability_table::trace_back_chunks(size_t high_row)
+{
+    std::vector<size_t> end_rows(m_chunk_count);
+    end_rows[m_chunk_count - 1] = high_row;
+    for(size_t chunk = m_chunk_count - 1; chunk > 0; --chunk)
+    {
+        end_rows[chunk - 1] = m_chunk_start_rows[chunk * m_rows + end_rows[chunk]];
+    }
+
+    run_tasks(m_chunk_count, static_cast<unsigned int>(m_chunk_count), [this, &end_rows](size_t chunk)
+    {
+        trace_back_chunk(chunk_begin(chunk), chunk_begin(chunk + 1), end_rows[chunk], m_chunk_path_counts[chunk]);
+    });
+
+    // Sum the counts of the chunks, and count the edges between them.
+    for(size_t chunk = 0; chunk < m_chunk_count; ++chunk)
+    {
+        const Path_counts& counts = m_chunk_path_counts[chunk];
+        std::transform(m_path_counts.edges.cbegin(), m_path_counts.edges.cend(), counts.edges.cbegin(), m_path_counts.edges.begin(), std::plus<size_t>());
+        std::transform(m_path_counts.emissions.cbegin(), m_path_counts.emissions.cend(), counts.emissions.cbegin(), m_path_counts.emissions.begin(), std::plus<size_t>());
+        m_path_counts.changed = m_path_counts.changed || counts.changed;
+
+        if(chunk > 0)
+        {
+            ++m_path_counts.edges[end_rows[chunk - 1] * m_rows + m_probable_path[chunk_begin(chunk)]];
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Zero the counts, keeping their storage for the next trace back.
+void Probability_table::reset_path_counts(Path_counts& counts) const
+{
+    counts.edges.assign(m_rows * m_rows, 0);
+    counts.emissions.assign(m_rows * m_emission_count, 0);
+    counts.changed = false;
+}
+
+//---------------------------------------------------------------------------
+// Save the row of the probable path at a column, and count its emission, and
+// its edge to the next column if that is before end.  The trace back goes
+// from the last column to the first, so the next row is already saved.
+void Probability_table::save_path_row(size_t row, size_t column, size_t end, Path_counts& counts)
+{
+    counts.changed = counts.changed || (m_probable_path[column] != row);
+    m_probable_path[column] = row;
+
+    ++counts.emissions[row * m_emission_count + m_emission_index(m_sample_data[column])];
+    if(column + 1 < end)
+    {
+        ++counts.edges[row * m_rows + m_probable_path[column + 1]];
+    }
+}
+
+//---------------------------------------------------------------------------
+// Checkpoints every interval columns take about (columns / interval + interval)
+// columns of memory, which is least at sqrt(columns).  The probable path takes
+// one size_t per column besides, which is more than the checkpoints for few
+// states, so it is counted against the budget too.  Under a budget, the
+// interval is the shortest one that fits, since shorter segments stay in the
+// cache while they are recomputed.  A budget below the least memory cannot be
+// met, so meets_budget is cleared, and the least memory interval is used.
+static size_t checkpoint_interval_for_budget(size_t columns, size_t rows, size_t memory_budget, bool& meets_budget)
+{
+    const size_t least_memory_interval = std::max<size_t>(1, static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(columns)))));
+
+    meets_budget = true;
+    if(0 == memory_budget)
+    {
+        return least_memory_interval;
+    }
+
+    const size_t path_bytes = columns * sizeof(size_t);
+    const double budget_columns = (memory_budget > path_bytes) ? static_cast<double>(memory_budget - path_bytes) / (rows * sizeof(double)) : 0.0;
+    const double discriminant = budget_columns * budget_columns - 4.0 * columns;
+    if(discriminant < 0.0)
+    {
+        meets_budget = false;
+        return least_memory_interval;
+    }
+
+    // The shortest interval i with columns / i + i <= budget_columns.
+    const size_t interval = std::max<size_t>(1, static_cast<size_t>(std::ceil((budget_columns - std::sqrt(discriminant)) / 2.0)));
+    return std::min(interval, least_memory_interval);
+}
+
+//---------------------------------------------------------------------------
+// The best predecessors of chunks are bytes, and their transfer matrices take
+// m_rows^3 work per column, so models of more than 256 states keep
+// backpointers instead of chunks.  storage() tells which storage was used.
 Probability_table::Probability_table(
     std::string&& sample_data,                      // Sample data.
     std::vector<double>&& initial_probabilities,    // Probabilities of transition from begin state.
     std::vector<double>&& edges,                    // Probabilities for each edge (transitions between states).
     std::vector<double>&& emission_probabilities,   // Probabilities for each emission for each model.
-    size_t (*emission_index)(char))                 // Function to map emission to an index in the probability vector.
+    size_t (*emission_index)(char),                 // Function to map emission to an index in the probability vector.
+    Viterbi_storage storage,
+    size_t memory_budget,
+    unsigned int thread_count)
     : m_edges(std::move(edges))
     , m_emission_probabilities(std::move(emission_probabilities))
     , m_emission_count(m_emission_probabilities.size() / initial_probabilities.size()) // number of emission probabilities (i.e. dice=12, 6 emissions * 2 types of dice)
@@ -94,8 +644,42 @@ Probability_table::Probability_table(
     , m_initial_probabilities(std::move(initial_probabilities))
     , m_columns(m_sample_data.length())             // Number of samples in the sample data.
     , m_rows(m_initial_probabilities.size())        // Number of Markov models being combined.
+    , m_storage(((Viterbi_storage::chunk_parallel == storage) && (m_rows > UINT8_MAX + 1)) ? Viterbi_storage::backpointers : storage)
+    , m_column_kernel(select_column_kernel(m_rows))
+    , m_best_rows_kernel(select_best_rows_kernel(m_rows))
+    , m_wide_best_rows_kernel(select_wide_best_rows_kernel(m_rows))
 {
-    m_log_prob_matrix.resize(m_columns * m_rows);
+    if(Viterbi_storage::backpointers == m_storage)
+    {
+        assert(m_rows <= UINT16_MAX + 1);
+
+        m_column_log_probs.resize(2 * m_rows);
+        m_backpointers.resize((2 == m_rows) ? (m_columns * 2 + 7) / 8 : m_columns * m_rows * ((m_rows > UINT8_MAX + 1) ? 2 : 1));
+    }
+    else if(Viterbi_storage::checkpoints == m_storage)
+    {
+        m_checkpoint_interval = checkpoint_interval_for_budget(m_columns, m_rows, memory_budget, m_meets_memory_budget);
+        m_column_log_probs.resize(2 * m_rows);
+        m_checkpoint_log_probs.resize(((m_columns + m_checkpoint_interval - 1) / m_checkpoint_interval) * m_rows);
+        m_segment_log_probs.resize(m_checkpoint_interval * m_rows);
+    }
+    else if(Viterbi_storage::chunk_parallel == m_storage)
+    {
+        m_chunk_count = std::max<size_t>(1, std::min<size_t>(resolve_thread_count(thread_count), m_columns));
+        m_column_log_probs.resize(m_rows);
+        m_chunk_log_probs.resize(m_chunk_count * m_rows);
+        m_chunk_start_rows.resize(m_chunk_count * m_rows);
+        m_chunk_certain_rows.resize(m_chunk_count * m_rows);
+        m_chunk_transfers.resize(m_chunk_count);
+        m_chunk_best_rows.resize(m_columns * m_rows);
+        m_chunk_path_counts.resize(m_chunk_count);
+    }
+    else
+    {
+        m_log_prob_matrix.resize(m_columns * m_rows);
+    }
+
+    update_log_tables();
     build_table();
 }
 
@@ -103,40 +687,78 @@ Probability_table::Probability_table(
 // Do trace back of highest probability path (Viterbi traceback).
 // Search the final column for the highest score, then save
 // the backtrace (m_probable_path) from that entry.
-void Probability_table::trace_back_and_save(std::ostream& output_stream)
+// Returns the log probability of the path.
+double Probability_table::trace_back_and_save(std::ostream& output_stream)
 {
+    const bool has_backpointers = (Viterbi_storage::backpointers == m_storage);
+    const bool has_checkpoints = (Viterbi_storage::checkpoints == m_storage);
+    const auto final_log_prob = [this](size_t row)
+    {
+        return (Viterbi_storage::full_table == m_storage) ? log_prob_at(row, m_columns - 1) : m_column_log_probs[row];
+    };
+    const auto previous_log_prob = [this, has_checkpoints](size_t row, size_t column)
+    {
+        return has_checkpoints ? m_segment_log_probs[(column % m_checkpoint_interval) * m_rows + row] : log_prob_at(row, column);
+    };
+    size_t rebuilt_segment = SIZE_MAX;
+
     // Search the final column for the highest log probability.
     // Begin the trace back from that score.
-    double max_score = log_prob_at(0, m_columns - 1);
+    double max_score = final_log_prob(0);
     size_t high_row = 0;
     for(size_t ii = 1; ii < m_rows; ++ii)
     {
-        if(log_prob_at(ii, m_columns - 1) > max_score)
+        if(final_log_prob(ii) > max_score)
         {
-            max_score = log_prob_at(ii, m_columns - 1);
+            max_score = final_log_prob(ii);
             high_row = ii;
         }
     }
 
     output_stream << "Viterbi path log probability: " << max_score << "\n";
 
-    // The probable path is a list of the followed rows.
+    // The probable path is a list of the followed rows.  It is counted as it
+    // is saved, and the first trace back always changes it, even if the path
+    // stays in row 0, which the resized path already holds.
+    const bool first_trace_back = (m_probable_path.size() != m_columns);
     m_probable_path.resize(m_columns);
-    m_probable_path[m_columns - 1] = high_row;
+    reset_path_counts(m_path_counts);
+    m_path_counts.changed = first_trace_back;
 
-    // Walk the columns in reverse order for the traceback.  Calculate the previous nodes'
-    // (log) probabilities, and follow the path with the max score.
+    if(Viterbi_storage::chunk_parallel == m_storage)
+    {
+        trace_back_chunks(high_row);
+        return max_score;
+    }
+
+    save_path_row(high_row, m_columns - 1, m_columns, m_path_counts);
+
+    // Walk the columns in reverse order for the traceback.  Follow the saved backpointers,
+    // or calculate the previous nodes' (log) probabilities and follow the path with the
+    // max score.  The emission of high_row is the same for every previous node, so it is left out.
     for(size_t jj = m_columns - 1; jj > 0; --jj)
     {
-        size_t new_high_row = 0;  // Assume initial row has the new highest probability.
+        if(has_backpointers)
+        {
+            high_row = backpointer_at(high_row, jj);
+            save_path_row(high_row, jj - 1, m_columns, m_path_counts);
+            continue;
+        }
+
+        // With checkpoints, the segment of the previous column is recomputed when the trace back enters it.
+        if(has_checkpoints && ((jj - 1) / m_checkpoint_interval != rebuilt_segment))
+        {
+            rebuilt_segment = (jj - 1) / m_checkpoint_interval;
+            rebuild_segment(rebuilt_segment);
+        }
 
-        double prob = log_of_sum_of_logs(log_prob_at(0, jj - 1), log(m_edges[0 * m_rows + high_row]));
-        prob = log_of_sum_of_logs(prob, log(m_emission_probabilities[high_row * m_emission_count + m_emission_index(m_sample_data[jj])]));
+        const double* log_edges = &m_log_edges_into[high_row * m_rows];
+        size_t new_high_row = 0;  // Assume initial row has the new highest probability.
+        double prob = previous_log_prob(0, jj - 1) + log_edges[0];
 
         for(size_t kk = 1; kk < m_rows; ++kk)
         {
-            double new_prob = log_of_sum_of_logs(log_prob_at(kk, jj - 1), log(m_edges[kk * m_rows + high_row]));
-            new_prob = log_of_sum_of_logs(new_prob, log(m_emission_probabilities[high_row * m_emission_count + m_emission_index(m_sample_data[jj])]));
+            const double new_prob = previous_log_prob(kk, jj - 1) + log_edges[kk];
 
             // If this row scored a higher probability than the previous max,
             // take this row as the new max.
@@ -150,8 +772,59 @@ void Probability_table::trace_back_and_save(std::ostream& output_stream)
         // After walking all the rows in this column, save the highest scoring one and use
         // that as the basis for the next column's score.
         high_row = new_high_row;
-        m_probable_path[jj - 1] = high_row;
+        save_path_row(high_row, jj - 1, m_columns, m_path_counts);
     }
+
+    return max_score;
+}
+
+//---------------------------------------------------------------------------
+// False if the checkpoints and the probable path cannot fit in the memory
+// budget, in which case the checkpoints take the least memory they can.
+bool Probability_table::meets_memory_budget() const
+{
+    return m_meets_memory_budget;
+}
+
+//---------------------------------------------------------------------------
+// The storage the table keeps, which is the one requested, except that models
+// of more than 256 states keep backpointers instead of chunks.
+Viterbi_storage Probability_table::storage() const
+{
+    return m_storage;
+}
+
+//---------------------------------------------------------------------------
+// Columns between saved columns for the checkpoints storage, or 0.
+size_t Probability_table::checkpoint_interval() const
+{
+    return m_checkpoint_interval;
+}
+
+//---------------------------------------------------------------------------
+// Log probability of the sample data and a given path (one row per column).
+double Probability_table::path_log_probability(const std::vector<size_t>& path) const
+{
+    assert(path.size() == m_columns);
+
+    double prob = m_log_initial_probabilities[path[0]];
+    for(size_t jj = 0; jj < m_columns; ++jj)
+    {
+        if(jj > 0)
+        {
+            prob += m_log_edges_into[path[jj] * m_rows + path[jj - 1]];
+        }
+
+        prob += m_log_emissions[m_emission_index(m_sample_data[jj]) * m_rows + path[jj]];
+    }
+
+    return prob;
+}
+
+//---------------------------------------------------------------------------
+const std::vector<size_t>& Probability_table::probable_path() const
+{
+    return m_probable_path;
 }
 
 //---------------------------------------------------------------------------
@@ -213,107 +886,67 @@ void Probability_table::print_found_sequences(std::ostream& output_stream, size_
 }
 
 //---------------------------------------------------------------------------
-// This behaves the same as print_found_sequences(), but just returns a count
-// instead of printing the sequences.
-size_t Probability_table::count_hits()
+// Number of hits that print_found_sequences() would find with no limits.
+// A hit ends where the path returns to row 0, so the hits are the edges
+// into row 0 from any other row, which the trace back counted.
+size_t Probability_table::count_hits() const
 {
-    bool in_sequence = false;
-    size_t start_index = 0;
     size_t hit_count = 0;
-
-    for(size_t jj = 0; jj < m_columns; ++jj)
+    for(size_t ii = 1; ii < m_rows; ++ii)
     {
-        if(0 == m_probable_path[jj])
-        {
-            // Count the if a sequence was in progress.
-            if(in_sequence)
-            {
-                in_sequence = false;
-                ++hit_count;
-
-                while(start_index < jj)
-                {
-                    ++start_index;
-                }
-            }
-        }
-        else
-        {
-            // Save the start index if a sequence is not in progress.
-            if(!in_sequence)
-            {
-                start_index = jj;
-                in_sequence = true;
-            }
-        }
+        hit_count += m_path_counts.edges[ii * m_rows];
     }
 
     return hit_count;
 }
 
 //---------------------------------------------------------------------------
-// Implement Viterbi training across edges (Ak,l) and pEmissionProbabilities (Ek(b))
-void Probability_table::train_and_print(std::ostream& output_stream)
+// Viterbi training has converged once a trace back finds the same path as
+// the one before it, since the same counts give the same parameters.
+bool Probability_table::path_changed() const
 {
-    // Calculate new estimate of transition probabilities.
-    std::vector<size_t> edges(m_rows);
+    return m_path_counts.changed;
+}
 
-    // TODO: A O(n) algorithm would be better here.
-    for(size_t ii = 0; ii < m_rows; ++ii)
+//---------------------------------------------------------------------------
+// Estimate new probabilities for each row as its counts over their total.
+// A row the path never used keeps its old probabilities.
+static void update_probabilities(const std::vector<size_t>& counts, size_t columns, std::vector<double>& probabilities)
+{
+    for(size_t row = 0; row < counts.size() / columns; ++row)
     {
-        edges.assign(m_rows, 0);
-
-        // Count the number of each transition taken.
-        // Walk m_columns - 1 because there are only edges between the nodes.
-        size_t total_edges = 0;
-        for(size_t jj = 0; jj < m_columns - 1; ++jj)
+        size_t total = 0;
+        for(size_t column = 0; column < columns; ++column)
         {
-            // If this node was in the trace, count its attached edge.
-            // Also increase the count of the specific edge that was followed.
-            if(m_probable_path[jj] == ii)
-            {
-                edges[m_probable_path[jj + 1]] += 1;
-                ++total_edges;
-            }
+            total += counts[row * columns + column];
         }
 
-        // Calculate new estimate of this edge probability.
-        for(size_t jj = 0; jj < m_rows; ++jj)
-        {
-            m_edges[ii * m_rows + jj] = edges[jj] / static_cast<double>(total_edges);
-        }
-    }
-
-    // Calculate new estimate of emission probabilities.
-    std::vector<size_t> emissions(m_emission_count);
-
-    // TODO: A O(n) algorithm would be better here.
-    for(size_t ii = 0; ii < m_rows; ++ii)
-    {
-        emissions.assign(m_emission_count, 0);
-
-        // Count the number of emissions, keeping a separate count for each row.
-        size_t total_emissions = 0;
-        for(size_t jj = 0; jj < m_columns; ++jj)
+        if(0 == total)
         {
-            // If this node was in the trace, then count its emission towards the total,
-            // and also up the count of the specific letter that was emitted.
-            // Keep a separate total for each row.
-            if(m_probable_path[jj] == ii)
-            {
-                emissions[m_emission_index(m_sample_data[jj])] += 1;
-                ++total_emissions;
-            }
+            continue;
         }
 
-        // Calculate estimate of new probability of emitting this character.
-        for(size_t jj = 0; jj < m_emission_count; ++jj)
+        for(size_t column = 0; column < columns; ++column)
         {
-            m_emission_probabilities[ii * m_emission_count + jj] = emissions[jj] / static_cast<double>(total_emissions);
+            probabilities[row * columns + column] = counts[row * columns + column] / static_cast<double>(total);
         }
     }
+}
+
+//---------------------------------------------------------------------------
+// Implement Viterbi training across edges (Ak,l) and pEmissionProbabilities (Ek(b)).
+// The trace back counted the edges and emissions of the path, so an iteration
+// is the update, one pass to build the table and one to trace it back, all in
+// the storage the table already has.
+void Probability_table::train_and_print(std::ostream& output_stream)
+{
+    // Calculate new estimates of the transition and emission probabilities.
+    // Edges are only counted between the nodes, so there are m_columns - 1 of them.
+    update_probabilities(m_path_counts.edges, m_rows, m_edges);
+    update_probabilities(m_path_counts.emissions, m_emission_count, m_emission_probabilities);
 
     // Print out the newly estimated parameters.
+    update_log_tables();
     build_table();
     trace_back_and_save(output_stream);
     print_parameters(output_stream);
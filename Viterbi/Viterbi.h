@@ -1,5 +1,35 @@
 #pragma once
 
+#include "ViterbiKernel.h"
+
+//---------------------------------------------------------------------------
+// How the table keeps what the trace back needs.
+enum class Viterbi_storage
+{
+    full_table,     // Every log probability, m_rows x m_columns doubles.
+    backpointers,   // Two columns of log probabilities, and the best predecessor of
+                    // each cell: one bit for two states, one byte up to 256 states,
+                    // otherwise two bytes (up to 65536 states).
+    checkpoints,    // Every interval-th column of log probabilities.  The trace back
+                    // recomputes one segment between checkpoints at a time.
+    chunk_parallel, // One chunk of columns per thread.  Each thread finds the max-plus
+                    // transfer matrix of its chunk, which give the column before each
+                    // chunk, and then saves the best predecessors of its chunk from it.
+                    // Chunks are run again in turn if a choice on the path is too close
+                    // to call, so the path is the serial one.
+                    // Models of more than 256 states use backpointers instead.
+};
+
+//---------------------------------------------------------------------------
+// Sufficient statistics of Viterbi training: the edges and emissions taken
+// by a probable path, counted as it is traced back.
+struct Path_counts
+{
+    std::vector<size_t> edges;                          // [from x to] edges taken by the path.
+    std::vector<size_t> emissions;                      // [row x emission] emissions of the path in each row.
+    bool changed = false;                               // True if the path differs from the one traced back before.
+};
+
 //---------------------------------------------------------------------------
 // Definition of a probability table for dynamic programming.
 class Probability_table
@@ -7,10 +37,28 @@ class Probability_table
     // Because multiplication of successive probabilities produces extremely
     // small numbers which are numerically unstable, use log probabilities
     // instead, which can be added without the numerical issues.
-    std::vector<double> m_log_prob_matrix;              // 2D matrix of log probabilities.
+    std::vector<double> m_log_prob_matrix;              // [m_columns x m_rows] log probabilities, state-contiguous (full_table).
+    std::vector<double> m_column_log_probs;             // Previous and current columns of log probabilities (backpointers).
+    std::vector<uint8_t> m_backpointers;                // [m_columns x m_rows] best predecessors, bit-packed for two states, two bytes each past 256 states (backpointers).
+    std::vector<double> m_checkpoint_log_probs;         // [checkpoint x m_rows] log probabilities of every interval-th column (checkpoints).
+    std::vector<double> m_segment_log_probs;            // [column x m_rows] log probabilities of the segment being traced back (checkpoints).
+    std::vector<double> m_chunk_log_probs;              // [chunk x m_rows] log probabilities of the last column of each chunk, from the transfer matrices (chunk_parallel).
+    std::vector<size_t> m_chunk_start_rows;             // [chunk x m_rows] row before each chunk that the best path to each row at its end leaves from (chunk_parallel).
+    std::vector<uint8_t> m_chunk_certain_rows;          // [chunk x m_rows] nonzero if every choice on that path is certain to be the serial one (chunk_parallel).
+    std::vector<std::vector<double>> m_chunk_transfers; // Transfer matrix of each chunk, and then its last column (chunk_parallel).
+    std::vector<uint8_t> m_chunk_best_rows;             // [m_columns x m_rows] best predecessors (chunk_parallel).
+    std::vector<Path_counts> m_chunk_path_counts;       // Counts of the path through each chunk (chunk_parallel).
     std::vector<double> m_edges;                        // [m_rows x m_rows] matrix of edge probabilities.
     std::vector<double> m_emission_probabilities;       // Probability of each emission.
     std::vector<size_t> m_probable_path;                // List of rows indicating the probable path.
+    Path_counts m_path_counts;                          // Counts of m_probable_path, for training.
+
+    // Log space copies of the parameters, so the kernel only adds and compares.
+    // Rebuilt by update_log_tables() whenever the parameters change.
+    std::vector<double> m_log_initial_probabilities;    // Log of m_initial_probabilities.
+    std::vector<double> m_log_edges_into;               // [to x from] matrix of log edge probabilities.
+    std::vector<double> m_log_edges_from;               // [from x to] matrix of log edge probabilities, for the column kernels.
+    std::vector<double> m_log_emissions;                // [emission x row] matrix of log emission probabilities.
 
     size_t m_emission_count;                            // Number of potential emissions.
 
@@ -20,6 +68,13 @@ class Probability_table
     const std::vector<double> m_initial_probabilities;  // Vector of initial probabilities (number of Markov models being combined).
     const size_t m_columns;                             // Width of matrix (m_sample_data.length()).
     const size_t m_rows;                                // Height of matrix (m_initial_probabilities.size()).
+    const Viterbi_storage m_storage;
+    size_t m_checkpoint_interval = 0;                   // Columns between checkpoints (checkpoints).
+    bool m_meets_memory_budget = true;                  // False if the memory budget was too small (checkpoints).
+    size_t m_chunk_count = 0;                           // Chunks of columns, one per thread (chunk_parallel).
+    const Viterbi_column_kernel m_column_kernel;        // next_column() for m_rows states.
+    const Viterbi_best_rows_kernel m_best_rows_kernel;  // next_column_and_rows() for m_rows states.
+    const Viterbi_wide_best_rows_kernel m_wide_best_rows_kernel; // next_column_and_wide_rows() for m_rows states.
 
     // Not implemented to prevent accidental copying/moving.
     Probability_table(const Probability_table&) = delete;
@@ -31,7 +86,26 @@ protected:
     double log_prob_at(size_t row, size_t column);
     void set_log_prob_at(double log_prob, size_t row, size_t column);
     void print_parameters(std::ostream& output_stream);
+    size_t backpointer_at(size_t row, size_t column) const;
+    void set_backpointer_at(size_t previous_row, size_t row, size_t column);
+    void update_log_tables();
     void build_table();
+    void build_backpointers();
+    void first_column(double* log_probs) const;
+    void next_column(const double* previous, double* log_probs, size_t column) const;
+    void next_column_and_rows(const double* previous, double* log_probs, size_t column, uint8_t* best_rows) const;
+    void next_column_and_wide_rows(const double* previous, double* log_probs, size_t column, uint16_t* best_rows) const;
+    void build_checkpoints();
+    void rebuild_segment(size_t segment);
+    size_t chunk_begin(size_t chunk) const;
+    void advance_chunk(std::vector<double>& log_probs, size_t start_count, size_t begin, size_t end) const;
+    void build_chunk_rows(size_t chunk, const double* start_log_probs, std::vector<double>& log_probs, bool check_choices);
+    bool is_chunk_path_certain() const;
+    void build_chunk_transfers();
+    void trace_back_chunk(size_t begin, size_t end, size_t end_row, Path_counts& counts);
+    void trace_back_chunks(size_t high_row);
+    void reset_path_counts(Path_counts& counts) const;
+    void save_path_row(size_t row, size_t column, size_t end, Path_counts& counts);
 
 public:
     Probability_table(
@@ -39,12 +113,22 @@ public:
         std::vector<double>&& initial_probabilities,    // Probabilities of transition from begin state.
         std::vector<double>&& edges,                    // Probabilities for each edge.
         std::vector<double>&& emission_probabilities,   // Probabilities for each emission for each model.
-        size_t (*emission_index)(char));                // Function to map emission to an index in the probability vector.
+        size_t (*emission_index)(char),                 // Function to map emission to an index in the probability vector.
+        Viterbi_storage storage = Viterbi_storage::full_table,
+        size_t memory_budget = 0,                       // Bytes of checkpoints and probable path (0 for sqrt(m_columns) columns apart).
+        unsigned int thread_count = 0);                 // Threads for chunk_parallel (0 for every hardware thread).
+
+    Viterbi_storage storage() const;
+    size_t checkpoint_interval() const;
+    bool meets_memory_budget() const;
     ~Probability_table() = default;
 
-    void trace_back_and_save(std::ostream& output_stream);
+    double trace_back_and_save(std::ostream& output_stream);
+    double path_log_probability(const std::vector<size_t>& path) const;
+    const std::vector<size_t>& probable_path() const;
     void print_found_sequences(std::ostream& output_stream, size_t max_hits, size_t min_nucleotide_count);
-    size_t count_hits();
+    size_t count_hits() const;
+    bool path_changed() const;
     void train_and_print(std::ostream& output_stream);
 #ifndef NDEBUG
     void print_dice_rolls(std::ostream& output_stream);
@@ -0,0 +1,257 @@
+#include "PreCompile.h"
+#include "ViterbiKernel.h"  // Pick up forward declarations to ensure correctness.
+
+// AVX2 is used when the compiler targets it: the Release builds of the project
+// set /arch:AVX2, and GCC or Clang need -mavx2 (or -march=native).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VITERBI_KERNEL_AVX2
+#define VITERBI_KERNEL_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define VITERBI_KERNEL_SSE2
+#endif
+
+//---------------------------------------------------------------------------
+// Thin wrappers over vectors of doubles, so the kernels are written once.
+// greater() returns a mask for select(), which takes a where the mask is set.
+
+//---------------------------------------------------------------------------
+// One lane "vector".  Used on targets without SIMD support (ARM).
+struct Scalar_double_vector
+{
+    typedef double vector_type;
+
+    static constexpr size_t lanes = 1;
+
+    static vector_type load(const double* source) { return *source; }
+    static void store(double* destination, vector_type value) { *destination = value; }
+    static vector_type splat(double value) { return value; }
+    static vector_type add(vector_type a, vector_type b) { return a + b; }
+    static vector_type max(vector_type a, vector_type b) { return std::max(a, b); }
+    static vector_type greater(vector_type a, vector_type b) { return (a > b) ? 1.0 : 0.0; }
+    static vector_type select(vector_type mask, vector_type a, vector_type b) { return (0.0 != mask) ? a : b; }
+};
+
+#if defined(VITERBI_KERNEL_SSE2)
+
+//---------------------------------------------------------------------------
+// Two double lanes.
+struct Sse2_double_vector
+{
+    typedef __m128d vector_type;
+
+    static constexpr size_t lanes = 2;
+
+    static vector_type load(const double* source) { return _mm_loadu_pd(source); }
+    static void store(double* destination, vector_type value) { _mm_storeu_pd(destination, value); }
+    static vector_type splat(double value) { return _mm_set1_pd(value); }
+    static vector_type add(vector_type a, vector_type b) { return _mm_add_pd(a, b); }
+    static vector_type max(vector_type a, vector_type b) { return _mm_max_pd(a, b); }
+    static vector_type greater(vector_type a, vector_type b) { return _mm_cmpgt_pd(a, b); }
+    static vector_type select(vector_type mask, vector_type a, vector_type b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+};
+
+typedef Sse2_double_vector Narrow_double_vector;
+
+#else
+
+typedef Scalar_double_vector Narrow_double_vector;
+
+#endif
+
+#if defined(VITERBI_KERNEL_AVX2)
+
+//---------------------------------------------------------------------------
+// Four double lanes.
+struct Avx2_double_vector
+{
+    typedef __m256d vector_type;
+
+    static constexpr size_t lanes = 4;
+
+    static vector_type load(const double* source) { return _mm256_loadu_pd(source); }
+    static void store(double* destination, vector_type value) { _mm256_storeu_pd(destination, value); }
+    static vector_type splat(double value) { return _mm256_set1_pd(value); }
+    static vector_type add(vector_type a, vector_type b) { return _mm256_add_pd(a, b); }
+    static vector_type max(vector_type a, vector_type b) { return _mm256_max_pd(a, b); }
+    static vector_type greater(vector_type a, vector_type b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static vector_type select(vector_type mask, vector_type a, vector_type b) { return _mm256_blendv_pd(b, a, mask); }
+};
+
+typedef Avx2_double_vector Simd_double_vector;
+
+#else
+
+typedef Narrow_double_vector Simd_double_vector;
+
+#endif
+
+//---------------------------------------------------------------------------
+// Fixed_rows is the number of states, or 0 for any number of them.  The
+// states past the last full vector are done one lane at a time.
+template<typename Vector, size_t Fixed_rows>
+static void max_column(const double* previous, const double* log_edges_from, const double* log_emissions, size_t rows, double* log_probs)
+{
+    typedef typename Vector::vector_type vector_type;
+    const size_t row_count = Fixed_rows ? Fixed_rows : rows;
+
+    size_t ii = 0;
+    for(; ii + Vector::lanes <= row_count; ii += Vector::lanes)
+    {
+        // Max is exact, so even and odd predecessors can be taken in two
+        // independent chains, and then combined.
+        vector_type best = Vector::add(Vector::splat(previous[0]), Vector::load(log_edges_from + ii));
+        vector_type odd_best = best;
+        size_t kk = 1;
+        for(; kk + 1 < row_count; kk += 2)
+        {
+            odd_best = Vector::max(odd_best, Vector::add(Vector::splat(previous[kk]), Vector::load(log_edges_from + kk * row_count + ii)));
+            best = Vector::max(best, Vector::add(Vector::splat(previous[kk + 1]), Vector::load(log_edges_from + (kk + 1) * row_count + ii)));
+        }
+
+        if(kk < row_count)
+        {
+            odd_best = Vector::max(odd_best, Vector::add(Vector::splat(previous[kk]), Vector::load(log_edges_from + kk * row_count + ii)));
+        }
+
+        Vector::store(log_probs + ii, Vector::add(Vector::max(best, odd_best), Vector::load(log_emissions + ii)));
+    }
+
+    for(; ii < row_count; ++ii)
+    {
+        double prob = previous[0] + log_edges_from[ii];
+        for(size_t kk = 1; kk < row_count; ++kk)
+        {
+            prob = std::max(previous[kk] + log_edges_from[kk * row_count + ii], prob);
+        }
+
+        log_probs[ii] = prob + log_emissions[ii];
+    }
+}
+
+//---------------------------------------------------------------------------
+// Predecessors are visited in order, and only a strictly greater one replaces
+// the best so far, so ties go to the lowest row.  Rows are kept as doubles in
+// the lanes, which hold them exactly.
+//
+// Each predecessor depends on the compare and select of the one before it,
+// so Blocks vectors of states are done together to hide that latency.
+template<typename Vector, size_t Blocks, typename Row>
+static void best_rows_blocks(const double* previous, const double* log_edges_from, const double* log_emissions, size_t row_count, size_t first_row, double* log_probs, Row* best_rows)
+{
+    typedef typename Vector::vector_type vector_type;
+
+    vector_type best[Blocks];
+    vector_type best_row[Blocks];
+    for(size_t block = 0; block < Blocks; ++block)
+    {
+        best[block] = Vector::add(Vector::splat(previous[0]), Vector::load(log_edges_from + first_row + block * Vector::lanes));
+        best_row[block] = Vector::splat(0.0);
+    }
+
+    for(size_t kk = 1; kk < row_count; ++kk)
+    {
+        const vector_type previous_prob = Vector::splat(previous[kk]);
+        const vector_type row = Vector::splat(static_cast<double>(kk));
+        const double* log_edges = log_edges_from + kk * row_count + first_row;
+
+        for(size_t block = 0; block < Blocks; ++block)
+        {
+            const vector_type prob = Vector::add(previous_prob, Vector::load(log_edges + block * Vector::lanes));
+            const vector_type mask = Vector::greater(prob, best[block]);
+            best[block] = Vector::select(mask, prob, best[block]);
+            best_row[block] = Vector::select(mask, row, best_row[block]);
+        }
+    }
+
+    for(size_t block = 0; block < Blocks; ++block)
+    {
+        const size_t ii = first_row + block * Vector::lanes;
+        Vector::store(log_probs + ii, Vector::add(best[block], Vector::load(log_emissions + ii)));
+
+        double lane_rows[Vector::lanes];
+        Vector::store(lane_rows, best_row[block]);
+        for(size_t lane = 0; lane < Vector::lanes; ++lane)
+        {
+            best_rows[ii + lane] = static_cast<Row>(lane_rows[lane]);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// max_column(), which also saves the best predecessor of each state as a Row.
+template<typename Vector, size_t Fixed_rows, typename Row>
+static void best_rows_column(const double* previous, const double* log_edges_from, const double* log_emissions, size_t rows, double* log_probs, Row* best_rows)
+{
+    constexpr size_t block_count = 4;
+    const size_t row_count = Fixed_rows ? Fixed_rows : rows;
+
+    size_t ii = 0;
+    for(; ii + block_count * Vector::lanes <= row_count; ii += block_count * Vector::lanes)
+    {
+        best_rows_blocks<Vector, block_count, Row>(previous, log_edges_from, log_emissions, row_count, ii, log_probs, best_rows);
+    }
+
+    for(; ii + Vector::lanes <= row_count; ii += Vector::lanes)
+    {
+        best_rows_blocks<Vector, 1, Row>(previous, log_edges_from, log_emissions, row_count, ii, log_probs, best_rows);
+    }
+
+    for(; ii < row_count; ++ii)
+    {
+        size_t best_row = 0;
+        double prob = previous[0] + log_edges_from[ii];
+        for(size_t kk = 1; kk < row_count; ++kk)
+        {
+            const double new_prob = previous[kk] + log_edges_from[kk * row_count + ii];
+            if(new_prob > prob)
+            {
+                best_row = kk;
+                prob = new_prob;
+            }
+        }
+
+        log_probs[ii] = prob + log_emissions[ii];
+        best_rows[ii] = static_cast<Row>(best_row);
+    }
+}
+
+//---------------------------------------------------------------------------
+Viterbi_column_kernel select_column_kernel(size_t rows)
+{
+    switch(rows)
+    {
+        case 2: return &max_column<Narrow_double_vector, 2>;
+        case 3: return &max_column<Narrow_double_vector, 3>;
+        case 4: return &max_column<Simd_double_vector, 4>;
+        case 8: return &max_column<Simd_double_vector, 8>;
+        default: return &max_column<Simd_double_vector, 0>;
+    }
+}
+
+//---------------------------------------------------------------------------
+Viterbi_best_rows_kernel select_best_rows_kernel(size_t rows)
+{
+    switch(rows)
+    {
+        case 2: return &best_rows_column<Narrow_double_vector, 2, uint8_t>;
+        case 3: return &best_rows_column<Narrow_double_vector, 3, uint8_t>;
+        case 4: return &best_rows_column<Simd_double_vector, 4, uint8_t>;
+        case 8: return &best_rows_column<Simd_double_vector, 8, uint8_t>;
+        default: return &best_rows_column<Simd_double_vector, 0, uint8_t>;
+    }
+}
+
+//---------------------------------------------------------------------------
+Viterbi_wide_best_rows_kernel select_wide_best_rows_kernel(size_t rows)
+{
+    switch(rows)
+    {
+        case 2: return &best_rows_column<Narrow_double_vector, 2, uint16_t>;
+        case 3: return &best_rows_column<Narrow_double_vector, 3, uint16_t>;
+        case 4: return &best_rows_column<Simd_double_vector, 4, uint16_t>;
+        case 8: return &best_rows_column<Simd_double_vector, 8, uint16_t>;
+        default: return &best_rows_column<Simd_double_vector, 0, uint16_t>;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+//---------------------------------------------------------------------------
+// One column of the Viterbi recurrence, in log space:
+//
+//      log_probs[ii] = max over kk of (previous[kk] + log_edges_from[kk][ii]) + log_emissions[ii]
+//
+// Columns are state-contiguous, and log_edges_from is [from x to], so the
+// states being computed sit in adjacent lanes, and each predecessor adds one
+// broadcast value to one contiguous row of edges.  The max over predecessors
+// then needs no horizontal reduction.  Ties go to the lowest predecessor, as
+// in the scalar recurrence, so the paths found are the same.
+typedef void (*Viterbi_column_kernel)(
+    const double* previous,         // Log probabilities of the previous column.
+    const double* log_edges_from,   // [from x to] matrix of log edge probabilities.
+    const double* log_emissions,    // Log probability of the column's emission in each state.
+    size_t rows,                    // Number of states.
+    double* log_probs);             // Log probabilities of the column.
+
+// The same, and also saves the best predecessor of each state.
+typedef void (*Viterbi_best_rows_kernel)(
+    const double* previous,
+    const double* log_edges_from,
+    const double* log_emissions,
+    size_t rows,
+    double* log_probs,
+    uint8_t* best_rows);            // Best predecessor of each state (at most 256 states).
+
+// The same, for up to 65536 states.
+typedef void (*Viterbi_wide_best_rows_kernel)(
+    const double* previous,
+    const double* log_edges_from,
+    const double* log_emissions,
+    size_t rows,
+    double* log_probs,
+    uint16_t* best_rows);
+
+// Kernels for a number of states.  Small models get kernels built for their
+// exact state count, whose loops the compiler unrolls completely.
+Viterbi_column_kernel select_column_kernel(size_t rows);
+Viterbi_best_rows_kernel select_best_rows_kernel(size_t rows);
+Viterbi_wide_best_rows_kernel select_wide_best_rows_kernel(size_t rows);
@@ -2,6 +2,8 @@
 
 #include "PreCompile.h"
 #include "Viterbi.h"
+#include "StreamingViterbi.h"
+#include "BaumWelch.h"
 #include <Shared/fasta.h>
 
 //---------------------------------------------------------------------------
@@ -35,8 +37,125 @@ size_t nucleotide_emission_index(char nucleotide)
 }
 
 //---------------------------------------------------------------------------
-int main()
+// Parameters of the model of genomic G-C content.
+static void make_gc_content_model(std::vector<double>& initial_probabilities, std::vector<double>& edges, std::vector<double>& emission_probabilities)
 {
+    // Initial probabilities.
+    // Two models: low G-C base pair content/high G-C base pair content.
+    constexpr size_t model_count = 2;
+    initial_probabilities.resize(model_count);
+    initial_probabilities[0] = 0.9999;
+    initial_probabilities[1] = 0.0001;
+
+    // Transition probabilities.
+    edges.resize(model_count * model_count);
+    edges[0 * model_count + 0] = 0.9999;
+    edges[0 * model_count + 1] = 0.0001;
+    edges[1 * model_count + 0] = 0.01;
+    edges[1 * model_count + 1] = 0.99;
+
+    // Emission probabilities.
+    constexpr size_t emission_count = 4;
+    emission_probabilities.resize(model_count * emission_count);
+    emission_probabilities[0 * emission_count + nucleotide_emission_index('A')] = 0.25; // Probabilities of low GC genomic background.
+    emission_probabilities[0 * emission_count + nucleotide_emission_index('C')] = 0.25;
+    emission_probabilities[0 * emission_count + nucleotide_emission_index('G')] = 0.25;
+    emission_probabilities[0 * emission_count + nucleotide_emission_index('T')] = 0.25;
+    emission_probabilities[1 * emission_count + nucleotide_emission_index('A')] = 0.20; // Probabilities of high GC genomic background.
+    emission_probabilities[1 * emission_count + nucleotide_emission_index('C')] = 0.30;
+    emission_probabilities[1 * emission_count + nucleotide_emission_index('G')] = 0.30;
+    emission_probabilities[1 * emission_count + nucleotide_emission_index('T')] = 0.20;
+}
+
+//---------------------------------------------------------------------------
+// Decode a genome of any size with the G-C content model, reading it in
+// chunks and printing each run of states as soon as it is known.
+static int stream_genome_file(const char* genome_filename)
+{
+    std::ifstream genome_file(genome_filename);
+    if(!genome_file)
+    {
+        std::cerr << "Unable to open " << genome_filename << ".\n";
+        return 1;
+    }
+
+    std::vector<double> initial_probabilities;
+    std::vector<double> edges;
+    std::vector<double> emission_probabilities;
+    make_gc_content_model(initial_probabilities, edges, emission_probabilities);
+
+    constexpr size_t chunk_size = 1 << 16;
+    Streaming_viterbi decoder(initial_probabilities, edges, emission_probabilities, nucleotide_emission_index);
+    print_streaming_viterbi(genome_file, decoder, chunk_size, std::cout);
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// Train the G-C content model with Baum-Welch on every record of the given
+// genomes, until the log likelihood converges, and decode each record with
+// the trained model.
+static int train_genome_files(int file_count, char* filenames[])
+{
+    std::vector<std::string> sequences;
+    for(int ii = 0; ii < file_count; ++ii)
+    {
+        std::ifstream genome_file(filenames[ii]);
+        if(!genome_file)
+        {
+            std::cerr << "Unable to open " << filenames[ii] << ".\n";
+            return 1;
+        }
+
+        Fasta_reader reader(genome_file);
+        Fasta_record record;
+        while(reader.read_record(record))
+        {
+            sequences.push_back(std::move(record.sequence));
+        }
+    }
+
+    std::vector<double> initial_probabilities;
+    std::vector<double> edges;
+    std::vector<double> emission_probabilities;
+    make_gc_content_model(initial_probabilities, edges, emission_probabilities);
+
+    std::cout << "Baum-Welch training on " << sequences.size() << " sequences..." << std::endl;
+    const size_t iteration_count = train_baum_welch(sequences, initial_probabilities, edges, emission_probabilities,
+                                                    nucleotide_emission_index, Baum_welch_options(), std::cout);
+    std::cout << "Converged after " << iteration_count << " iterations.\n";
+
+    for(auto& sequence : sequences)
+    {
+        Probability_table table(std::move(sequence),
+                                std::vector<double>(initial_probabilities),
+                                std::vector<double>(edges),
+                                std::vector<double>(emission_probabilities),
+                                nucleotide_emission_index,
+                                Viterbi_storage::chunk_parallel);
+        table.trace_back_and_save(std::cout);
+        table.print_found_sequences(std::cout, 10, 50);
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// With no arguments, decode the dice example (debug builds) and M. jannaschii.
+// With "--stream genome.fna", decode a genome of any size as it is read.
+// With "--baum-welch genome.fna...", train on genomes and decode them.
+int main(int argc, char* argv[])
+{
+    if((argc >= 3) && (std::string(argv[1]) == "--stream"))
+    {
+        return stream_genome_file(argv[2]);
+    }
+
+    if((argc >= 3) && (std::string(argv[1]) == "--baum-welch"))
+    {
+        return train_genome_files(argc - 2, argv + 2);
+    }
+
 #ifndef NDEBUG
     {
         // Exercise the Viterbi algorithm on the dice example in Durbin.
@@ -71,15 +190,332 @@ int main()
         emission_probabilities[1 * emission_count + 4] = (1.0 / 10.0);
         emission_probabilities[1 * emission_count + 5] = (1.0 / 2.0);
 
+        // No path through the first rolls is more probable than the Viterbi path.
+        {
+            constexpr size_t prefix_length = 12;
+            Probability_table table(std::string(durbin_dice, prefix_length),
+                                    std::vector<double>(initial_probabilities),
+                                    std::vector<double>(edges),
+                                    std::vector<double>(emission_probabilities),
+                                    dice_emission_index);
+            std::ostringstream ignored_output;
+            const double viterbi_log_prob = table.trace_back_and_save(ignored_output);
+
+            double max_log_prob = -std::numeric_limits<double>::infinity();
+            std::vector<size_t> path(prefix_length);
+            for(size_t path_bits = 0; path_bits < (size_t(1) << prefix_length); ++path_bits)
+            {
+                for(size_t jj = 0; jj < prefix_length; ++jj)
+                {
+                    path[jj] = (path_bits >> jj) & 1;
+                }
+                max_log_prob = std::max(max_log_prob, table.path_log_probability(path));
+            }
+
+            assert(std::abs(max_log_prob - viterbi_log_prob) < 1e-9);
+        }
+
+        // Two column tables with backpointers find the same path as the full table,
+        // bit-packed for the two dice, and in bytes with a third die that favors 1s.
+        // So do checkpoints at sqrt(300) = 18 columns apart (no budget, or one too
+        // small to meet), and 7 apart (the shortest interval for 800 bytes, past the
+        // 2400 bytes of the probable path of 300 rolls).
+        {
+            const auto check_storage = [](const std::vector<double>& initial, const std::vector<double>& transitions, const std::vector<double>& emissions)
+            {
+                std::ostringstream ignored_output;
+                const auto make_table = [&](Viterbi_storage storage, size_t memory_budget, unsigned int thread_count)
+                {
+                    return std::make_unique<Probability_table>(std::string(durbin_dice), std::vector<double>(initial), std::vector<double>(transitions),
+                                                               std::vector<double>(emissions), dice_emission_index, storage, memory_budget, thread_count);
+                };
+
+                const auto full_table = make_table(Viterbi_storage::full_table, 0, 0);
+                const double viterbi_log_prob = full_table->trace_back_and_save(ignored_output);
+
+                const auto backpointer_table = make_table(Viterbi_storage::backpointers, 0, 0);
+                assert(backpointer_table->trace_back_and_save(ignored_output) == viterbi_log_prob);
+                assert(backpointer_table->probable_path() == full_table->probable_path());
+
+                struct Budget_interval
+                {
+                    size_t memory_budget;
+                    size_t interval;
+                    bool meets_budget;
+                };
+                const Budget_interval budget_intervals[] = { { 0, 18, true }, { 100, 18, false }, { 3200, 7, true } };
+                for(const auto& budget_interval : budget_intervals)
+                {
+                    const auto checkpoint_table = make_table(Viterbi_storage::checkpoints, budget_interval.memory_budget, 0);
+                    assert(checkpoint_table->trace_back_and_save(ignored_output) == viterbi_log_prob);
+                    assert(checkpoint_table->probable_path() == full_table->probable_path());
+                    assert((initial.size() != 2) || (checkpoint_table->checkpoint_interval() == budget_interval.interval));
+                    assert((initial.size() != 2) || (checkpoint_table->meets_memory_budget() == budget_interval.meets_budget));
+                }
+
+                // Chunks sum the log probabilities in another order, so they may differ in the last bits,
+                // but any number of them finds the serial path.
+                for(unsigned int thread_count : { 1u, 2u, 4u, 7u })
+                {
+                    const auto chunk_table = make_table(Viterbi_storage::chunk_parallel, 0, thread_count);
+                    assert(std::abs(chunk_table->trace_back_and_save(ignored_output) - viterbi_log_prob) < 1e-9);
+                    assert(chunk_table->probable_path() == full_table->probable_path());
+                }
+            };
+
+            check_storage(initial_probabilities, edges, emission_probabilities);
+
+            std::vector<double> three_die_emissions(emission_probabilities);
+            three_die_emissions.insert(three_die_emissions.end(), { 0.5, 0.1, 0.1, 0.1, 0.1, 0.1 });
+            check_storage({ 0.9, 0.05, 0.05 },
+                          { 0.9, 0.05, 0.05, 0.1, 0.85, 0.05, 0.1, 0.05, 0.85 },
+                          three_die_emissions);
+
+            // Identical dice with coarse probabilities tie many paths, which chunks settle as the serial recurrence does.
+            check_storage({ 0.5, 0.5 },
+                          { 0.5, 0.5, 0.75, 0.25 },
+                          { 0.25, 0.25, 0.125, 0.125, 0.125, 0.125, 0.25, 0.25, 0.125, 0.125, 0.125, 0.125 });
+
+            // Many states run the vector kernels, for a fixed count (8 states), or
+            // for any count, with states left over past the last vector (37 states).
+            // Past 256 states, backpointers take two bytes, and chunks keep backpointers.
+            // Every storage finds the path of a plain Viterbi, a state at a time.
+            for(size_t state_count : { size_t(8), size_t(37), size_t(300) })
+            {
+                uint32_t random = 12345;
+                const auto random_distributions = [&random](size_t count, size_t size)
+                {
+                    std::vector<double> probabilities(count * size);
+                    for(size_t ii = 0; ii < count; ++ii)
+                    {
+                        double sum = 0.0;
+                        for(size_t kk = 0; kk < size; ++kk)
+                        {
+                            random = random * 1103515245 + 12345;
+                            probabilities[ii * size + kk] = ((random >> 16) & 0x7FFF) + 1.0;
+                            sum += probabilities[ii * size + kk];
+                        }
+
+                        for(size_t kk = 0; kk < size; ++kk)
+                        {
+                            probabilities[ii * size + kk] /= sum;
+                        }
+                    }
+
+                    return probabilities;
+                };
+
+                const std::vector<double> initial = random_distributions(1, state_count);
+                const std::vector<double> transitions = random_distributions(state_count, state_count);
+                const std::vector<double> emissions = random_distributions(state_count, emission_count);
+                check_storage(initial, transitions, emissions);
+
+                const size_t roll_count = sizeof(durbin_dice) - 1;
+                std::vector<double> log_probs(roll_count * state_count);
+                std::vector<size_t> best_rows(roll_count * state_count);
+                for(size_t ii = 0; ii < state_count; ++ii)
+                {
+                    log_probs[ii] = log(initial[ii]) + log(emissions[ii * emission_count + dice_emission_index(durbin_dice[0])]);
+                }
+
+                for(size_t jj = 1; jj < roll_count; ++jj)
+                {
+                    for(size_t ii = 0; ii < state_count; ++ii)
+                    {
+                        double prob = log_probs[(jj - 1) * state_count] + log(transitions[ii]);
+                        for(size_t kk = 1; kk < state_count; ++kk)
+                        {
+                            const double new_prob = log_probs[(jj - 1) * state_count + kk] + log(transitions[kk * state_count + ii]);
+                            if(new_prob > prob)
+                            {
+                                best_rows[jj * state_count + ii] = kk;
+                                prob = new_prob;
+                            }
+                        }
+
+                        log_probs[jj * state_count + ii] = prob + log(emissions[ii * emission_count + dice_emission_index(durbin_dice[jj])]);
+                    }
+                }
+
+                const double* last_column = &log_probs[(roll_count - 1) * state_count];
+                std::vector<size_t> path(roll_count);
+                path.back() = std::max_element(last_column, last_column + state_count) - last_column;
+                for(size_t jj = roll_count - 1; jj > 0; --jj)
+                {
+                    path[jj - 1] = best_rows[jj * state_count + path[jj]];
+                }
+
+                Probability_table table(std::string(durbin_dice),
+                                        std::vector<double>(initial),
+                                        std::vector<double>(transitions),
+                                        std::vector<double>(emissions),
+                                        dice_emission_index);
+                std::ostringstream ignored_output;
+                assert(table.trace_back_and_save(ignored_output) == last_column[path.back()]);
+                assert(table.probable_path() == path);
+
+                for(Viterbi_storage storage : { Viterbi_storage::backpointers, Viterbi_storage::chunk_parallel })
+                {
+                    Probability_table storage_table(std::string(durbin_dice),
+                                                    std::vector<double>(initial),
+                                                    std::vector<double>(transitions),
+                                                    std::vector<double>(emissions),
+                                                    dice_emission_index,
+                                                    storage,
+                                                    0,
+                                                    2);
+                    assert(std::abs(storage_table.trace_back_and_save(ignored_output) - last_column[path.back()]) < 1e-9);
+                    assert(storage_table.probable_path() == path);
+                    assert(storage_table.storage() == (((Viterbi_storage::chunk_parallel == storage) && (state_count > 256)) ? Viterbi_storage::backpointers : storage));
+                }
+            }
+        }
+
         {
             std::string dice(durbin_dice);
             Probability_table table(std::move(dice),
-                                    std::move(initial_probabilities),
-                                    std::move(edges),
-                                    std::move(emission_probabilities),
+                                    std::vector<double>(initial_probabilities),
+                                    std::vector<double>(edges),
+                                    std::vector<double>(emission_probabilities),
                                     dice_emission_index);
-            table.trace_back_and_save(std::cout);
+            const double viterbi_log_prob = table.trace_back_and_save(std::cout);
             table.print_dice_rolls(std::cout);
+
+            // The traced back path scores the Viterbi log probability.
+            assert(std::abs(table.path_log_probability(table.probable_path()) - viterbi_log_prob) < 1e-9);
+
+            // The trace back counted one hit per return to the fair die.
+            const std::vector<size_t>& probable_path = table.probable_path();
+            size_t hit_count = 0;
+            for(size_t jj = 1; jj < probable_path.size(); ++jj)
+            {
+                hit_count += (0 != probable_path[jj - 1]) && (0 == probable_path[jj]);
+            }
+            assert(table.count_hits() == hit_count);
+
+            // Viterbi training counts the same path in chunks as in one table,
+            // until the path stops changing, and then it stays put.
+            {
+                std::ostringstream ignored_output;
+                const auto make_table = [&](Viterbi_storage storage)
+                {
+                    return std::make_unique<Probability_table>(std::string(durbin_dice), std::vector<double>(initial_probabilities), std::vector<double>(edges),
+                                                               std::vector<double>(emission_probabilities), dice_emission_index, storage, 0, 4);
+                };
+
+                const auto full_table = make_table(Viterbi_storage::full_table);
+                const auto chunk_table = make_table(Viterbi_storage::chunk_parallel);
+                full_table->trace_back_and_save(ignored_output);
+                chunk_table->trace_back_and_save(ignored_output);
+                assert(full_table->path_changed() && chunk_table->path_changed());
+
+                unsigned int training_count = 0;
+                while(full_table->path_changed() && (training_count < 100))
+                {
+                    full_table->train_and_print(ignored_output);
+                    chunk_table->train_and_print(ignored_output);
+                    assert(chunk_table->probable_path() == full_table->probable_path());
+                    assert(chunk_table->path_changed() == full_table->path_changed());
+                    ++training_count;
+                }
+
+                const std::vector<size_t> converged_path = full_table->probable_path();
+                full_table->train_and_print(ignored_output);
+                assert(!full_table->path_changed() && (full_table->probable_path() == converged_path));
+
+                // The first trace back changes the path, even one that never leaves the fair die.
+                for(Viterbi_storage storage : { Viterbi_storage::full_table, Viterbi_storage::backpointers, Viterbi_storage::checkpoints, Viterbi_storage::chunk_parallel })
+                {
+                    Probability_table fair_table(std::string(100, '1'),
+                                                 std::vector<double>(initial_probabilities),
+                                                 std::vector<double>(edges),
+                                                 std::vector<double>(emission_probabilities),
+                                                 dice_emission_index,
+                                                 storage,
+                                                 0,
+                                                 2);
+                    fair_table.trace_back_and_save(ignored_output);
+                    assert(fair_table.probable_path() == std::vector<size_t>(100, 0));
+                    assert(fair_table.path_changed());
+                }
+            }
+
+            // Decoding the rolls a few at a time finds the same path, without holding all of them.
+            Streaming_viterbi decoder(initial_probabilities, edges, emission_probabilities, dice_emission_index);
+            std::vector<State_segment> segments;
+            for(size_t first = 0; first < sizeof(durbin_dice) - 1; first += 7)
+            {
+                decoder.decode(std::string(durbin_dice + first, std::min<size_t>(7, sizeof(durbin_dice) - 1 - first)), segments);
+            }
+            assert(decoder.finish(segments) == viterbi_log_prob);
+            assert(decoder.max_window_size() < decoder.column_count());
+
+            std::vector<size_t> path;
+            for(const auto& segment : segments)
+            {
+                path.insert(path.end(), segment.end - segment.begin, segment.state);
+            }
+            assert(path == table.probable_path());
+        }
+
+        // Baum-Welch finds the likelihood of every path through the first rolls,
+        // and gives the same parameters however the rolls are split into chunks
+        // and threads.  Training never lowers the likelihood.
+        {
+            constexpr size_t prefix_length = 12;
+            Probability_table table(std::string(durbin_dice, prefix_length),
+                                    std::vector<double>(initial_probabilities),
+                                    std::vector<double>(edges),
+                                    std::vector<double>(emission_probabilities),
+                                    dice_emission_index);
+
+            double sum_of_paths = 0.0;
+            std::vector<size_t> path(prefix_length);
+            for(size_t path_bits = 0; path_bits < (size_t(1) << prefix_length); ++path_bits)
+            {
+                for(size_t jj = 0; jj < prefix_length; ++jj)
+                {
+                    path[jj] = (path_bits >> jj) & 1;
+                }
+                sum_of_paths += exp(table.path_log_probability(path));
+            }
+
+            std::vector<double> initial(initial_probabilities);
+            std::vector<double> transitions(edges);
+            std::vector<double> emissions(emission_probabilities);
+            Baum_welch_options options;
+            options.chunk_size = 5;
+            options.thread_count = 3;
+            const double log_likelihood = baum_welch_step({ std::string(durbin_dice, prefix_length) }, initial, transitions, emissions, dice_emission_index, options);
+            assert(std::abs(log_likelihood - log(sum_of_paths)) < 1e-9);
+
+            // Two copies of the rolls, and the rolls split at another point.
+            const std::vector<std::string> sequences = { std::string(durbin_dice), std::string(durbin_dice + 100, 200) };
+            std::vector<double> chunked_initial(initial_probabilities);
+            std::vector<double> chunked_transitions(edges);
+            std::vector<double> chunked_emissions(emission_probabilities);
+            const double chunked_log_likelihood = baum_welch_step(sequences, chunked_initial, chunked_transitions, chunked_emissions, dice_emission_index, options);
+
+            initial = initial_probabilities;
+            transitions = edges;
+            emissions = emission_probabilities;
+            options.chunk_size = 1000;
+            options.thread_count = 1;
+            assert(std::abs(baum_welch_step(sequences, initial, transitions, emissions, dice_emission_index, options) - chunked_log_likelihood) < 1e-9);
+
+            const auto near = [](const std::vector<double>& a, const std::vector<double>& b)
+            {
+                return std::equal(a.cbegin(), a.cend(), b.cbegin(), [](double x, double y) { return std::abs(x - y) < 1e-12; });
+            };
+            assert(near(initial, chunked_initial) && near(transitions, chunked_transitions) && near(emissions, chunked_emissions));
+
+            double previous_log_likelihood = chunked_log_likelihood;
+            for(unsigned int ii = 0; ii < 5; ++ii)
+            {
+                const double next_log_likelihood = baum_welch_step(sequences, initial, transitions, emissions, dice_emission_index, options);
+                assert(next_log_likelihood >= previous_log_likelihood - 1e-9);
+                previous_log_likelihood = next_log_likelihood;
+            }
         }
     }
 #endif
@@ -88,31 +524,10 @@ int main()
         // Exercise the Viterbi algorithm on M. jannaschii.
         std::cout << "HMM Viterbi of M. jannaschii:\n";
 
-        // Initial probabilities.
-        // Two models: low G-C base pair content/high G-C base pair content.
-        constexpr size_t model_count = 2;
-        std::vector<double> initial_probabilities(model_count);
-        initial_probabilities[0] = 0.9999;
-        initial_probabilities[1] = 0.0001;
-
-        // Transition probabilities.
-        std::vector<double> edges(model_count * model_count);
-        edges[0 * model_count + 0] = 0.9999;
-        edges[0 * model_count + 1] = 0.0001;
-        edges[1 * model_count + 0] = 0.01;
-        edges[1 * model_count + 1] = 0.99;
-
-        // Emission probabilities.
-        constexpr size_t emission_count = 4;
-        std::vector<double> emission_probabilities(model_count * emission_count);
-        emission_probabilities[0 * emission_count + nucleotide_emission_index('A')] = 0.25; // Probabilities of low GC genomic background.
-        emission_probabilities[0 * emission_count + nucleotide_emission_index('C')] = 0.25;
-        emission_probabilities[0 * emission_count + nucleotide_emission_index('G')] = 0.25;
-        emission_probabilities[0 * emission_count + nucleotide_emission_index('T')] = 0.25;
-        emission_probabilities[1 * emission_count + nucleotide_emission_index('A')] = 0.20; // Probabilities of high GC genomic background.
-        emission_probabilities[1 * emission_count + nucleotide_emission_index('C')] = 0.30;
-        emission_probabilities[1 * emission_count + nucleotide_emission_index('G')] = 0.30;
-        emission_probabilities[1 * emission_count + nucleotide_emission_index('T')] = 0.20;
+        std::vector<double> initial_probabilities;
+        std::vector<double> edges;
+        std::vector<double> emission_probabilities;
+        make_gc_content_model(initial_probabilities, edges, emission_probabilities);
 
         // Read in the sequence data.
         std::cout << "Reading NC_000909.fna..." << std::endl;
@@ -121,18 +536,33 @@ int main()
 
         std::cout << "Beginning analysis..." << std::endl;
         {
+            // Decode one chunk of the genome on each hardware thread, instead of
+            // keeping the full table, which is 16 bytes per nucleotide for two states.
             Probability_table table(std::move(sample_data),
                                     std::move(initial_probabilities),
                                     std::move(edges),
                                     std::move(emission_probabilities),
-                                    nucleotide_emission_index);
+                                    nucleotide_emission_index,
+                                    Viterbi_storage::chunk_parallel);
             table.trace_back_and_save(std::cout);
             table.print_found_sequences(std::cout, 0, 0);
 
-            // Do Viterbi training 10 times.
-            for(unsigned int ii = 0; ii < 10; ++ii)
+            // Do Viterbi training until the path stops changing (at most 100 times).
+            constexpr unsigned int max_training_count = 100;
+            unsigned int training_count = 0;
+            while(table.path_changed() && (training_count < max_training_count))
             {
                 table.train_and_print(std::cout);
+                ++training_count;
+            }
+
+            if(table.path_changed())
+            {
+                std::cout << "Viterbi training stopped after " << training_count << " iterations without converging.\n";
+            }
+            else
+            {
+                std::cout << "Viterbi training converged after " << training_count << " iterations.\n";
             }
 
             // Print first 10 sequences of at least 50 nucleotides.